@@ -1,10 +1,22 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Buffers are hashed on (dev, blockno) into NBUCKET buckets,
+// each with its own lock, so lookups of different blocks
+// don't contend. There is no global LRU list: brelse() stamps
+// a buffer with the current ticks, and bget() recycles the
+// unused buffer with the oldest stamp.
+//
+// The NBUF static buffers are only the minimum. While more
+// than a quarter of RAM is free, a miss adds a page's worth
+// of buffers from kalloc() (up to NBPAGE pages); when
+// kalloc() runs out it calls bshrink(), which gives back
+// the pages none of whose buffers are in use.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -19,73 +31,302 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "ktrace.h"
+
+#define NBUCKET 13
+#define NBPAGE 256    // most pages of extra buffers
+
+// A page of extra buffers.
+struct bpage {
+  struct bpage *next;
+  struct buf buf[(PGSIZE - sizeof(void*)) / sizeof(struct buf)];
+};
+
+#define BPERPAGE (sizeof(((struct bpage*)0)->buf) / sizeof(struct buf))
+
+struct bucket {
+  struct spinlock lock;
+  struct buf head;   // circular list through prev/next
+};
 
 struct {
+  // serializes recycling, which moves buffers
+  // between buckets. never held by a cache hit.
   struct spinlock lock;
   struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  struct bpage *pages;  // extra buffers, under lock
+  int npage;
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // statistics, for statsbcache().
+  int nhit;       // bget()s that found the block cached
+  int nmiss;      // bget()s that recycled a buffer
+  int nshrink;    // pages given back by bshrink()
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+static void
+binsert(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  // All buffers start out unused in bucket 0.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    binsert(&bcache.bucket[0], b);
   }
 }
 
+// Free a page of extra buffers, and forget their locks.
+static void
+bfreepage(struct bpage *pg)
+{
+  struct buf *b;
+
+  for(b = pg->buf; b < pg->buf+BPERPAGE; b++)
+    freelock(&b->lock.lk);
+  kfree(pg);
+}
+
+// Add a page of unused buffers to bucket 0. Called with
+// no bcache locks held, since kalloc() may call bshrink().
+static void
+bgrow(void)
+{
+  struct bpage *pg;
+  struct buf *b;
+
+  if((pg = kalloc()) == 0)
+    return;
+  memset(pg, 0, sizeof(*pg));
+  for(b = pg->buf; b < pg->buf+BPERPAGE; b++)
+    initsleeplock(&b->lock, "buffer");
+
+  acquire(&bcache.lock);
+  if(bcache.npage >= NBPAGE){
+    release(&bcache.lock);
+    bfreepage(pg);
+    return;
+  }
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  bcache.npage++;
+  acquire(&bcache.bucket[0].lock);
+  for(b = pg->buf; b < pg->buf+BPERPAGE; b++)
+    binsert(&bcache.bucket[0], b);
+  release(&bcache.bucket[0].lock);
+  release(&bcache.lock);
+}
+
+// Give back the pages of extra buffers that are all unused;
+// called by kalloc() when memory runs out. Their blocks
+// are clean, since the log holds on to the ones it hasn't
+// written home. Returns the number of pages freed.
+int
+bshrink(void)
+{
+  struct bpage *pg, **pp, *freed;
+  struct bucket *bk;
+  struct buf *b;
+  int n;
+
+  acquire(&bcache.lock);
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    acquire(&bk->lock);
+
+  freed = 0;
+  n = 0;
+  for(pp = &bcache.pages; (pg = *pp) != 0; ){
+    for(b = pg->buf; b < pg->buf+BPERPAGE; b++)
+      if(b->refcnt != 0)
+        break;
+    if(b < pg->buf+BPERPAGE){
+      pp = &pg->next;
+      continue;
+    }
+    for(b = pg->buf; b < pg->buf+BPERPAGE; b++)
+      bunlink(b);
+    *pp = pg->next;
+    pg->next = freed;
+    freed = pg;
+    n++;
+  }
+  bcache.npage -= n;
+  bcache.nshrink += n;
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    release(&bk->lock);
+  release(&bcache.lock);
+
+  // free them after the locks are gone.
+  while((pg = freed) != 0){
+    freed = pg->next;
+    bfreepage(pg);
+  }
+  return n;
+}
+
+// Look for block (dev, blockno) in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For read-ahead (prefetch set), only a newly allocated buffer
+// is returned; returns 0 if the block is already cached or
+// no buffer is free.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int prefetch)
 {
-  struct buf *b;
+  struct buf *b, *victim;
+  struct bucket *bk, *vbk, *obk;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(prefetch){
+      release(&bk->lock);
+      return 0;
+    }
+    b->refcnt++;
+    release(&bk->lock);
+    __sync_fetch_and_add(&bcache.nhit, 1);
+    ktrace(KT_BHIT, dev, blockno);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  // Not cached. Use free memory for more buffers, if
+  // there is plenty; not for read-ahead, which is only
+  // a hint.
+  if(!prefetch && bcache.npage < NBPAGE &&
+     kfreepages() > (PHYSTOP - KERNBASE) / PGSIZE / 4)
+    bgrow();
+
+  // Only one process at a time recycles, so
+  // it may hold its home bucket lock while it looks at
+  // the others without risking deadlock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+
+  // Someone else may have cached it while we waited.
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(prefetch){
+      release(&bk->lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return 0;
     }
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    __sync_fetch_and_add(&bcache.nhit, 1);
+    ktrace(KT_BHIT, dev, blockno);
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached.
   // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  for(;;){
+    victim = 0;
+    vbk = 0;
+    for(obk = bcache.bucket; obk < bcache.bucket+NBUCKET; obk++){
+      if(obk != bk)
+        acquire(&obk->lock);
+      for(b = obk->head.next; b != &obk->head; b = b->next){
+        if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+          victim = b;
+          vbk = obk;
+        }
+      }
+      if(obk != bk)
+        release(&obk->lock);
+    }
+    if(victim == 0){
+      if(prefetch){
+        release(&bk->lock);
+        release(&bcache.lock);
+        return 0;
+      }
+      panic("bget: no buffers");
     }
+
+    if(vbk != bk)
+      acquire(&vbk->lock);
+    // a cache hit may have grabbed it since we looked.
+    if(victim->refcnt == 0)
+      break;
+    if(vbk != bk)
+      release(&vbk->lock);
+  }
+
+  if(vbk != bk){
+    bunlink(victim);
+    release(&vbk->lock);
+    binsert(bk, victim);
   }
-  panic("bget: no buffers");
+  victim->dev = dev;
+  victim->blockno = blockno;
+#ifdef RAMDISK
+  victim->data = ramdiskblock(blockno);
+  victim->valid = 1;
+#else
+  victim->valid = 0;
+#endif
+  victim->refcnt = 1;
+  bcache.nmiss++;
+  release(&bk->lock);
+  release(&bcache.lock);
+  ktrace(KT_BMISS, dev, blockno);
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +335,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,52 +343,150 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block, zero-filled
+// rather than read from disk, for a block whose old contents
+// don't matter. A cached copy is overwritten.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
+// Start reading the n blocks in blocknos into the cache,
+// without waiting for them. Blocks that are already cached
+// are skipped. Each buffer stays locked until its read
+// completes, when virtio_disk_intr() calls bradone().
+// Read-ahead is only a hint, so this quietly gives up
+// on blocks for which no buffer is free.
+void
+breadahead(uint dev, uint *blocknos, int n)
+{
+  struct buf *b;
+
+#ifdef RAMDISK
+  return;  // nothing to wait for
+#endif
+  for(int i = 0; i < n; i++){
+    if((b = bget(dev, blocknos[i], 1)) == 0)
+      continue;
+    b->readahead = 1;
+    disownsleep(&b->lock);
+    virtio_disk_start(b, b->blockno, 0);
+  }
+  virtio_disk_kick();
+}
+
+// Finish a read started by breadahead(), in interrupt
+// context: mark the buffer valid and release it on
+// behalf of the process that started the read.
+void
+bradone(struct buf *b)
+{
+  struct bucket *bk;
+
+  b->readahead = 0;
+  b->valid = 1;
+  releasesleep(&b->lock);
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0)
+    b->lastuse = ticks;
+  release(&bk->lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
+#ifdef RAMDISK
+  ramdiskwrite(b, b->blockno);
+#else
   virtio_disk_rw(b, 1);
+#endif
+}
+
+// Write the contents of n locked buffers to disk as one batch,
+// and wait for all of them. bufs[i] is written to block
+// blocknos[i], or to its own block if blocknos is 0; the log
+// uses this to write cached blocks straight into the log.
+void
+bwritev(struct buf **bufs, uint *blocknos, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwritev");
+#ifdef RAMDISK
+    ramdiskwrite(bufs[i], blocknos ? blocknos[i] : bufs[i]->blockno);
+#else
+    virtio_disk_start(bufs[i], blocknos ? blocknos[i] : bufs[i]->blockno, 1);
+#endif
+  }
+#ifndef RAMDISK
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bufs[i]);
+#endif
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Stamp it with the time of last use for LRU recycling.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Format buffer cache counters into buf.
+// Returns the number of bytes written.
+int
+statsbcache(char *buf, int sz)
+{
+  return snprintf(buf, sz,
+                  "--- bcache stats\n#hit %d #miss %d #buf %d #shrink %d\n",
+                  bcache.nhit, bcache.nmiss, NBUF + bcache.npage * (int)BPERPAGE,
+                  bcache.nshrink);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 
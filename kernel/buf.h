@@ -1,12 +1,19 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  struct waitq wq; // waiting for the disk, under the disk's lock
+  int readahead; // read started by breadahead(); release when done
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks at last release, for LRU eviction
+  struct buf *prev; // hash bucket list
   struct buf *next;
+#ifdef RAMDISK
+  uchar *data;      // the block in the ramdisk image
+#else
   uchar data[BSIZE];
+#endif
 };
 
@@ -1,19 +1,32 @@
 struct buf;
 struct context;
+struct dirent;
 struct file;
 struct inode;
+struct iovec;
+struct kcache;
+struct mbuf;
 struct pipe;
+struct pollwait;
 struct proc;
+struct sock;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct waitq;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, uint*, int);
+void            breadahead(uint, uint*, int);
+void            bradone(struct buf*);
+int             statsbcache(char*, int);
+int             bshrink(void);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -24,6 +37,9 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execseg(pagetable_t, uint64, uint64);
+int             execfault(pagetable_t, uint64);
+void            segtrim(struct proc*, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -31,13 +47,20 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, uint*);
+int             filewritev(struct file*, struct iovec*, int, uint*);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filepoll(struct file*, int, struct pollwait*);
+void            pollregister(struct pollwait*, struct pollwait**, struct spinlock*);
+void            pollremove(struct pollwait*);
+void            pollwake(struct pollwait**);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+int             dirnext(struct inode*, uint*, struct dirent*, struct stat*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
@@ -46,48 +69,119 @@ void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+void            iflushall(void);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
+struct inode*   nameiat(struct inode*, char*);
+struct inode*   nameiparentat(struct inode*, char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+void            dcacheforget(struct inode*, char*);
+int             statsdcache(char*, int);
 
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+uchar*          ramdiskblock(uint);
+void            ramdiskwrite(struct buf*, uint);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kzalloc(void);
+int             kprezero(void);
 void            kfree(void *);
 void            kinit(void);
+void            kinithart(void);
+void            kdup(void *);
+int             krefcnt(void *);
+int             statskmem(char*, int);
+int             kfreepages(void);
+void*           kalloc2m(void);
+void            kfree2m(void *);
+
+// slab.c
+void            slabinit(void);
+void            kcacheinit(struct kcache*, char*, uint);
+void*           kcalloc(struct kcache*);
+void            kcfree(struct kcache*, void*);
+int             statsslab(char*, int);
+
+// mmap.c
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+int             mmapfault(pagetable_t, uint64, int);
+void            munmapall(struct proc*);
+int             mmapfork(struct proc*, struct proc*);
+uint64          mmapbase(struct proc*);
+void            shminit(void);
+uint64          shmcreate(char*, uint64);
+uint64          shmattach(char*, uint64);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint, uint);
+void            pcacheinval(struct inode*);
+int             pcacheshrink(void);
+int             statspcache(char*, int);
+
+// ktrace.c
+void            ktraceinit(void);
+void            ktrace(int, uint64, uint64);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
+void            log_free(uint);
+int             log_direct(uint, int);
+void            log_sync(void);
+int             statslog(char*, int);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipepoll(struct pipe*, int, struct pollwait*);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// stats.c
+void            statsinit(void);
+
+// prof.c
+extern uint64   profcycles;
+void            profinit(void);
+void            profsample(void);
+int             profile(uint64);
+
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
-void            proc_mapstacks(pagetable_t);
+int             clone(uint64, uint64, uint64);
+int             spawn(char*, char**, int*, int);
+int             join(uint64);
+int             sharedvm(struct proc*);
+int             growproc(int, uint64*);
 pagetable_t     proc_pagetable(struct proc *);
+int             proc_mapfixed(struct proc *, pagetable_t);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
 int             killed(struct proc*);
@@ -102,10 +196,19 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeproc(struct proc*, void*);
+void            sleepon(struct waitq*, struct spinlock*);
+void            wakeq(struct waitq*);
 void            yield(void);
+void            preempt(int);
+int             setpriority(int, int);
+int             kthread(void (*)(void), char*);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             statscpu(char*, int);
+int             pollsleep(int);
+void            pollwakeproc(struct proc*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -114,6 +217,8 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            freelock(struct spinlock*);
+int             statslock(char*, int);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
@@ -121,6 +226,7 @@ void            pop_off(void);
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+void            disownsleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -133,6 +239,14 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(int, struct superblock*);
+int             swapout(char**, uint*, int);
+void            swapin(uint, char*);
+void            swapdup(uint);
+void            swapfree(uint);
+int             swapavail(void);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -140,6 +254,7 @@ void            argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+int             statssyscall(char*, int);
 
 // trap.c
 extern uint     ticks;
@@ -147,11 +262,17 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+uint64          clocktime(void);
+void            clockresume(void);
+int             clocksleep(int);
+void            clockalarm(uint64);
+void            clockcancel(void);
+void            ipi(int);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
-void            uartputc(int);
+void            uartwrite(char*, int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -167,23 +288,60 @@ uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+uint64          uvmsatp(struct proc*);
+void            uvmflush(pagetable_t, uint64);
 void            uvmclear(pagetable_t, uint64);
+void            uvmmovetop(pagetable_t, pagetable_t);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             uvmfault(pagetable_t, uint64, int);
+int             uvminstall(pagetable_t, uint64, uint64, int);
+int             uvmshare(pagetable_t, uint64, uint64*);
+int             uvmremap(pagetable_t, uint64, uint64);
+char*           uvmpagealloc(pagetable_t, uint64);
 
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
+void            plic_diskroute(int);
 int             plic_claim(void);
 void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, uint, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_kick(void);
 void            virtio_disk_intr(void);
 
+#ifdef LAB_NET
+// pci.c
+void            pci_init();
+
+// e1000.c
+void            e1000_init(uint32 *);
+void            e1000_intr(void);
+int             e1000_transmit(struct mbuf*);
+
+// net.c
+void            mbufinit(void);
+void            net_rx(struct mbuf*);
+void            net_tx_udp(struct mbuf*, uint32, uint16, uint16);
+
+// sysnet.c
+void            sockinit(void);
+int             sockalloc(struct file **, uint32, uint16, uint16);
+void            sockclose(struct sock *);
+int             sockread(struct sock *, struct iovec*, int);
+int             sockwrite(struct sock *, struct iovec*, int);
+int             sockrecvpage(struct sock *, uint64, int*);
+int             sockpoll(struct sock *, struct pollwait*);
+void            sockrecvudp(struct mbuf*, uint32, uint16, uint16);
+#endif
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
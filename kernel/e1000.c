@@ -0,0 +1,208 @@
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "e1000_dev.h"
+#include "net.h"
+
+//
+// driver for qemu's Intel 82540EM (e1000) network card.
+//
+// Both rings have many descriptors, each pointing at the
+// page of an mbuf, which the card reads or writes directly.
+// Received packets are handed up the stack in the mbufs the
+// card wrote them into, and each descriptor gets a fresh
+// mbuf from the pool; a sent packet's mbuf stays with its
+// descriptor until the card is done with it.
+//
+// Interrupts are coalesced: the card waits RXDELAY for more
+// packets before interrupting, and interrupts at most every
+// ITRATE. e1000_intr() then takes every packet that has
+// arrived and gives the ring back with one tail write;
+// e1000_transmit() similarly queues a whole chain of packets
+// and tells the card once.
+//
+
+#define TX_RING_SIZE 64
+static struct tx_desc tx_ring[TX_RING_SIZE] __attribute__((aligned(16)));
+static struct mbuf *tx_mbufs[TX_RING_SIZE];
+
+#define RX_RING_SIZE 64
+static struct rx_desc rx_ring[RX_RING_SIZE] __attribute__((aligned(16)));
+static struct mbuf *rx_mbufs[RX_RING_SIZE];
+
+// interrupt coalescing, in the card's units.
+#define ITRATE  500   // 256ns: at most ~8000 interrupts/second
+#define RXDELAY 32    // 1.024us: wait this long for another packet,
+#define RXMAX   128   //   but no longer than this after the first
+
+// remember where the e1000's registers live.
+static volatile uint32 *regs;
+
+struct spinlock e1000_txlock;  // tx_ring, tx_mbufs
+struct spinlock e1000_rxlock;  // rx_ring, rx_mbufs
+
+// called by pci_init().
+// xregs is the memory address at which the
+// e1000's registers are mapped.
+void
+e1000_init(uint32 *xregs)
+{
+  int i;
+
+  initlock(&e1000_txlock, "e1000tx");
+  initlock(&e1000_rxlock, "e1000rx");
+
+  regs = xregs;
+
+  // Reset the device
+  regs[E1000_IMS] = 0; // disable interrupts
+  regs[E1000_CTL] |= E1000_CTL_RST;
+  regs[E1000_IMS] = 0; // redisable interrupts
+  __sync_synchronize();
+
+  // [E1000 14.5] Transmit initialization
+  memset(tx_ring, 0, sizeof(tx_ring));
+  for (i = 0; i < TX_RING_SIZE; i++) {
+    tx_ring[i].status = E1000_TXD_STAT_DD;
+    tx_mbufs[i] = 0;
+  }
+  regs[E1000_TDBAL] = (uint64) tx_ring;
+  if(sizeof(tx_ring) % 128 != 0)
+    panic("e1000");
+  regs[E1000_TDLEN] = sizeof(tx_ring);
+  regs[E1000_TDH] = regs[E1000_TDT] = 0;
+  
+  // [E1000 14.4] Receive initialization
+  memset(rx_ring, 0, sizeof(rx_ring));
+  for (i = 0; i < RX_RING_SIZE; i++) {
+    rx_mbufs[i] = mbufalloc(0);
+    if (!rx_mbufs[i])
+      panic("e1000");
+    rx_ring[i].addr = (uint64) rx_mbufs[i]->head;
+  }
+  regs[E1000_RDBAL] = (uint64) rx_ring;
+  if(sizeof(rx_ring) % 128 != 0)
+    panic("e1000");
+  regs[E1000_RDH] = 0;
+  regs[E1000_RDT] = RX_RING_SIZE - 1;
+  regs[E1000_RDLEN] = sizeof(rx_ring);
+
+  // filter by qemu's MAC address, 52:54:00:12:34:56
+  regs[E1000_RA] = 0x12005452;
+  regs[E1000_RA+1] = 0x5634 | (1<<31);
+  // multicast table
+  for (int i = 0; i < 4096/32; i++)
+    regs[E1000_MTA + i] = 0;
+
+  // transmitter control bits.
+  regs[E1000_TCTL] = E1000_TCTL_EN |  // enable
+    E1000_TCTL_PSP |                  // pad short packets
+    (0x10 << E1000_TCTL_CT_SHIFT) |   // collision stuff
+    (0x40 << E1000_TCTL_COLD_SHIFT);
+  regs[E1000_TIPG] = 10 | (8<<10) | (6<<20); // inter-pkt gap
+
+  // receiver control bits.
+  regs[E1000_RCTL] = E1000_RCTL_EN | // enable receiver
+    E1000_RCTL_BAM |                 // enable broadcast
+    E1000_RCTL_SZ_2048 |             // 2048-byte rx buffers
+    E1000_RCTL_SECRC;                // strip CRC
+  
+  // ask e1000 for receive interrupts, coalesced. sent
+  // packets' descriptors are reaped by e1000_transmit(),
+  // so there's no need for transmit interrupts.
+  regs[E1000_ITR] = ITRATE;
+  regs[E1000_RDTR] = RXDELAY;
+  regs[E1000_RADV] = RXMAX;
+  regs[E1000_IMS] = E1000_ICR_RXT0 | E1000_ICR_RXO;
+}
+
+// Queue the chain of packets m (linked by next) for
+// sending, telling the card about all of them at once. The
+// mbufs are the driver's from now on; packets that don't
+// fit in the ring are dropped.
+// Returns 0, or -1 if any were dropped.
+int
+e1000_transmit(struct mbuf *m)
+{
+  struct mbuf *next;
+  uint tail;
+  int r = 0;
+
+  acquire(&e1000_txlock);
+  tail = regs[E1000_TDT];
+  for(; m; m = next){
+    next = m->next;
+    m->next = 0;
+    // a descriptor the card hasn't finished with means
+    // the ring is full.
+    if((tx_ring[tail].status & E1000_TXD_STAT_DD) == 0){
+      mbuffree(m);
+      r = -1;
+      continue;
+    }
+    if(tx_mbufs[tail])
+      mbuffree(tx_mbufs[tail]);
+    tx_ring[tail].addr = (uint64) m->head;
+    tx_ring[tail].length = m->len;
+    tx_ring[tail].cmd = E1000_TXD_CMD_EOP | E1000_TXD_CMD_RS;
+    tx_ring[tail].status = 0;
+    tx_mbufs[tail] = m;
+    tail = (tail + 1) % TX_RING_SIZE;
+  }
+  __sync_synchronize();
+  regs[E1000_TDT] = tail;
+  release(&e1000_txlock);
+  return r;
+}
+
+// Take all the packets the card has received, refill
+// their descriptors, and hand the packets up the stack.
+static void
+e1000_recv(void)
+{
+  struct mbufq q;
+  struct mbuf *m, *fresh;
+  uint i, last;
+
+  mbufq_init(&q);
+  acquire(&e1000_rxlock);
+  last = regs[E1000_RDT];
+  for(i = (last + 1) % RX_RING_SIZE;
+      rx_ring[i].status & E1000_RXD_STAT_DD;
+      i = (i + 1) % RX_RING_SIZE){
+    m = rx_mbufs[i];
+    // keep a packet only if there's an mbuf to replace
+    // it; otherwise drop it and reuse its buffer.
+    if((rx_ring[i].status & E1000_RXD_STAT_EOP) &&
+       (fresh = mbufalloc(0)) != 0){
+      mbufput(m, rx_ring[i].length);
+      mbufq_pushtail(&q, m);
+      rx_mbufs[i] = fresh;
+      rx_ring[i].addr = (uint64) fresh->head;
+    }
+    rx_ring[i].status = 0;
+    last = i;
+  }
+  // give the refilled descriptors back at once.
+  __sync_synchronize();
+  regs[E1000_RDT] = last;
+  release(&e1000_rxlock);
+
+  while((m = mbufq_pophead(&q)) != 0)
+    net_rx(m);
+}
+
+void
+e1000_intr(void)
+{
+  // tell the e1000 we've seen this interrupt;
+  // without this the e1000 won't raise any
+  // further interrupts.
+  regs[E1000_ICR] = 0xffffffff;
+
+  e1000_recv();
+}
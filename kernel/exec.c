@@ -19,17 +19,44 @@ int flags2perm(int flags)
     return perm;
 }
 
+// Can exec() move the page tables at the top of p's address
+// space into the new image, rather than make new ones? They
+// must map nothing but the trampoline, trapframe and
+// USYSCALL pages, which are the same in both: no files,
+// threads' trapframes or heap. exec() checks once it knows
+// the new image's size that it doesn't reach there either.
+static int
+topmovable(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->used)
+      return 0;
+  return p->tslots == 0 && PGROUNDUP(p->sz) <= UTOPTABLE;
+}
+
+// Replace p's image with the program path. On success the
+// new image keeps argv, which must come from fetchargv(),
+// as its argument pages; on failure argv is still the
+// caller's.
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
+  int i, off, top = 0, nargpages = 0;
+  uint64 argc, sz = 0, sp = 0, va;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
+  struct inode *exe = 0, *oldexe;
+  struct seg seg[NSEG];
+  int nseg = 0;
+
+  if(sharedvm(p))
+    return -1;
 
   begin_op();
 
@@ -46,10 +73,14 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pagetable = proc_pagetable(p)) == 0)
+  // the new image's top page tables come from the old one
+  // at the commit, if they can.
+  top = topmovable(p);
+  if((pagetable = top ? uvmcreate() : proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments for execfault() to page
+  // in; only load them now if there are too many.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,6 +92,18 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > UTOP || ph.off + ph.filesz < ph.off)
+      goto bad;
+    if(nseg < NSEG && ph.vaddr >= PGROUNDUP(sz)){
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].memsz = ph.memsz;
+      seg[nseg].off = ph.off;
+      seg[nseg].filesz = ph.filesz;
+      seg[nseg].perm = PTE_R | PTE_U | flags2perm(ph.flags);
+      nseg++;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
       goto bad;
@@ -68,8 +111,9 @@ exec(char *path, char **argv)
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   p = myproc();
@@ -82,32 +126,46 @@ exec(char *path, char **argv)
   uint64 sz1;
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE, PTE_W)) == 0)
     goto bad;
-  sz = sz1;
-  uvmclear(pagetable, sz-2*PGSIZE);
-  sp = sz;
-  stackbase = sp - PGSIZE;
+  uvmclear(pagetable, sz);
+  sp = sz = sz1;
 
-  // Push argument strings, prepare rest of stack in ustack.
-  for(argc = 0; argv[argc]; argc++) {
+  // The argv[] array, then the argument strings, go in
+  // pages of their own above the stack, so a long argument
+  // list doesn't use it up. They are fetchargv()'s pages,
+  // mapped rather than copied: argv[]'s, then each page
+  // that a string starts.
+  for(argc = 0; argv[argc]; argc++)
     if(argc >= MAXARG)
       goto bad;
-    sp -= strlen(argv[argc]) + 1;
-    sp -= sp % 16; // riscv sp must be 16-byte aligned
-    if(sp < stackbase)
-      goto bad;
-    if(copyout(pagetable, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
+  if(mappages(pagetable, sp, PGSIZE, (uint64)argv, PTE_R|PTE_W|PTE_U) != 0)
+    goto bad;
+  nargpages = 1;
+  for(i = 0; i < argc; i++){
+    if((uint64)argv[i] % PGSIZE == 0){
+      if(mappages(pagetable, sp + nargpages*PGSIZE, PGSIZE, (uint64)argv[i],
+                  PTE_R|PTE_W|PTE_U) != 0)
+        goto bad;
+      nargpages++;
+    }
+  }
+  sz = sp + nargpages*PGSIZE;
+
+  // a program loaded up into the top gigabyte has page tables
+  // of its own there, so the old ones can't move after all.
+  if(top && sz > UTOPTABLE){
+    if(proc_mapfixed(p, pagetable) < 0)
       goto bad;
-    ustack[argc] = sp;
+    top = 0;
   }
-  ustack[argc] = 0;
 
-  // push the array of argv[] pointers.
-  sp -= (argc+1) * sizeof(uint64);
-  sp -= sp % 16;
-  if(sp < stackbase)
-    goto bad;
-  if(copyout(pagetable, sp, (char *)ustack, (argc+1)*sizeof(uint64)) < 0)
-    goto bad;
+  // Point argv[] at where the strings are in user space;
+  // the page was zeroed, so it ends in a null pointer.
+  va = sp;
+  for(i = 0; i < argc; i++){
+    if((uint64)argv[i] % PGSIZE == 0)
+      va += PGSIZE;
+    argv[i] = (char*)(va + (uint64)argv[i] % PGSIZE);
+  }
 
   // arguments to user main(argc, argv)
   // argc is returned via the system call return
@@ -121,25 +179,153 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  munmapall(p);
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
+  p->noasid = 0;
+  uvmflush(pagetable, -1);  // the old one's entries have p's ASIDs
   p->sz = sz;
+  p->exe = exe;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  if(top){
+    uvmmovetop(oldpagetable, pagetable);
+    uvmfree(oldpagetable, oldsz);
+  } else {
+    proc_freepagetable(oldpagetable, oldsz);
+  }
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz);
+  if(pagetable){
+    // argv's pages are still the caller's.
+    uvmunmap(pagetable, sp, nargpages, 0);
+    if(top)
+      uvmfree(pagetable, sz);
+    else
+      proc_freepagetable(pagetable, sz);
+  }
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
+// Find the segment of p's program containing va, if
+// pagetable is p's.
+static struct seg*
+seglookup(struct proc *p, pagetable_t pagetable, uint64 va)
+{
+  struct seg *s;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return 0;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(va >= s->va && va < s->va + s->memsz)
+      return s;
+  }
+  return 0;
+}
+
+// Does [va, va+len) overlap a segment of the current
+// process's program?
+int
+execseg(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct seg *s;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return 0;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(va < s->va + s->memsz && va + len > s->va)
+      return 1;
+  }
+  return 0;
+}
+
+// Map the page of the current process's program at va, on
+// its first touch. Pages holding file contents come from the
+// page cache, shared with other processes running the same
+// program, copy-on-write if the segment is writable; the
+// rest of the segment is zeros.
+// Returns 0 on success, -1 if va isn't in a segment, out of
+// memory, or the file can't be read.
+int
+execfault(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct seg *s;
+  uint64 i;
+  uint n;
+  int perm, nested;
+  char *mem;
+
+  if((s = seglookup(p, pagetable, va)) == 0)
+    return -1;
+
+  // reading the file may sleep; see mmapfault().
+  push_off();
+  nested = mycpu()->noff > 1;
+  pop_off();
+  if(nested)
+    return -1;
+
+  va = PGROUNDDOWN(va);
+  i = va - s->va;
+  perm = s->perm;
+  if(i < s->filesz){
+    n = s->filesz - i;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    if((mem = pcacheget(p->exe, s->off + i, n)) == 0)
+      return -1;
+    if(perm & PTE_W)
+      perm = (perm & ~PTE_W) | PTE_COW;
+  } else {
+    if((mem = uvmpagealloc(pagetable, va)) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+  }
+  if(uvminstall(pagetable, va, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// p's memory is shrinking to sz: forget the segments
+// above it, so that growing again gives zeros.
+void
+segtrim(struct proc *p, uint64 sz)
+{
+  struct seg *s;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(s->va >= sz)
+      s->memsz = 0;
+    else if(s->va + s->memsz > sz)
+      s->memsz = sz - s->va;
+    if(s->filesz > s->memsz)
+      s->filesz = s->memsz;
+  }
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
@@ -3,3 +3,31 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// mmap() protection and flags.
+#define PROT_NONE       0x0
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define PROT_EXEC       0x4
+
+#define MAP_SHARED      0x01
+#define MAP_PRIVATE     0x02
+
+// poll() events.
+#define POLLIN    0x001   // can read without blocking
+#define POLLOUT   0x004   // can write without blocking
+#define POLLHUP   0x010   // the other end of a pipe is closed
+#define POLLNVAL  0x020   // not an open file descriptor
+
+// one descriptor for poll().
+struct pollfd {
+  int fd;
+  short events;    // POLLIN and POLLOUT to wait for
+  short revents;   // what is ready, set by poll()
+};
+
+// one buffer of a readv() or writev().
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
@@ -12,35 +12,36 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "slab.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
+
+// file structures come from filecache, so there's no fixed
+// limit on open files. lock protects every file's ref.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kcache filecache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kcacheinit(&ftable.filecache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
+// Returns 0 if out of memory.
 struct file*
 filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kcalloc(&ftable.filecache)) == 0)
+    return 0;
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +70,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kcfree(&ftable.filecache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -80,6 +80,11 @@ fileclose(struct file *f)
     iput(ff.ip);
     end_op();
   }
+#ifdef LAB_NET
+  else if(ff.type == FD_SOCK){
+    sockclose(ff.sock);
+  }
+#endif
 }
 
 // Get metadata about file f.
@@ -101,82 +106,251 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// Read from file f into the cnt user buffers in iov, in
+// order, stopping early at the end of the data. Reads at *off
+// if off is non-zero, which only files support; otherwise at
+// f's offset, which it advances.
+// Returns the number of bytes read, or -1 if an error came
+// before any were.
 int
-fileread(struct file *f, uint64 addr, int n)
+filereadv(struct file *f, struct iovec *iov, int cnt, uint *off)
 {
-  int r = 0;
+  int i, r, tot;
+  uint64 addr;
 
   if(f->readable == 0)
     return -1;
+  if(off != 0 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
-      return -1;
-    r = devsw[f->major].read(1, addr, n);
-  } else if(f->type == FD_INODE){
+  tot = 0;
+  if(f->type == FD_INODE){
+    if(off == 0)
+      off = &f->off;
+    // one ilock for all of it, so that the read
+    // isn't interleaved with writes.
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, *off, iov[i].iov_len)) < 0){
+        // what was read so far has moved the offset.
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      *off += r;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
     iunlock(f->ip);
-  } else {
-    panic("fileread");
+    return tot;
   }
+#ifdef LAB_NET
+  if(f->type == FD_SOCK)
+    return sockread(f->sock, iov, cnt);
+#endif
 
-  return r;
+  for(i = 0; i < cnt; i++){
+    addr = (uint64)iov[i].iov_base;
+    if(f->type == FD_PIPE){
+      r = piperead(f->pipe, addr, iov[i].iov_len);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+        return -1;
+      r = devsw[f->major].read(1, addr, iov[i].iov_len);
+    } else {
+      panic("fileread");
+    }
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    // don't wait for more once some data has arrived.
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return tot;
 }
 
-// Write to file f.
-// addr is a user virtual address.
+// Write the cnt user buffers in iov to file f, in order. Writes
+// at *off if off is non-zero, which only files support;
+// otherwise at f's offset, which it advances.
+// Returns the number of bytes written, fewer than asked if an
+// error stopped it part way, or -1 if it wrote none.
 int
-filewrite(struct file *f, uint64 addr, int n)
+filewritev(struct file *f, struct iovec *iov, int cnt, uint *off)
 {
-  int r, ret = 0;
+  int i, r, n, n1, tot, left, err;
+  uint64 done;
 
   if(f->writable == 0)
     return -1;
+  if(off != 0 && f->type != FD_INODE)
+    return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+#ifdef LAB_NET
+  if(f->type == FD_SOCK)
+    return sockwrite(f->sock, iov, cnt);
+#endif
+
+  n = 0;
+  for(i = 0; i < cnt; i++)
+    n += iov[i].iov_len;
+
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    if(f->type == FD_DEVICE &&
+       (f->major < 0 || f->major >= NDEV || !devsw[f->major].write))
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+    tot = 0;
+    for(i = 0; i < cnt; i++){
+      if(f->type == FD_PIPE)
+        r = pipewrite(f->pipe, (uint64)iov[i].iov_base, iov[i].iov_len);
+      else
+        r = devsw[f->major].write(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
+  }
+
+  if(f->type != FD_INODE)
+    panic("filewrite");
+  if(off == 0)
+    off = &f->off;
 
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // a transaction takes as many of the buffers as fit,
+  // since together they're one contiguous write.
+  // writei() mostly writes data blocks in place, but
+  // may have to log any of them.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((WRITEOPBLOCKS-1-1-2) / 2) * BSIZE;
+  tot = 0;
+  i = 0;
+  done = 0;   // bytes of iov[i] written
+  err = 0;
+  while(tot < n && !err){
+    begin_opn(WRITEOPBLOCKS);
+    ilock(f->ip);
+    for(left = max; left > 0 && i < cnt; ){
+      n1 = iov[i].iov_len - done;
+      if(n1 > left)
+        n1 = left;
+      if((r = writei(f->ip, 1, (uint64)iov[i].iov_base + done, *off, n1)) > 0){
+        *off += r;
+        tot += r;
+        done += r;
+        left -= r;
+      }
       if(r != n1){
         // error from writei
+        err = 1;
         break;
       }
-      i += r;
+      if(done == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+    iunlock(f->ip);
+    end_op();
   }
+  // a partial write has moved the offset; say how far.
+  return tot > 0 || n == 0 ? tot : -1;
+}
+
+// Read from file f.
+// addr is a user virtual address.
+int
+fileread(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, 0);
+}
 
-  return ret;
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, 0);
 }
 
+
+// Add pw to the list of pollers at *head, under lk,
+// which the caller holds.
+void
+pollregister(struct pollwait *pw, struct pollwait **head, struct spinlock *lk)
+{
+  pw->head = head;
+  pw->lk = lk;
+  pw->next = *head;
+  *head = pw;
+}
+
+// Take pw off the list pollregister() put it on, if any.
+void
+pollremove(struct pollwait *pw)
+{
+  struct pollwait **pp;
+
+  if(pw->head == 0)
+    return;
+  acquire(pw->lk);
+  for(pp = pw->head; *pp != pw; pp = &(*pp)->next)
+    ;
+  *pp = pw->next;
+  release(pw->lk);
+  pw->head = 0;
+}
+
+// Wake the pollers on a list, when the file may have become
+// readable or writable. Caller must hold the list's lock.
+void
+pollwake(struct pollwait **head)
+{
+  struct pollwait *pw;
+
+  for(pw = *head; pw; pw = pw->next)
+    pollwakeproc(pw->p);
+}
+
+// Which of events (POLLIN, POLLOUT) f is ready for, and
+// POLLHUP. If pw isn't 0 it is added to f's pollers, for
+// poll() to wait on; the caller must pollremove() it.
+int
+filepoll(struct file *f, int events, struct pollwait *pw)
+{
+  int r;
+
+  if(f->type == FD_PIPE){
+    r = pipepoll(f->pipe, f->writable, pw);
+  } else if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+            devsw[f->major].poll){
+    r = devsw[f->major].poll(pw);
+#ifdef LAB_NET
+  } else if(f->type == FD_SOCK){
+    r = sockpoll(f->sock, pw);
+#endif
+  } else {
+    r = POLLIN | POLLOUT;
+  }
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r & (events | POLLHUP);
+}
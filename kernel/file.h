@@ -1,5 +1,5 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_SOCK } type;
   int ref; // reference count
   char readable;
   char writable;
@@ -7,6 +7,7 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  struct sock *sock; // FD_SOCK
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -18,23 +19,47 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // hash chain, or free list if ref is 0
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int dirty;          // on itable.dirty, for writeback at commit
+  struct inode *dnext;
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+  uint alast;         // last data block bmap() returned
+
+  uint ralast;        // last block read by readi(), for read-ahead
+  uint rawin;         // read-ahead window, in blocks
+  uint raend;         // read-ahead has been started up to here
+};
+
+// A poll() waiting on one file: on the list at *head,
+// which lk protects, for pollwake() to wake p.
+struct pollwait {
+  struct proc *p;
+  struct pollwait *next;
+  struct pollwait **head;
+  struct spinlock *lk;
 };
 
 // map major device number to device functions.
+// poll, if set, returns the device's POLLIN/POLLOUT
+// readiness, and adds its pollwait argument, if not 0, to
+// the device's list; a device without one is always ready.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollwait*);
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define STATS   2
+#define PROFILE 3
+#define KTRACE  4
@@ -22,10 +22,26 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define WBATCH 16   // data blocks writei() writes at once
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+// In-memory summary of the free block bitmap, so that balloc()
+// needn't read bitmap blocks with nothing free. nfree[i] is
+// changed only with bitmap block i locked. low is a hint:
+// balloc() finds a free block below it, if there is one,
+// by wrapping around.
+#define NBMAP (FSSIZE / BPB + 1)
+static struct {
+  uint low;          // no free block below this, most likely
+  int nfree[NBMAP];  // free blocks covered by each bitmap block
+} bsum;
+
+static void bsuminit(int);
+static void dcacheinit(void);
+static void dcachepurge(struct inode*);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +60,8 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
+  swapinit(dev, &sb);
 }
 
 // Zero a block.
@@ -60,24 +78,65 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint
-balloc(uint dev)
+// Count the free blocks in the bitmap, after recovery.
+static void
+bsuminit(int dev)
 {
   int b, bi, m;
   struct buf *bp;
 
-  bp = 0;
+  if((sb.size + BPB - 1) / BPB > NBMAP)
+    panic("bsuminit: disk too big");
+  bsum.low = sb.size;
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
+    bsum.nfree[b / BPB] = 0;
     for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0){
+        bsum.nfree[b / BPB]++;
+        if(b + bi < bsum.low)
+          bsum.low = b + bi;
+      }
+    }
+    brelse(bp);
+  }
+}
+
+// Allocate a disk block, the first free one at or after
+// goal, wrapping around to the start of the disk. goal 0
+// asks for the first free block on the disk. The block is
+// zeroed if zero is set; file data blocks aren't, since
+// bytes past the end of a file are never read.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal, int zero)
+{
+  int b, bi, m, n, nmap, first;
+  struct buf *bp;
+
+  first = goal == 0 || goal >= sb.size;
+  if(first)
+    goal = bsum.low < sb.size ? bsum.low : 0;
+  nmap = (sb.size + BPB - 1) / BPB;
+  // goal's bitmap block comes round again at the end, for
+  // the blocks before goal.
+  for(n = 0; n <= nmap; n++){
+    b = ((goal / BPB + n) % nmap) * BPB;
+    if(bsum.nfree[b / BPB] == 0)  // racy peek; it's only a hint
+      continue;
+    bp = bread(dev, BBLOCK(b, sb));
+    for(bi = n == 0 ? goal % BPB : 0; bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
+        bsum.nfree[b / BPB]--;
+        if(first)
+          bsum.low = b + bi + 1;
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
+        if(zero)
+          bzero(dev, b + bi);
         return b + bi;
       }
     }
@@ -100,8 +159,12 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  bsum.nfree[b / BPB]++;
+  if(b < bsum.low)
+    bsum.low = b;
   log_write(bp);
   brelse(bp);
+  log_free(b);
 }
 
 // Inodes.
@@ -164,28 +227,59 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// Entries in use are hashed on (dev, inum) into NIBUCKET
+// buckets, so that iget()s of different inodes don't contend.
+// A bucket's lock protects ip->ref, ip->dev, ip->inum and
+// ip->next of the entries in it. Free entries are kept on
+// itable.free, protected by itable.lock; an entry moves
+// between the two with both locks held, bucket lock first.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// Inode writeback is deferred: iupdate() puts the inode's
+// block in the transaction and the inode on itable.dirty,
+// and the commit copies all the dirty inodes into their
+// blocks at once, grouped by block, when the transaction
+// closes (iflushall()). An entry is flushed before iput()
+// lets it go. ip->dirty and ip->dnext are protected by
+// itable.lock.
+
+#define NIBUCKET 31
+
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;
+};
 
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *free;    // entries with ref 0
+  struct inode *dirty;   // entries iupdate()d since the last commit
+  struct ibucket bucket[NIBUCKET];
 } itable;
 
+static struct ibucket*
+ihash(uint dev, uint inum)
+{
+  return &itable.bucket[(dev * 31 + inum) % NIBUCKET];
+}
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  for(i = 0; i < NIBUCKET; i++)
+    initlock(&itable.bucket[i].lock, "itable.bucket");
+  dcacheinit();
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    itable.inode[i].next = itable.free;
+    itable.free = &itable.inode[i];
   }
 }
 
@@ -218,60 +312,137 @@ ialloc(uint dev, short type)
   return 0;
 }
 
-// Copy a modified in-memory inode to disk.
+// Copy an in-memory inode to its disk inode.
+static void
+icopy(struct inode *ip, struct dinode *dip)
+{
+  dip->type = ip->type;
+  dip->major = ip->major;
+  dip->minor = ip->minor;
+  dip->nlink = ip->nlink;
+  dip->size = ip->size;
+  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+}
+
+// Mark a modified in-memory inode to be written to disk.
 // Must be called after every change to an ip->xxx field
-// that lives on disk.
+// that lives on disk. The inode's block joins the
+// transaction now, so that it counts against the system
+// call's log space; the inode itself is copied into it
+// when the transaction commits.
 // Caller must hold ip->lock.
 void
 iupdate(struct inode *ip)
 {
   struct buf *bp;
-  struct dinode *dip;
+
+  acquire(&itable.lock);
+  if(ip->dirty){
+    release(&itable.lock);
+    return;
+  }
+  ip->dirty = 1;
+  ip->dnext = itable.dirty;
+  itable.dirty = ip;
+  release(&itable.lock);
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-  dip = (struct dinode*)bp->data + ip->inum%IPB;
-  dip->type = ip->type;
-  dip->major = ip->major;
-  dip->minor = ip->minor;
-  dip->nlink = ip->nlink;
-  dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
 }
 
+// Write a dirty inode into its block now, and take it off
+// itable.dirty. Caller must hold ip->lock.
+static void
+iflush(struct inode *ip)
+{
+  struct inode **pp;
+  struct buf *bp;
+
+  acquire(&itable.lock);
+  if(!ip->dirty){
+    release(&itable.lock);
+    return;
+  }
+  for(pp = &itable.dirty; *pp != ip; pp = &(*pp)->dnext)
+    ;
+  *pp = ip->dnext;
+  ip->dirty = 0;
+  release(&itable.lock);
+
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  icopy(ip, (struct dinode*)bp->data + ip->inum%IPB);
+  brelse(bp);
+}
+
+// Copy every dirty inode into its block, reading each
+// block once for all of its inodes. Called by commit()
+// when a transaction closes, with no system calls active
+// in it, so nothing is changing the inodes.
+void
+iflushall(void)
+{
+  struct inode *ip, **pp, *list;
+  struct buf *bp;
+
+  acquire(&itable.lock);
+  list = itable.dirty;
+  itable.dirty = 0;
+  for(ip = list; ip; ip = ip->dnext)
+    ip->dirty = 0;
+  release(&itable.lock);
+
+  while(list){
+    bp = bread(list->dev, IBLOCK(list->inum, sb));
+    for(pp = &list; (ip = *pp) != 0; ){
+      if(ip->dev == bp->dev && IBLOCK(ip->inum, sb) == bp->blockno){
+        icopy(ip, (struct dinode*)bp->data + ip->inum%IPB);
+        *pp = ip->dnext;
+      } else {
+        pp = &ip->dnext;
+      }
+    }
+    brelse(bp);
+  }
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct ibucket *bk;
 
-  acquire(&itable.lock);
+  bk = ihash(dev, inum);
+  acquire(&bk->lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = bk->head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
-      release(&itable.lock);
+      release(&bk->lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
   // Recycle an inode entry.
-  if(empty == 0)
+  acquire(&itable.lock);
+  if((ip = itable.free) == 0)
     panic("iget: no inodes");
+  itable.free = ip->next;
+  release(&itable.lock);
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&itable.lock);
+  ip->ralast = ip->rawin = ip->raend = 0;
+  ip->alast = 0;
+  ip->next = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
 
   return ip;
 }
@@ -281,9 +452,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -294,6 +467,7 @@ ilock(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
+  uint blocknos[2];
 
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
@@ -301,6 +475,12 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
+    // start reading the next inode block along with this
+    // one: an ls or a find goes through a directory's
+    // inodes, which are mostly allocated in order.
+    blocknos[0] = IBLOCK(ip->inum, sb);
+    blocknos[1] = blocknos[0] + 1;
+    breadahead(ip->dev, blocknos, blocknos[1] <= IBLOCK(sb.ninodes-1, sb) ? 2 : 1);
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
@@ -336,7 +516,10 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+  struct inode **pp;
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,7 +528,7 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&bk->lock);
 
     itrunc(ip);
     ip->type = 0;
@@ -354,11 +537,31 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
+  }
+
+  // the entry may be reused once it is free, so write
+  // the inode out first.
+  while(ip->ref == 1 && ip->dirty){
+    acquiresleep(&ip->lock);
+    release(&bk->lock);
+    iflush(ip);
+    releasesleep(&ip->lock);
+    acquire(&bk->lock);
   }
 
   ip->ref--;
-  release(&itable.lock);
+  if(ip->ref == 0){
+    // move the entry to the free list.
+    for(pp = &bk->head; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+    acquire(&itable.lock);
+    ip->next = itable.free;
+    itable.free = ip;
+    release(&itable.lock);
+  }
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -374,7 +577,35 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// are listed in the blocks listed in block ip->addrs[NDIRECT+1].
+//
+// A data block is allocated as close as possible after the
+// one bmap() last returned, so that a file written
+// sequentially is contiguous on disk. Index blocks are
+// allocated from the start of the disk, out of the way.
+
+// Return entry i of index block addr, allocating a block
+// near goal for it if there is none, zeroed if zero is set.
+// returns 0 if out of disk space.
+static uint
+bindex(struct inode *ip, uint addr, uint i, uint goal, int zero)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    addr = balloc(ip->dev, goal, zero);
+    if(addr){
+      a[i] = addr;
+      log_write(bp);
+    }
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -382,16 +613,20 @@ iunlockput(struct inode *ip)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, goal;
+  int zero;
+
+  goal = ip->alast ? ip->alast + 1 : 0;
+  zero = ip->type != T_FILE;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, goal, zero);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
     }
+    ip->alast = addr;
     return addr;
   }
   bn -= NDIRECT;
@@ -399,25 +634,55 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, 0, 1);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
     }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
+  } else {
+    bn -= NINDIRECT;
+    if(bn >= NDINDIRECT)
+      panic("bmap: out of range");
+
+    // Load the doubly-indirect block, then the
+    // indirect block it lists for bn.
+    if((addr = ip->addrs[NDIRECT+1]) == 0){
+      addr = balloc(ip->dev, 0, 1);
+      if(addr == 0)
+        return 0;
+      ip->addrs[NDIRECT+1] = addr;
     }
-    brelse(bp);
-    return addr;
+    if((addr = bindex(ip, addr, bn / NINDIRECT, 0, 1)) == 0)
+      return 0;
+    bn %= NINDIRECT;
   }
 
-  panic("bmap: out of range");
+  if((addr = bindex(ip, addr, bn, goal, zero)) != 0)
+    ip->alast = addr;
+  return addr;
+}
+
+// Free the blocks listed in index block addr, and it.
+// depth 1 for an indirect block, 2 for a doubly-indirect one.
+static void
+bfreeindex(struct inode *ip, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      bfreeindex(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -425,9 +690,11 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  pcacheinval(ip);
+  if(ip->type == T_DIR)
+    dcachepurge(ip);
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -437,16 +704,14 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeindex(ip, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
+  if(ip->addrs[NDIRECT+1]){
+    bfreeindex(ip, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+  ip->alast = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -464,6 +729,49 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Sequential read-ahead.
+// A read that starts in or just after the block where the
+// previous readi() ended is sequential. Each sequential read
+// doubles the window, up to RAMAX blocks, and starts reading
+// the window's blocks past the end of this read into the
+// buffer cache; the read that needs them then finds them
+// cached, or already on their way. Any other read resets
+// the window.
+#define RAMAX 8
+
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, last, nb, start, end, i;
+  uint addrs[RAMAX];
+
+  bn = off / BSIZE;
+  last = (off + n - 1) / BSIZE;
+  if(bn == ip->ralast || bn == ip->ralast + 1){
+    ip->rawin = ip->rawin ? min(2 * ip->rawin, RAMAX) : 1;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ralast = last;
+  if(ip->rawin == 0)
+    return;
+
+  nb = (ip->size + BSIZE - 1) / BSIZE;
+  start = ip->raend > last + 1 ? ip->raend : last + 1;
+  end = min(last + 1 + ip->rawin, nb);
+  for(i = 0; start + i < end; i++){
+    // blocks below ip->size are always allocated,
+    // so bmap() won't allocate here.
+    if((addrs[i] = bmap(ip, start + i)) == 0)
+      break;
+  }
+  if(i > 0){
+    ip->raend = start + i;
+    breadahead(ip->dev, addrs, i);
+  }
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -478,6 +786,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -506,30 +816,66 @@ int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  struct buf *bp, *batch[WBATCH];
+  int nb, fresh, direct;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // a regular file's data blocks are written in place rather
+  // than through the log (ordered data mode), in batches of
+  // up to WBATCH, before the transaction that changes the
+  // file's metadata commits. see log_direct() for when a
+  // block must still go through the log.
+  nb = 0;
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    // past the end of the file, the old contents don't
+    // matter, so don't read them.
+    fresh = off/BSIZE >= (ip->size + BSIZE - 1)/BSIZE;
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
+    direct = ip->type == T_FILE && log_direct(addr, fresh);
+    if(fresh || (direct && m == BSIZE))
+      bp = bnew(ip->dev, addr);
+    else
+      bp = bread(ip->dev, addr);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+      if(direct && !fresh)
+        bp->valid = 0;  // don't keep a half-written copy
       brelse(bp);
       break;
     }
-    log_write(bp);
-    brelse(bp);
+    if(!direct){
+      log_write(bp);
+      brelse(bp);
+      continue;
+    }
+    batch[nb++] = bp;
+    if(nb == WBATCH){
+      bwritev(batch, 0, nb);
+      while(nb > 0)
+        brelse(batch[--nb]);
+    }
+  }
+  if(nb > 0){
+    bwritev(batch, 0, nb);
+    while(nb > 0)
+      brelse(batch[--nb]);
   }
 
   if(off > ip->size)
     ip->size = off;
 
+  // running programs mustn't pick up pages of the new
+  // contents; drop them after the copy, which may itself
+  // have faulted some in.
+  if(tot > 0)
+    pcacheinval(ip);
+
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
   // block to ip->addrs[].
@@ -546,17 +892,154 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name lookup cache.
+//
+// Remembers the results of dirlookup(), keyed on the
+// directory and the name: the entry's inum and offset, or
+// that the name isn't there (inum 0). The entries of a
+// directory change only with it locked, in dirlink(),
+// dcacheforget() and itrunc(), so a lookup, which also holds
+// the directory's lock, never sees a stale entry.
+
+#define NDCACHE 64
+
+struct dentry {
+  uint dev;
+  uint dinum;         // directory; 0 if the slot is free
+  uint hash;          // of name
+  char name[DIRSIZ];
+  uint inum;          // 0 if name isn't in the directory
+  uint off;           // of the dirent, if inum != 0
+  uint lastuse;       // ticks, for LRU replacement
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry d[NDCACHE];
+
+  // statistics, for statsdcache().
+  int nhit;
+  int nmiss;
+} dcache;
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static uint
+dhash(char *name)
+{
+  uint h = 0;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h;
+}
+
+// Find dp's entry for name. Caller must hold dcache.lock.
+static struct dentry*
+dcachefind(struct inode *dp, char *name, uint h)
+{
+  struct dentry *d;
+
+  for(d = dcache.d; d < &dcache.d[NDCACHE]; d++){
+    if(d->dinum == dp->inum && d->dev == dp->dev && d->hash == h &&
+       namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+// Remember that name in dp is inum at off (inum 0: absent).
+static void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h = dhash(name);
+
+  acquire(&dcache.lock);
+  if((d = dcachefind(dp, name, h)) == 0){
+    for(struct dentry *e = dcache.d; e < &dcache.d[NDCACHE]; e++){
+      if(e->dinum == 0){
+        d = e;
+        break;
+      }
+      if(d == 0 || e->lastuse < d->lastuse)
+        d = e;
+    }
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    d->hash = h;
+    strncpy(d->name, name, DIRSIZ);
+  }
+  d->inum = inum;
+  d->off = off;
+  d->lastuse = ticks;
+  release(&dcache.lock);
+}
+
+// name is being removed from dp.
+void
+dcacheforget(struct inode *dp, char *name)
+{
+  dcacheenter(dp, name, 0, 0);
+}
+
+// Forget every entry of directory dp, which is being freed.
+static void
+dcachepurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.d; d < &dcache.d[NDCACHE]; d++){
+    if(d->dinum == dp->inum && d->dev == dp->dev)
+      d->dinum = 0;
+  }
+  release(&dcache.lock);
+}
+
+// Format name cache counters into buf.
+// Returns the number of bytes written.
+int
+statsdcache(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- dcache stats\n#hit %d #miss %d\n",
+                  dcache.nhit, dcache.nmiss);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, h;
   struct dirent de;
+  struct dentry *d;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  h = dhash(name);
+  acquire(&dcache.lock);
+  if((d = dcachefind(dp, name, h)) != 0){
+    d->lastuse = ticks;
+    dcache.nhit++;
+    inum = d->inum;
+    off = d->off;
+    release(&dcache.lock);
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  dcache.nmiss++;
+  release(&dcache.lock);
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +1050,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcacheenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcacheenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -601,10 +1086,54 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcacheenter(dp, name, inum, off);
 
   return 0;
 }
 
+// Read the next entry in use of directory dp, at or after
+// byte offset *off, into *de, and the stat of the inode it
+// names into *st. Advances *off past the entry.
+// Caller must hold dp->lock, and be in a transaction,
+// since the inode may be the last reference to a file
+// unlinked meanwhile. Returns 1, or 0 at the end of dp.
+int
+dirnext(struct inode *dp, uint *off, struct dirent *de, struct stat *st)
+{
+  struct inode *ip;
+
+  for(; *off + sizeof(*de) <= dp->size; *off += sizeof(*de)){
+    if(readi(dp, 0, (uint64)de, *off, sizeof(*de)) != sizeof(*de))
+      panic("dirnext read");
+    if(de->inum == 0)
+      continue;
+    *off += sizeof(*de);
+
+    if(de->inum == dp->inum){
+      stati(dp, st);
+    } else if(namecmp(de->name, "..") == 0){
+      // the parent must be locked before dp, so
+      // let go of dp meanwhile, as namex() does.
+      ip = iget(dp->dev, de->inum);
+      iunlock(dp);
+      ilock(ip);
+      stati(ip, st);
+      iunlock(ip);
+      ilock(dp);
+      iput(ip);
+    } else {
+      // dp is locked, so the entry can't be
+      // unlinked and its inode freed under us.
+      ip = iget(dp->dev, de->inum);
+      ilock(ip);
+      stati(ip, st);
+      iunlockput(ip);
+    }
+    return 1;
+  }
+  return 0;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -644,17 +1173,20 @@ skipelem(char *path, char *name)
   return path;
 }
 
-// Look up and return the inode for a path name.
+// Look up and return the inode for a path name, which if
+// relative starts at directory dp, or the cwd if dp is 0.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
 // Must be called inside a transaction since it calls iput().
 static struct inode*
-namex(char *path, int nameiparent, char *name)
+namex(struct inode *dp, char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
+  else if(dp)
+    ip = idup(dp);
   else
     ip = idup(myproc()->cwd);
 
@@ -687,11 +1219,26 @@ struct inode*
 namei(char *path)
 {
   char name[DIRSIZ];
-  return namex(path, 0, name);
+  return namex(0, path, 0, name);
 }
 
 struct inode*
 nameiparent(char *path, char *name)
 {
-  return namex(path, 1, name);
+  return namex(0, path, 1, name);
+}
+
+// Like namei() and nameiparent(), but a relative path
+// starts at directory dp rather than the cwd.
+struct inode*
+nameiat(struct inode *dp, char *path)
+{
+  char name[DIRSIZ];
+  return namex(dp, path, 0, name);
+}
+
+struct inode*
+nameiparentat(struct inode *dp, char *path, char *name)
+{
+  return namex(dp, path, 1, name);
 }
@@ -0,0 +1,106 @@
+//
+// Futexes: sleeping on a word of user memory.
+//
+// futexwait(addr, val) sleeps if the int at addr still holds
+// val, and futexwake(addr, n) wakes up to n of the sleepers
+// on addr. User code keeps its locks in such words, and
+// calls into the kernel only when it must wait, or wake a
+// waiter (see user/usync.c). Checking the word and going to
+// sleep happen under the hash bucket's lock, which
+// futexwake() takes too, so a wakeup can't be missed between
+// them.
+//
+// A futex is named by its user address in the waiter's page
+// table, so only threads of one process (which share a page
+// table) can use one together.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 31
+
+struct bucket {
+  struct spinlock lock;
+  struct waitq q;     // waiters on futexes that hash here
+};
+
+static struct bucket futextab[NFUTEX];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futextab[i].lock, "futex");
+}
+
+static struct bucket*
+fhash(pagetable_t pagetable, uint64 addr)
+{
+  return &futextab[((uint64)pagetable / PGSIZE + addr / sizeof(int)) % NFUTEX];
+}
+
+// Sleep until futexwake(addr), if the int at user address
+// addr is val. May also return early, like any wait for a
+// condition; callers check their condition again.
+// Returns 0 once woken, or -1 if *addr isn't val, addr is
+// bad, or the process was killed.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct bucket *b;
+  int v;
+
+  if(addr % sizeof(int) != 0)
+    return -1;
+  // fault the page in now: copyin() can't sleep for a
+  // demand-paged page under the bucket lock.
+  if(copyin(p->pagetable, (char *)&v, addr, sizeof(v)) < 0)
+    return -1;
+
+  b = fhash(p->pagetable, addr);
+  acquire(&b->lock);
+  if(copyin(p->pagetable, (char *)&v, addr, sizeof(v)) < 0 ||
+     v != val || killed(p)){
+    release(&b->lock);
+    return -1;
+  }
+  p->futex = addr;
+  sleepon(&b->q, &b->lock);
+  p->futex = 0;
+  release(&b->lock);
+  return killed(p) ? -1 : 0;
+}
+
+// Wake up to n processes sleeping in futexwait(addr) with the
+// current process's page table. Returns the number woken.
+int
+futexwake(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct bucket *b;
+  struct proc *w, **wp;
+  int woken = 0;
+
+  b = fhash(p->pagetable, addr);
+  acquire(&b->lock);
+  wp = &b->q.head;
+  while((w = *wp) != 0 && woken < n){
+    if(w->futex == addr && w->pagetable == p->pagetable){
+      *wp = w->wqnext;
+      w->wq = 0;
+      wakeproc(w, &b->q);
+      woken++;
+    } else {
+      wp = &w->wqnext;
+    }
+  }
+  release(&b->lock);
+  return woken;
+}
@@ -1,6 +1,30 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps its own free list, protected by its own
+// lock, so that kalloc() and kfree() on different CPUs
+// don't contend. A CPU whose list is empty steals a batch
+// of pages from another CPU's list.
+//
+// Pages are reference counted so that copy-on-write fork can
+// share them between page tables; kfree() drops a reference
+// and only frees the page when the last one goes away.
+//
+// Memory from the first 2MB boundary up starts out as a pool
+// of 2MB superpages, for kalloc2m(). A CPU with no free pages
+// that can't steal any breaks up a superpage onto its list.
+// The pages of a superpage keep individual reference counts,
+// so a superpage mapping can be split into 4096-byte ones.
+// The pages below that boundary are shared out among the
+// CPUs' lists at boot by all the CPUs at once (kinithart()).
+//
+// Idle CPUs zero free pages ahead of time (kprezero()), onto
+// a second per-CPU list that kzalloc() takes from first.
+//
+// Unless built with RELEASE defined, freed and allocated pages
+// are filled with junk, to catch dangling references and use
+// of uninitialized memory.
 
 #include "types.h"
 #include "param.h"
@@ -9,57 +33,255 @@
 #include "riscv.h"
 #include "defs.h"
 
-void freerange(void *pa_start, void *pa_end);
+static void kfreepage(void *pa);
+static void kfree2mpool(void *pa);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// max pages moved from another CPU's list in one steal.
+#define STEALBATCH 64
+
+// max pages each CPU keeps zeroed.
+#define NZERO 64
+
+// pages each CPU takes at a time in kinithart().
+#define INITBATCH 32
+
 struct run {
   struct run *next;
 };
 
+struct kmem {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;            // length of freelist
+  struct run *zerolist; // free pages, already zeroed
+  int nzero;            // length of zerolist
+
+  // statistics, for statskmem().
+  int nalloc;           // kalloc()s served by this CPU
+  int nsteal;           // pages stolen from other CPUs
+};
+
+struct kmem kmem[NCPU];
+
+// the superpage pool.
 struct {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+} kmem2m;
+
+// per-page reference counts, indexed by PA2REF(pa).
+// updated with atomic instructions rather than a lock.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+int pageref[(PHYSTOP - KERNBASE) / PGSIZE];
+
+// the pages between the end of the kernel and the first
+// superpage, which kinithart() hands out.
+static struct {
+  char *start, *end;
+  uint64 next;  // offset of the next batch, taken atomically
+} kinitrange;
 
+// Called by CPU 0 before the others start.
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  char *p;
+
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&kmem2m.lock, "kmem2m");
+  p = (char*)SUPERPGROUNDUP((uint64)end);
+  kinitrange.start = (char*)PGROUNDUP((uint64)end);
+  kinitrange.end = p;
+  for(; p + SUPERPGSIZE <= (char*)PHYSTOP; p += SUPERPGSIZE)
+    kfree2mpool(p);
 }
 
+// Put batches of the pages below the first superpage on
+// this CPU's free list until there are none left, as every
+// CPU does once kinit() is done; between them they free all
+// of those pages. The pages have never been used, so with
+// no references to drop or dangling ones to catch they go
+// straight on the list, a batch per acquire().
 void
-freerange(void *pa_start, void *pa_end)
+kinithart(void)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  struct run *r, *first, *last;
+  struct kmem *km;
+  char *p, *e;
+  int n;
+
+  for(;;){
+    p = kinitrange.start + __sync_fetch_and_add(&kinitrange.next, INITBATCH*PGSIZE);
+    if(p >= kinitrange.end)
+      return;
+    e = p + INITBATCH*PGSIZE;
+    if(e > kinitrange.end)
+      e = kinitrange.end;
+
+    first = last = 0;
+    for(n = 0; p < e; p += PGSIZE, n++){
+      r = (struct run*)p;
+      r->next = first;
+      first = r;
+      if(last == 0)
+        last = r;
+    }
+
+    push_off();
+    km = &kmem[cpuid()];
+    acquire(&km->lock);
+    last->next = km->freelist;
+    km->freelist = first;
+    km->nfree += n;
+    release(&km->lock);
+    pop_off();
+  }
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// Drops one reference; the page goes on the current CPU's
+// free list when no references remain.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&pageref[PA2REF(pa)], 1);
+  if(n < 0)
+    panic("kfree: ref");
+  if(n > 0)
+    return;
+  kfreepage(pa);
+}
+
+// Put page pa, which has no references left,
+// on the current CPU's free list.
+static void
+kfreepage(void *pa)
+{
+  struct run *r;
+  struct kmem *km;
+
+#ifndef RELEASE
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  release(&km->lock);
+  pop_off();
+}
+
+// Move up to half of another CPU's free pages (at most
+// STEALBATCH) onto CPU id's list, and return one of them.
+// Holds at most one kmem lock at a time, so two CPUs
+// stealing from each other can't deadlock.
+// Takes one zeroed page from another CPU if none has free
+// pages left. Returns 0 if every other list is empty.
+static struct run*
+steal(int id)
+{
+  struct run *r, *first, *last;
+  struct kmem *victim;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    victim = &kmem[(id + i) % NCPU];
+    if(victim->nfree == 0)  // racy peek; rechecked under the lock.
+      continue;
+
+    acquire(&victim->lock);
+    n = (victim->nfree + 1) / 2;
+    if(n > STEALBATCH)
+      n = STEALBATCH;
+    first = last = victim->freelist;
+    if(first == 0){
+      release(&victim->lock);
+      continue;
+    }
+    for(int k = 1; k < n; k++)
+      last = last->next;
+    victim->freelist = last->next;
+    victim->nfree -= n;
+    release(&victim->lock);
+
+    // keep the first page for the caller, the rest
+    // go on our own list.
+    r = first;
+    if(n > 1){
+      acquire(&kmem[id].lock);
+      last->next = kmem[id].freelist;
+      kmem[id].freelist = first->next;
+      kmem[id].nfree += n - 1;
+      release(&kmem[id].lock);
+    }
+    __sync_fetch_and_add(&kmem[id].nsteal, n);
+    return r;
+  }
+
+  for(i = 1; i < NCPU; i++){
+    victim = &kmem[(id + i) % NCPU];
+    if(victim->nzero == 0)
+      continue;
+    acquire(&victim->lock);
+    if((r = victim->zerolist) != 0){
+      victim->zerolist = r->next;
+      victim->nzero--;
+    }
+    release(&victim->lock);
+    if(r){
+      __sync_fetch_and_add(&kmem[id].nsteal, 1);
+      return r;
+    }
+  }
+  return 0;
+}
+
+// Take a superpage from the pool, keep its first page for
+// the caller and put the rest on CPU id's free list.
+// Returns 0 if the pool is empty.
+static struct run*
+breakup(int id)
+{
+  struct run *r;
+  char *p;
+
+  acquire(&kmem2m.lock);
+  r = kmem2m.freelist;
+  if(r){
+    kmem2m.freelist = r->next;
+    kmem2m.nfree--;
+  }
+  release(&kmem2m.lock);
+  if(r == 0)
+    return 0;
+
+  acquire(&kmem[id].lock);
+  for(p = (char*)r + SUPERPGSIZE - PGSIZE; p > (char*)r; p -= PGSIZE){
+    ((struct run*)p)->next = kmem[id].freelist;
+    kmem[id].freelist = (struct run*)p;
+  }
+  kmem[id].nfree += SUPERPGSIZE/PGSIZE - 1;
+  release(&kmem[id].lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +291,217 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+  acquire(&km->lock);
+  if((r = km->freelist) != 0){
+    km->freelist = r->next;
+    km->nfree--;
+  } else if((r = km->zerolist) != 0){
+    km->zerolist = r->next;
+    km->nzero--;
+  }
+  release(&km->lock);
 
+  if(r == 0)
+    r = steal(id);
+  if(r == 0)
+    r = breakup(id);
   if(r)
+    __sync_fetch_and_add(&km->nalloc, 1);
+  pop_off();
+
+  if(r){
+    pageref[PA2REF(r)] = 1;
+#ifndef RELEASE
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  } else if(pcacheshrink() > 0 || bshrink() > 0){
+    // the program page cache or the buffer cache
+    // may have freed some.
+    return kalloc();
+  }
+  return (void*)r;
+}
+
+// Allocate a zeroed page, preferably one zeroed ahead
+// of time by kprezero().
+// Returns 0 if the memory cannot be allocated.
+void *
+kzalloc(void)
+{
+  struct run *r;
+  struct kmem *km;
+
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  if((r = km->zerolist) != 0){
+    km->zerolist = r->next;
+    km->nzero--;
+    km->nalloc++;
+  }
+  release(&km->lock);
+  pop_off();
+
+  if(r){
+    pageref[PA2REF(r)] = 1;
+    r->next = 0;  // the only word the list used
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero one of this CPU's free pages, for kzalloc(), unless
+// it has enough zeroed already. Called by idle CPUs.
+// Returns 1 if it zeroed a page, 0 if it had nothing to do.
+int
+kprezero(void)
+{
+  struct run *r;
+  struct kmem *km;
+
+  push_off();
+  km = &kmem[cpuid()];
+  r = 0;
+  acquire(&km->lock);
+  if(km->nzero < NZERO && (r = km->freelist) != 0){
+    km->freelist = r->next;
+    km->nfree--;
+  }
+  release(&km->lock);
+
+  if(r){
+    memset((char*)r, 0, PGSIZE);
+    acquire(&km->lock);
+    r->next = km->zerolist;
+    km->zerolist = r;
+    km->nzero++;
+    release(&km->lock);
+  }
+  pop_off();
+  return r != 0;
+}
+
+// Allocate a 2MB-aligned superpage of physical memory.
+// Each of its pages has one reference; free it with kfree2m(),
+// or page by page with kfree().
+// Returns 0 if no superpage is free.
+void *
+kalloc2m(void)
+{
+  struct run *r;
+
+  acquire(&kmem2m.lock);
+  r = kmem2m.freelist;
+  if(r){
+    kmem2m.freelist = r->next;
+    kmem2m.nfree--;
+  }
+  release(&kmem2m.lock);
+
+  if(r){
+    for(int i = 0; i < SUPERPGSIZE/PGSIZE; i++)
+      pageref[PA2REF(r) + i] = 1;
+  }
   return (void*)r;
 }
+
+static void
+kfree2mpool(void *pa)
+{
+  struct run *r = (struct run*)pa;
+
+  acquire(&kmem2m.lock);
+  r->next = kmem2m.freelist;
+  kmem2m.freelist = r;
+  kmem2m.nfree++;
+  release(&kmem2m.lock);
+}
+
+// Drop a reference to each page of the superpage at pa.
+// If that frees them all, the superpage goes back to the
+// pool in one piece; otherwise freed pages go on the
+// free list one by one.
+void
+kfree2m(void *pa)
+{
+  uint64 mine[SUPERPGSIZE/PGSIZE/64];  // pages whose last reference we dropped
+  int i, n, left;
+
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kfree2m");
+
+  left = 0;
+  memset(mine, 0, sizeof(mine));
+  for(i = 0; i < SUPERPGSIZE/PGSIZE; i++){
+    n = __sync_sub_and_fetch(&pageref[PA2REF(pa) + i], 1);
+    if(n < 0)
+      panic("kfree2m: ref");
+    if(n > 0)
+      left = 1;
+    else
+      mine[i/64] |= 1L << (i%64);
+  }
+  if(!left){
+    kfree2mpool(pa);
+    return;
+  }
+  for(i = 0; i < SUPERPGSIZE/PGSIZE; i++){
+    if(mine[i/64] & (1L << (i%64)))
+      kfreepage((char*)pa + i*PGSIZE);
+  }
+}
+
+// Add a reference to an allocated page, e.g. when
+// copy-on-write fork maps it into a second page table.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  if(__sync_fetch_and_add(&pageref[PA2REF(pa)], 1) < 1)
+    panic("kdup: free page");
+}
+
+// Number of references to page pa.
+int
+krefcnt(void *pa)
+{
+  return pageref[PA2REF(pa)];
+}
+
+// The number of free pages, superpages included. Read
+// without locks, so only roughly right.
+int
+kfreepages(void)
+{
+  int n = kmem2m.nfree * (SUPERPGSIZE / PGSIZE);
+
+  for(int i = 0; i < NCPU; i++)
+    n += kmem[i].nfree + kmem[i].nzero;
+  return n;
+}
+
+// Format per-CPU allocator counters into buf.
+// Returns the number of bytes written.
+int
+statskmem(char *buf, int sz)
+{
+  int n;
+
+  n = snprintf(buf, sz, "--- kalloc stats\n#free superpages %d\n", kmem2m.nfree);
+  for(int i = 0; i < NCPU; i++){
+    if(kmem[i].nalloc == 0 && kmem[i].nfree == 0 && kmem[i].nzero == 0)
+      continue;
+    n += snprintf(buf+n, sz-n, "cpu %d: #kalloc %d #stolen %d #free %d #zeroed %d\n",
+                  i, kmem[i].nalloc, kmem[i].nsteal, kmem[i].nfree, kmem[i].nzero);
+  }
+  return n;
+}
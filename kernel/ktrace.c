@@ -0,0 +1,143 @@
+//
+// the kernel event trace.
+//
+// Each CPU records events (context switches, system calls,
+// buffer cache lookups, disk requests, log commits) in a
+// ring of its own, with interrupts off but without a lock:
+// a CPU's ring only ever has that one writer, which fills
+// in the slot at head and then advances head. Events are
+// overwritten once the ring wraps, so the trace costs the
+// same whether anyone reads it or not.
+//
+// Reading the ktrace device takes the events each CPU has
+// recorded since the last read, as struct ktevents, CPU by
+// CPU. A reader that fell more than a ring behind gets a
+// KT_LOST event saying how many went missing. A read must
+// have room for at least two events.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "ktrace.h"
+#include "defs.h"
+
+#define NKTRACE 1024  // events in each CPU's ring
+
+struct ktring {
+  uint64 head;        // events ever recorded; only its CPU writes it
+  uint64 tail;        // events ever read; under ktread
+  struct ktevent ev[NKTRACE];
+};
+
+static struct ktring ktrings[NCPU];
+static struct sleeplock ktread;
+
+// Record an event on this CPU.
+void
+ktrace(int type, uint64 a, uint64 b)
+{
+  struct ktring *r;
+  struct ktevent *e;
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  r = &ktrings[c - cpus];
+  e = &r->ev[r->head % NKTRACE];
+  e->time = r_time();
+  e->type = type;
+  e->cpu = c - cpus;
+  e->pid = c->proc ? c->proc->pid : 0;
+  e->a = a;
+  e->b = b;
+  // the event is complete before a reader can see it.
+  __sync_synchronize();
+  r->head++;
+  pop_off();
+}
+
+// Copy the whole events of ring r not yet read, up to max
+// of them (max >= 2), into ev, advancing r->tail. If any
+// have been lost, ev[0] says how many.
+static int
+ktcollect(struct ktring *r, int id, struct ktevent *ev, int max)
+{
+  uint64 head, start, first, i;
+  int n, skip;
+
+  start = r->tail;
+  head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  n = 0;
+  for(i = start; i < head && n < max - 1; i++)
+    ev[1 + n++] = r->ev[i % NKTRACE];
+
+  // the writer may have overwritten some as we copied
+  // them: only events within NKTRACE-1 of the head now are
+  // sure to be whole, the slot of head - NKTRACE being the
+  // one it may be filling in.
+  __sync_synchronize();
+  head = r->head;
+  first = head > NKTRACE - 1 ? head - (NKTRACE - 1) : 0;
+  if(start >= first){
+    memmove(ev, ev + 1, n * sizeof(ev[0]));
+    r->tail = i;
+    return n;
+  }
+
+  skip = first - start < n ? first - start : n;
+  memmove(ev + 1, ev + 1 + skip, (n - skip) * sizeof(ev[0]));
+  n -= skip;
+  r->tail = n > 0 ? i : first;
+  ev[0].time = r_time();
+  ev[0].type = KT_LOST;
+  ev[0].cpu = id;
+  ev[0].pid = 0;
+  ev[0].a = first - start;
+  ev[0].b = 0;
+  return n + 1;
+}
+
+static int
+ktraceread(int user_dst, uint64 dst, int n)
+{
+  struct ktevent ev[8];
+  int id, m, tot;
+
+  acquiresleep(&ktread);
+  tot = 0;
+  for(id = 0; id < NCPU; id++){
+    while((m = (n - tot) / sizeof(ev[0])) >= 2){
+      if(m > NELEM(ev))
+        m = NELEM(ev);
+      if((m = ktcollect(&ktrings[id], id, ev, m)) == 0)
+        break;
+      if(either_copyout(user_dst, dst + tot, ev, m * sizeof(ev[0])) < 0){
+        releasesleep(&ktread);
+        return tot > 0 ? tot : -1;
+      }
+      tot += m * sizeof(ev[0]);
+    }
+  }
+  releasesleep(&ktread);
+  return tot;
+}
+
+static int
+ktracewrite(int user_src, uint64 src, int n)
+{
+  return -1;
+}
+
+void
+ktraceinit(void)
+{
+  initsleeplock(&ktread, "ktread");
+  devsw[KTRACE].read = ktraceread;
+  devsw[KTRACE].write = ktracewrite;
+}
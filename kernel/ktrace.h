@@ -0,0 +1,20 @@
+// Kernel trace events, as read from the ktrace device.
+struct ktevent {
+  uint64 time;    // timer cycles since boot
+  ushort type;    // KT_...
+  ushort cpu;
+  int pid;        // the process running, 0 if none
+  uint64 a, b;    // depending on type:
+};
+
+#define KT_LOST       0  // a events on cpu were overwritten unread
+#define KT_SWITCH     1  // a is switching to b (pids, 0 the scheduler)
+#define KT_SYSCALL    2  // system call a, first argument b
+#define KT_SYSRET     3  // system call a returns b
+#define KT_BHIT       4  // block b of device a was cached
+#define KT_BMISS      5  //   or wasn't
+#define KT_DISKSTART  6  // disk request for block a, b 1 if a write
+#define KT_DISKDONE   7  //   and its completion
+#define KT_COMMIT     8  // log commit of a blocks starts
+#define KT_COMMITDONE 9  //   and is on disk
+#define KT_NTYPE     10
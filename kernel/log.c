@@ -4,14 +4,16 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
+#include "ktrace.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is only closed when there are no FS
+// system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
@@ -19,7 +21,30 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the open transaction has been committed.
+//
+// Group commit: closing a transaction copies its blocks out
+// of the buffer cache into log.snap[], and the commit works
+// from that copy. So while one transaction is being written
+// to disk, FS system calls go on accumulating the next one
+// in the cache. Only one transaction is on its way to disk
+// at a time.
+//
+// Commits are written by the writeback daemon, a kernel
+// thread, which end_op() wakes when a transaction has no
+// system calls active in it. So system calls don't wait for
+// the disk, and a write() may return before it is durable;
+// fsync() waits for the transactions so far to commit.
+//
+// Delayed checkpointing: a committed transaction isn't written
+// to its home locations straight away. The next transaction is
+// appended to the log after it, and the header lists the blocks
+// of all of them, in order, so recovery installs the latest copy
+// of each block last. Only when the log is too full for the next
+// transaction does checkpoint() write home the latest committed
+// copy of every block in it (kept in log.psnap[]) and erase the
+// log. A bitmap or inode block written by every transaction thus
+// goes home once per log-full of commits rather than each time.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +53,16 @@
 //   block B
 //   block C
 //   ...
+// where a block # may appear more than once.
 // Log appends are synchronous.
+//
+// Ordered data mode: writei() writes the data blocks of regular
+// files straight to their home locations, before the transaction
+// that points the file at them commits, so the log only carries
+// metadata. log_direct() says when a block must go through the
+// log anyway: when a transaction that hasn't been erased from the
+// log has it, or, for a block being allocated, may have freed it,
+// since until that transaction commits its old owner still has it.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,14 +76,61 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they may still write.
+  int closing;     // copying the open transaction out, please wait.
   int dev;
-  struct logheader lh;
+  struct waitq wq;      // begin_op()s and log_sync()s waiting for the log
+  struct waitq dq;      // the writeback daemon, waiting for work
+  int nclosed;          // transactions closed so far
+  int ndone;            // transactions committed so far
+  struct logheader lh;  // the open transaction
+  int nfreed;           // blocks it freed, -1 if too many to list
+  uint freed[NFREED];
+
+  // the committing transaction. only the
+  // committer uses these, without the lock.
+  struct logheader clh;
+  struct buf *pinned[LOGSIZE]; // its blocks in the cache
+  struct buf *snap[LOGSIZE];   // copies of their contents
+  uint to[LOGSIZE];            // log block numbers
+
+  // the committing transaction until it is committed, for
+  // log_direct(): clh.block[0..cn-1], and cfreed.
+  // protected by lock.
+  int cn;
+  int ncfreed;
+  uint cfreed[NFREED];
+
+  // the transactions in the log, not yet installed. only the
+  // committer changes these; pblock[0..pn-1] is protected by
+  // lock, for log_direct().
+  struct logheader dlh;          // the on-disk header
+  int pn;                        // distinct blocks in the log
+  uint pblock[LOGSIZE];
+  struct buf *ppinned[LOGSIZE];  // their blocks in the cache
+  struct buf *psnap[LOGSIZE];    // their latest committed contents
+
+  // statistics, for statslog().
+  int ncommit;
+  int ncheckpoint;
+  int ninstall;   // blocks written home
+  int nlogged;    // blocks written to the log
 };
 struct log log;
 
+// the snapshot buffers, outside the buffer cache.
+static struct buf snapbuf[LOGSIZE];
+static struct buf pendbuf[LOGSIZE];
+#ifdef RAMDISK
+// a ramdisk buf's data points into the image; these need
+// blocks of their own.
+static uchar snapdata[LOGSIZE][BSIZE];
+static uchar penddata[LOGSIZE][BSIZE];
+#endif
+
 static void recover_from_log(void);
 static void commit();
+static void logdaemon(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -58,25 +139,38 @@ initlog(int dev, struct superblock *sb)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
+  for (int i = 0; i < LOGSIZE; i++) {
+    initsleeplock(&snapbuf[i].lock, "logsnap");
+    snapbuf[i].dev = dev;
+    log.snap[i] = &snapbuf[i];
+    initsleeplock(&pendbuf[i].lock, "logpend");
+    pendbuf[i].dev = dev;
+    log.psnap[i] = &pendbuf[i];
+#ifdef RAMDISK
+    snapbuf[i].data = snapdata[i];
+    pendbuf[i].data = penddata[i];
+#endif
+  }
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
   recover_from_log();
+  if(kthread(logdaemon, "writeback") < 0)
+    panic("initlog: writeback");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// in log order, so the latest copy of a block wins.
 static void
-install_trans(int recovering)
+install_trans(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
+  for (tail = 0; tail < log.dlh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+    struct buf *dbuf = bread(log.dev, log.dlh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -89,25 +183,25 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.dlh.n = lh->n;
+  for (i = 0; i < log.dlh.n; i++) {
+    log.dlh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
 // Write in-memory log header to disk.
 // This is the true point at which the
-// current transaction commits.
+// committing transaction commits.
 static void
 write_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.dlh.n;
+  for (i = 0; i < log.dlh.n; i++) {
+    hb->block[i] = log.dlh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,24 +211,34 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  install_trans(); // if committed, copy from log to disk
+  log.dlh.n = 0;
   write_head(); // clear the log
 }
 
 // called at the start of each FS system call.
 void
 begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// like begin_op(), for an FS operation that may
+// write up to n blocks to the log.
+void
+begin_opn(int n)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    if(log.closing){
+      sleepon(&log.wq, &log.lock);
+    } else if(log.lh.n + log.reserved + n > LOGSIZE){
       // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      sleepon(&log.wq, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
@@ -142,63 +246,202 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// if this was the last outstanding operation, wakes
+// the writeback daemon to commit the transaction.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
+  log.reserved -= myproc()->logres;
+  if(log.closing)
+    panic("log.closing");
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+    wakeq(&log.dq);
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
-    wakeup(&log);
+    wakeq(&log.wq);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Wait until every transaction with FS system calls that
+// have finished, including the open one, is committed.
+void
+log_sync(void)
+{
+  int n;
+
+  acquire(&log.lock);
+  n = log.nclosed;
+  if(!log.closing && log.lh.n > 0)
+    n++;
+  while(log.ndone < n){
+    wakeq(&log.dq);
+    sleepon(&log.wq, &log.lock);
   }
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Close the open transaction: move its header to log.clh
+// and copy its blocks out of the cache, so that new FS
+// system calls can change them while the commit is on disk.
+// The blocks stay pinned until they are installed, so the
+// cache never reads back stale home copies.
+// Called with log.closing set and no FS system calls active.
 static void
-write_log(void)
+snapshot(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  log.clh = log.lh;
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    acquiresleep(&log.snap[tail]->lock);
+    memmove(log.snap[tail]->data, from->data, BSIZE);
+    log.snap[tail]->blockno = log.clh.block[tail];
+    log.pinned[tail] = from;
     brelse(from);
-    brelse(to);
   }
+  log.lh.n = 0;
+}
+
+// Write the snapshot to the log after the transactions
+// already there, in one batch, and add its blocks to the
+// header.
+static void
+write_log(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    log.to[tail] = log.start+log.dlh.n+tail+1; // log block
+    log.dlh.block[log.dlh.n+tail] = log.clh.block[tail];
+  }
+  bwritev(log.snap, log.to, log.clh.n);  // write the log
+  log.dlh.n += log.clh.n;
+  log.nlogged += log.clh.n;
+}
+
+// The committing transaction has committed: make its
+// snapshot the latest committed copy of each of its blocks,
+// keeping one pin per block in the log. Returns the new
+// number of distinct blocks in the log.
+static int
+absorb(void)
+{
+  int tail, k, n = log.pn;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    for (k = 0; k < n; k++) {
+      if (log.pblock[k] == log.clh.block[tail])
+        break;
+    }
+    if (k == n) {
+      log.pblock[n] = log.clh.block[tail];
+      log.psnap[n]->blockno = log.clh.block[tail];
+      log.ppinned[n] = log.pinned[tail];
+      n++;
+    } else {
+      bunpin(log.pinned[tail]);  // already pinned
+    }
+    memmove(log.psnap[k]->data, log.snap[tail]->data, BSIZE);
+    releasesleep(&log.snap[tail]->lock);
+  }
+  return n;
 }
 
+// Install the latest committed copy of every block in the
+// log at its home location, in one batch, and erase the log.
+static void
+checkpoint(void)
+{
+  int i;
+
+  // with a ramdisk, each block's home location is its cached
+  // copy, which already has the committed contents, and
+  // maybe newer ones of the open transaction that writing
+  // the snapshot would undo.
+#ifndef RAMDISK
+  for (i = 0; i < log.pn; i++)
+    acquiresleep(&log.psnap[i]->lock);
+  bwritev(log.psnap, 0, log.pn);  // write dst to disk
+  for (i = 0; i < log.pn; i++)
+    releasesleep(&log.psnap[i]->lock);
+#endif
+  log.dlh.n = 0;
+  write_head();    // Erase the transactions from the log
+
+  acquire(&log.lock);
+  for (i = 0; i < log.pn; i++)
+    bunpin(log.ppinned[i]);
+  log.ninstall += log.pn;
+  log.ncheckpoint++;
+  log.pn = 0;
+  release(&log.lock);
+}
+
+// Commit transactions until the open one is empty
+// or has FS system calls active in it.
+// Called by the writeback daemon, holding log.lock.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
+  int n;
+
+  while(log.outstanding == 0 && log.lh.n > 0){
+    log.closing = 1;
+    log.nclosed++;
+    ktrace(KT_COMMIT, log.lh.n, 0);
+    release(&log.lock);
+    iflushall();
+    snapshot();
+    acquire(&log.lock);
+    log.cn = log.clh.n;
+    log.ncfreed = log.nfreed;
+    if(log.nfreed > 0)
+      memmove(log.cfreed, log.freed, log.nfreed * sizeof(uint));
+    log.nfreed = 0;
+    log.closing = 0;
+    wakeq(&log.wq);   // the next transaction may start
+    release(&log.lock);
+
+    if(log.dlh.n + log.clh.n > LOGSIZE || log.dlh.n + log.clh.n > log.size - 1)
+      checkpoint();  // no room after the transactions in the log
+    write_log();     // Write snapshot to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    ktrace(KT_COMMITDONE, log.cn, 0);
+    n = absorb();
+
+    acquire(&log.lock);
+    log.pn = n;
+    log.cn = 0;
+    log.ncfreed = 0;
+    log.ncommit++;
+    log.ndone++;
+    wakeq(&log.wq);   // for log_sync()
+  }
+}
+
+// The writeback daemon: commits transactions, and installs
+// the log in the background once it is half full, so that
+// commits seldom have to wait for a checkpoint.
+static void
+logdaemon(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.outstanding == 0 && log.lh.n > 0){
+      commit();
+    } else if(log.dlh.n > LOGSIZE/2){
+      release(&log.lock);
+      checkpoint();
+      acquire(&log.lock);
+    } else {
+      sleepon(&log.dq, &log.lock);
+    }
   }
 }
 
@@ -234,3 +477,55 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+// Record that the open transaction frees block b.
+void
+log_free(uint b)
+{
+  acquire(&log.lock);
+  if(log.nfreed >= 0){
+    if(log.nfreed < NFREED)
+      log.freed[log.nfreed++] = b;
+    else
+      log.nfreed = -1;
+  }
+  release(&log.lock);
+}
+
+static int
+inlist(uint b, uint *list, int n)
+{
+  if(n < 0)
+    return 1;
+  for(int i = 0; i < n; i++){
+    if(list[i] == b)
+      return 1;
+  }
+  return 0;
+}
+
+// May block b be written in place, bypassing the log? fresh
+// says b was just allocated to a file. If not, the caller
+// must log_write() it.
+int
+log_direct(uint b, int fresh)
+{
+  int ok;
+
+  acquire(&log.lock);
+  ok = !inlist(b, (uint*)log.lh.block, log.lh.n) &&
+       !inlist(b, (uint*)log.clh.block, log.cn) &&
+       !inlist(b, log.pblock, log.pn);
+  if(ok && fresh)
+    ok = !inlist(b, log.freed, log.nfreed) && !inlist(b, log.cfreed, log.ncfreed);
+  release(&log.lock);
+  return ok;
+}
+
+// Format log counters into buf.
+// Returns the number of bytes written.
+int
+statslog(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- log stats\n#commit %d #checkpoint %d #logged %d #installed %d\n",
+                  log.ncommit, log.ncheckpoint, log.nlogged, log.ninstall);
+}
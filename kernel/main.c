@@ -4,6 +4,8 @@
 #include "riscv.h"
 #include "defs.h"
 
+// 1 once the page allocator can be used; 2 once the rest
+// of the kernel is set up, for the other CPUs to start.
 volatile static int started = 0;
 
 // start() jumps here in supervisor mode on all CPUs.
@@ -17,6 +19,10 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    __sync_synchronize();
+    started = 1;
+    kinithart();     // this CPU's share of the free pages
+    slabinit();      // kernel object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -26,15 +32,34 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    pcacheinit();    // program page cache
+    shminit();       // shared memory segments
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    futexinit();     // futex hash table
+    statsinit();     // statistics device
+    profinit();      // profiler device
+    ktraceinit();    // event trace device
+#ifdef RAMDISK
+    ramdiskinit();   // file system image in memory
+#else
     virtio_disk_init(); // emulated hard disk
+#endif
+#ifdef LAB_NET
+    sockinit();      // sockets and the mbuf pool
+    pci_init();      // e1000 network card
+#endif
     userinit();      // first user process
     __sync_synchronize();
-    started = 1;
+    started = 2;
   } else {
     while(started == 0)
       ;
     __sync_synchronize();
+    kinithart();      // this CPU's share of the free pages
+    while(started == 1)
+      ;
+    __sync_synchronize();
     printf("hart %d starting\n", cpuid());
     kvminithart();    // turn on paging
     trapinithart();   // install kernel trap vector
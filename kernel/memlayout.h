@@ -8,6 +8,8 @@
 // 0C000000 -- PLIC
 // 10000000 -- uart0 
 // 10001000 -- virtio disk 
+// 30000000 -- PCIe configuration space (LAB_NET)
+// 40000000 -- e1000 registers (LAB_NET)
 // 80000000 -- boot ROM jumps here in machine mode
 //             -kernel loads the kernel here
 // unused RAM after 80000000.
@@ -25,8 +27,18 @@
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
 
+#ifdef LAB_NET
+// qemu puts the PCIe configuration space (ECAM) here; bus
+// 0's, all pci_init() looks at, is the first megabyte.
+#define PCIE_ECAM 0x30000000L
+// pci_init() puts the e1000's registers here.
+#define E1000_REGS 0x40000000L
+#define E1000_IRQ 33
+#endif
+
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt pending.
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -62,6 +74,27 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   memory-mapped files, below UTOP
+//   threads' trapframes (see clone())
+//   USYSCALL (p->usyscall, read-only, for ulib.c)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USYSCALL (TRAPFRAME - PGSIZE)
+#define THREADFRAME(i) (USYSCALL - ((i)+1)*PGSIZE)
+#define UTOP THREADFRAME(NTHREAD-1)
+
+// the bottom of the top gigabyte, which a page table's last
+// root entry maps, and so the page tables under it.
+#define UTOPTABLE (MAXVA - (1L << PXSHIFT(2)))
+
+#ifndef __ASSEMBLER__
+// what the kernel shares with user code at USYSCALL, so
+// getpid() and uptime() don't need system calls. the
+// current time is the time CSR, which user mode may read.
+struct usyscall {
+  int pid;            // Process ID
+  uint64 tickcycles;  // timer cycles per tick
+  uint64 timefreq;    // timer cycles per second
+};
+#endif
@@ -0,0 +1,530 @@
+//
+// Memory-mapped files.
+//
+// mmap() records a region in the process's vma[] table and
+// maps nothing. Each page is read from the file the first
+// time it is touched (see uvmfault()). The regions sit at the
+// top of the address space, each just below the one before,
+// and the heap can't grow into them.
+//
+// A MAP_SHARED, PROT_WRITE page that was written to (its PTE
+// has the hardware dirty bit set) is written back to the file
+// when it is unmapped, by munmap(), exit() or exec(). Writes
+// never extend the file. fork() shares a MAP_SHARED region's
+// pages with the child, and copies MAP_PRIVATE pages
+// copy-on-write.
+//
+// A region may instead map a named shared memory segment,
+// made by shmcreate() and mapped by others with shmattach(),
+// so that processes can share data without copying it
+// through the kernel. A segment's pages are all mapped as
+// the region is made, and each mapping holds a reference to
+// every page. The segment holds one more, and lasts, name
+// and all, until the last region mapping it is unmapped.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+#define SHMMAXPAGE (PGSIZE / sizeof(uint64))  // segment size limit
+
+struct shm {
+  char name[SHMNAME];
+  int ref;            // regions mapping it; free if 0
+  int npage;
+  uint64 *pages;      // a page of the addresses of its pages
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtable;
+
+// Find the region of p containing va.
+static struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->used && va >= v->addr && va < v->addr + v->len)
+      return v;
+  }
+  return 0;
+}
+
+static struct vma*
+vmaalloc(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!v->used)
+      return v;
+  }
+  return 0;
+}
+
+// The lowest address used by p's mapped regions, which
+// is as far as the heap may grow.
+uint64
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = UTOP;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->used && v->addr < base)
+      base = v->addr;
+  }
+  return base;
+}
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+// Take another reference to what region v maps.
+static void
+vmadup(struct vma *v)
+{
+  if(v->shm){
+    acquire(&shmtable.lock);
+    v->shm->ref++;
+    release(&shmtable.lock);
+  } else {
+    filedup(v->f);
+  }
+}
+
+// Drop a reference to segment s. The last frees its
+// pages, and its name for reuse.
+static void
+shmput(struct shm *s)
+{
+  uint64 *pages;
+  int n;
+
+  acquire(&shmtable.lock);
+  if(--s->ref > 0){
+    release(&shmtable.lock);
+    return;
+  }
+  pages = s->pages;
+  n = s->npage;
+  s->pages = 0;
+  release(&shmtable.lock);
+  for(int i = 0; i < n; i++)
+    kfree((void*)pages[i]);
+  kfree(pages);
+}
+
+// Drop region v's reference to what it maps, and free v.
+static void
+vmaclose(struct vma *v)
+{
+  if(v->shm)
+    shmput(v->shm);
+  else
+    fileclose(v->f);
+  v->used = 0;
+}
+
+// Map len bytes of file f, starting at offset off, into the
+// current process. Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 addr;
+
+  if(len == 0 || off % PGSIZE != 0 || f->type != FD_INODE || sharedvm(p))
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if((prot & PROT_READ) && !f->readable)
+    return -1;
+  if((prot & PROT_WRITE) && flags == MAP_SHARED && !f->writable)
+    return -1;
+
+  len = PGROUNDUP(len);
+  addr = mmapbase(p);
+  if(addr < len || addr - len < PGROUNDUP(p->sz))
+    return -1;
+  if((v = vmaalloc(p)) == 0)
+    return -1;
+  addr -= len;
+
+  v->used = 1;
+  v->addr = addr;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = filedup(f);
+  v->shm = 0;
+  v->off = off;
+  return addr;
+}
+
+// Handle a page fault at va in a mapped region of the
+// current process: map a page holding the file's contents
+// there (zeros past the end of the file).
+// Returns 0 on success, -1 if va isn't in a region, the
+// access isn't allowed, or the page can't be read.
+int
+mmapfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct inode *ip;
+  char *mem;
+  int perm, locked, nested;
+
+  if(p == 0 || p->pagetable != pagetable || (v = vmalookup(p, va)) == 0)
+    return -1;
+  // a segment's pages are all mapped already.
+  if(v->shm)
+    return -1;
+  if(write && !(v->prot & PROT_WRITE))
+    return -1;
+  if(!write && !(v->prot & (PROT_READ|PROT_EXEC)))
+    return -1;
+
+  // reading the file may sleep, which isn't allowed with
+  // a spinlock held (e.g. pipewrite()'s copyin()); such
+  // a copy fails instead.
+  push_off();
+  nested = mycpu()->noff > 1;
+  pop_off();
+  if(nested)
+    return -1;
+
+  va = PGROUNDDOWN(va);
+  if((mem = uvmpagealloc(pagetable, va)) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+
+  // the caller may be a read() or write() of this very
+  // file, already holding its inode lock.
+  ip = v->f->ip;
+  locked = holdingsleep(&ip->lock);
+  if(!locked)
+    ilock(ip);
+  if(readi(ip, 0, (uint64)mem, v->off + (va - v->addr), PGSIZE) == -1){
+    if(!locked)
+      iunlock(ip);
+    kfree(mem);
+    return -1;
+  }
+  if(!locked)
+    iunlock(ip);
+
+  perm = PTE_U;
+  if(v->prot & PROT_READ)
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(uvminstall(pagetable, va, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Write the page at va of region v back to its file, not
+// past the file's end. Done in chunks, like filewrite(),
+// to stay within a log transaction.
+static void
+writeback(struct vma *v, uint64 va)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->addr);
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i = 0, n1, r;
+
+  while(i < PGSIZE){
+    n1 = PGSIZE - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_op();
+    ilock(ip);
+    if(off + i >= ip->size){
+      iunlock(ip);
+      end_op();
+      break;
+    }
+    if(n1 > ip->size - (off + i))
+      n1 = ip->size - (off + i);
+    r = writei(ip, 1, va + i, off + i, n1);
+    iunlock(ip);
+    end_op();
+
+    if(r != n1)
+      break;
+    i += r;
+  }
+}
+
+// Unmap [addr, addr+len) of region v from p, writing dirty
+// pages of a shared writable mapping back to the file.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 addr, uint64 len)
+{
+  uint64 va;
+  pte_t *pte;
+
+  if(v->f && (v->flags & MAP_SHARED) && (v->prot & PROT_WRITE)){
+    for(va = addr; va < addr + len; va += PGSIZE){
+      pte = walk(p->pagetable, va, 0);
+      if(pte && (*pte & PTE_V) && (*pte & PTE_D))
+        writeback(v, va);
+    }
+  }
+  uvmunmap(p->pagetable, addr, len / PGSIZE, 1);
+}
+
+// Unmap [addr, addr+len) from the current process. The range
+// must lie within one region; unmapping its middle splits it.
+// Returns 0, or -1 on a bad range.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint64 end;
+
+  if(addr % PGSIZE != 0 || len == 0 || sharedvm(p))
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = vmalookup(p, addr)) == 0 || addr + len > v->addr + v->len)
+    return -1;
+  end = v->addr + v->len;
+
+  nv = 0;
+  if(addr > v->addr && addr + len < end){
+    // the part after the hole becomes a region of its own.
+    if((nv = vmaalloc(p)) == 0)
+      return -1;
+  }
+
+  vmaunmap(p, v, addr, len);
+
+  if(nv){
+    *nv = *v;
+    nv->addr = addr + len;
+    nv->len = end - nv->addr;
+    nv->off = v->off + (nv->addr - v->addr);
+    vmadup(nv);
+    v->len = addr - v->addr;
+  } else if(addr == v->addr && len == v->len){
+    vmaclose(v);
+  } else if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+    v->len -= len;
+  } else {
+    v->len -= len;
+  }
+  return 0;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->used){
+      vmaunmap(p, v, v->addr, v->len);
+      vmaclose(v);
+    }
+  }
+}
+
+// Give child np a copy of p's regions, sharing the pages
+// mapped so far: as they are for MAP_SHARED, copy-on-write
+// for MAP_PRIVATE. Doesn't sleep, so it may be called with
+// np->lock held. Returns 0, or -1 (mapping nothing) if out
+// of memory.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  uint64 va, pa;
+  pte_t *pte;
+  uint flags;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!v->used)
+      continue;
+    for(va = v->addr; va < v->addr + v->len; va += PGSIZE){
+      pte = walk(p->pagetable, va, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if((v->flags & MAP_PRIVATE) && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte) & ~PTE_D;
+      if(mappages(np->pagetable, va, PGSIZE, pa, flags) != 0)
+        goto err;
+      kdup((void*)pa);
+    }
+  }
+  uvmflush(p->pagetable, -1);
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    np->vma[v - p->vma] = *v;
+    if(v->used)
+      vmadup(v);
+  }
+  return 0;
+
+ err:
+  uvmflush(p->pagetable, -1);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->used)
+      uvmunmap(np->pagetable, v->addr, v->len / PGSIZE, 1);
+  }
+  return -1;
+}
+
+// Map all of segment s, to which the caller holds a
+// reference, into the current process, read-write. The
+// region takes over the reference.
+// Returns the address, or -1 (dropping the reference).
+static uint64
+shmmap(struct shm *s)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 addr, len, pa;
+  int i;
+
+  len = (uint64)s->npage * PGSIZE;
+  addr = mmapbase(p);
+  if(sharedvm(p) || addr < len || addr - len < PGROUNDUP(p->sz) ||
+     (v = vmaalloc(p)) == 0)
+    goto bad;
+  addr -= len;
+  for(i = 0; i < s->npage; i++){
+    pa = s->pages[i];
+    if(mappages(p->pagetable, addr + i*PGSIZE, PGSIZE, pa, PTE_R|PTE_W|PTE_U) != 0){
+      uvmunmap(p->pagetable, addr, i, 1);
+      goto bad;
+    }
+    kdup((void*)pa);
+  }
+
+  v->used = 1;
+  v->addr = addr;
+  v->len = len;
+  v->prot = PROT_READ|PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->f = 0;
+  v->shm = s;
+  v->off = 0;
+  return addr;
+
+ bad:
+  shmput(s);
+  return -1;
+}
+
+// Find the segment called name. Called with shmtable.lock held.
+static struct shm*
+shmlookup(char *name)
+{
+  struct shm *s;
+
+  for(s = shmtable.shm; s < &shmtable.shm[NSHM]; s++){
+    if(s->ref > 0 && strncmp(s->name, name, SHMNAME) == 0)
+      return s;
+  }
+  return 0;
+}
+
+// Make a shared memory segment of len bytes of zeros called
+// name, and map it into the current process.
+// Returns its address, or -1 if the name is taken, there
+// are too many segments, or memory ran out.
+uint64
+shmcreate(char *name, uint64 len)
+{
+  struct shm *s;
+  uint64 *pages;
+  int i, n;
+
+  n = PGROUNDUP(len) / PGSIZE;
+  if(n == 0 || n > SHMMAXPAGE || (pages = kzalloc()) == 0)
+    return -1;
+  for(i = 0; i < n; i++)
+    if((pages[i] = (uint64)kzalloc()) == 0)
+      goto bad;
+
+  acquire(&shmtable.lock);
+  if(shmlookup(name) != 0){
+    release(&shmtable.lock);
+    goto bad;
+  }
+  for(s = shmtable.shm; s < &shmtable.shm[NSHM] && s->ref > 0; s++)
+    ;
+  if(s == &shmtable.shm[NSHM]){
+    release(&shmtable.lock);
+    goto bad;
+  }
+  safestrcpy(s->name, name, SHMNAME);
+  s->ref = 1;
+  s->npage = n;
+  s->pages = pages;
+  release(&shmtable.lock);
+  return shmmap(s);
+
+ bad:
+  for(i = 0; i < n && pages[i]; i++)
+    kfree((void*)pages[i]);
+  kfree(pages);
+  return -1;
+}
+
+// Map the shared memory segment called name into the current
+// process, and copy its size in bytes out to user address
+// lenaddr, unless that is 0.
+// Returns its address, or -1.
+uint64
+shmattach(char *name, uint64 lenaddr)
+{
+  struct proc *p = myproc();
+  struct shm *s;
+  int len;
+
+  acquire(&shmtable.lock);
+  if((s = shmlookup(name)) == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  s->ref++;
+  release(&shmtable.lock);
+
+  len = s->npage * PGSIZE;
+  if(lenaddr != 0 && copyout(p->pagetable, lenaddr, (char*)&len, sizeof(len)) < 0){
+    shmput(s);
+    return -1;
+  }
+  return shmmap(s);
+}
@@ -1,13 +1,46 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC        64  // processes in the table at boot
+#define MAXPROC     512  // ... it grows up to this many
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         3  // scheduler priority levels
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NIOV         16  // max buffers per readv() or writev()
+#define NPOLL        16  // max descriptors per poll()
+#define NVMA         16  // memory-mapped regions per process
+#define NSHM         16  // named shared memory segments
+#define SHMNAME      16  // longest segment name, with its 0
+#define NSEG         4   // demand-paged program segments per process
+#define NTHREAD      8   // threads per process, made by clone()
+#define NPCACHE      128 // pages in the program page cache
+#ifndef NINODE
+#define NINODE      200  // maximum number of active i-nodes
+#endif
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
-#define MAXARG       32  // max exec arguments
+#define MAXARG      256  // max exec arguments
+#define ARGPAGES      8  // max pages of exec argument strings and argv[]
+#define TICKCYCLES 1000000 // timer cycles per tick; about 1/10th second in qemu
+#define TIMEFREQ 10000000  // timer cycles per second in qemu
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define WRITEOPBLOCKS 64 // ... except filewrite(), which reserves this many
+#ifndef LOGSIZE
+#define LOGSIZE      (MAXOPBLOCKS*4+WRITEOPBLOCKS*2)  // max data blocks in on-disk log
+#endif
+#define NFREED       128 // frees per transaction log_direct() keeps track of
+// the blocks in the log, one transaction committing and
+// one accumulating can pin 3*LOGSIZE blocks, and writei()
+// holds batches of blocks it writes directly
+#define NBUF         (LOGSIZE*4+MAXOPBLOCKS*3)  // size of disk block cache
+#ifdef RAMDISK
+#define FSSIZE       40000   // size of file system in blocks, in RAM
+#else
+#define FSSIZE       200000  // size of file system in blocks
+#endif
 #define MAXPATH      128   // maximum file path name
+#define SWAPSIZE     32768 // blocks of swap space after the file system
+#define SWAPBATCH    8     // pages paged out at a time
+#define PROFMIN     1000   // shortest profiler sampling period, in timer cycles
+#define DISKIRQ_ANY    -1  // any hart takes disk interrupts
+#define DISKIRQ_SUBMIT -2  // the hart that started the requests
+#ifndef DISKIRQ
+#define DISKIRQ DISKIRQ_SUBMIT // or a hart number
+#endif
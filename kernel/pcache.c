@@ -0,0 +1,184 @@
+//
+// Page cache for program files.
+//
+// exec() doesn't load a program; its pages are read from the
+// file when first touched (see execfault()). The pages read
+// are kept here, keyed by inode and offset, so processes
+// running the same program map the same physical pages:
+// read-only text directly, writable data copy-on-write.
+//
+// The cache holds one reference to each of its pages. Writing
+// to or truncating a file drops its pages, and kalloc() asks
+// the cache to let go of everything when memory runs out.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+struct cpage {
+  uint dev;
+  uint inum;      // 0 if the slot is free
+  uint off;       // file offset of the page
+  uint n;         // bytes read from the file; the rest is zeros
+  char *pa;
+  uint lastuse;   // ticks, for LRU replacement
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+
+  // statistics, for statspcache().
+  int nhit;
+  int nmiss;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Find the page of (dev, inum) at off with n file bytes.
+// Caller must hold pcache.lock.
+static struct cpage*
+pcachefind(uint dev, uint inum, uint off, uint n)
+{
+  struct cpage *c;
+
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum == inum && c->dev == dev && c->off == off && c->n == n)
+      return c;
+  }
+  return 0;
+}
+
+// Return a page holding n bytes of ip starting at off,
+// followed by zeros, with a reference for the caller, who
+// must not write to it. Reads the file on a miss, locking
+// ip unless the caller already holds it.
+// Returns 0 if out of memory or the file can't be read.
+char*
+pcacheget(struct inode *ip, uint off, uint n)
+{
+  struct cpage *c, *victim;
+  char *mem, *old;
+  int locked;
+
+  acquire(&pcache.lock);
+  if((c = pcachefind(ip->dev, ip->inum, off, n)) != 0){
+    kdup(c->pa);
+    c->lastuse = ticks;
+    pcache.nhit++;
+    release(&pcache.lock);
+    return c->pa;
+  }
+  release(&pcache.lock);
+
+  if((mem = kzalloc()) == 0)
+    return 0;
+
+  // hold the inode lock while inserting, so that a
+  // writei() can't invalidate in between and leave a
+  // stale copy in the cache.
+  locked = holdingsleep(&ip->lock);
+  if(!locked)
+    ilock(ip);
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    if(!locked)
+      iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+
+  old = 0;
+  acquire(&pcache.lock);
+  if((c = pcachefind(ip->dev, ip->inum, off, n)) != 0){
+    // someone else read it first.
+    kdup(c->pa);
+    c->lastuse = ticks;
+    release(&pcache.lock);
+    if(!locked)
+      iunlock(ip);
+    kfree(mem);
+    return c->pa;
+  }
+  victim = 0;
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum == 0){
+      victim = c;
+      break;
+    }
+    if(victim == 0 || c->lastuse < victim->lastuse)
+      victim = c;
+  }
+  if(victim->inum)
+    old = victim->pa;
+  victim->dev = ip->dev;
+  victim->inum = ip->inum;
+  victim->off = off;
+  victim->n = n;
+  victim->pa = mem;
+  victim->lastuse = ticks;
+  kdup(mem);
+  pcache.nmiss++;
+  release(&pcache.lock);
+  if(!locked)
+    iunlock(ip);
+
+  if(old)
+    kfree(old);
+  return mem;
+}
+
+// Drop the cached pages of ip, whose contents are changing.
+// Processes that have them mapped keep their copies.
+void
+pcacheinval(struct inode *ip)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum == ip->inum && c->dev == ip->dev){
+      kfree(c->pa);
+      c->inum = 0;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Drop every cached page, for kalloc() when memory is
+// short. Returns the number of pages dropped.
+int
+pcacheshrink(void)
+{
+  struct cpage *c;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum){
+      kfree(c->pa);
+      c->inum = 0;
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
+
+// Format page cache counters into buf.
+// Returns the number of bytes written.
+int
+statspcache(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- pcache stats\n#hit %d #miss %d\n",
+                  pcache.nhit, pcache.nmiss);
+}
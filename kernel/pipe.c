@@ -7,18 +7,45 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// The data lives in PIPEPAGES separately allocated pages,
+// used as one ring of PIPESIZE bytes. Bytes are copied in
+// spans that stay within one page. A page-aligned write of
+// a whole page into an empty page slot takes the writer's
+// page itself instead of copying it (the writer keeps it
+// copy-on-write), and a page-aligned read of a whole page
+// hands the slot's page to the reader in the same way.
+// Slot pages are allocated when first written, and a slot
+// whose page is still shared with a user address space is
+// copied before the pipe writes into it.
+#define PIPEPAGES 4
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES]; // the ring, one page per slot
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct waitq rq;  // readers waiting for data
+  struct waitq wq;  // writers waiting for room
+  struct pollwait *pollers;  // poll()s on either end
 };
 
+// pipes are much smaller than a page.
+static struct kcache pipecache;
+
+void
+pipeinit(void)
+{
+  kcacheinit(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +55,10 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kcalloc(&pipecache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
-  pi->nwrite = 0;
-  pi->nread = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +72,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kcfree(&pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -61,22 +86,49 @@ pipeclose(struct pipe *pi, int writable)
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
-    wakeup(&pi->nread);
+    wakeq(&pi->rq);
   } else {
     pi->readopen = 0;
-    wakeup(&pi->nwrite);
+    wakeq(&pi->wq);
   }
+  pollwake(&pi->pollers);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    freelock(&pi->lock);
+    for(int i = 0; i < PIPEPAGES; i++)
+      if(pi->page[i])
+        kfree(pi->page[i]);
+    kcfree(&pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Make the page in slot writable by the pipe: allocate it,
+// or copy it if a user page table still shares it.
+// Returns 0, or -1 if out of memory.
+static int
+pipeslot(struct pipe *pi, int slot)
+{
+  char *mem;
+
+  if(pi->page[slot] && krefcnt(pi->page[slot]) == 1)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return -1;
+  if(pi->page[slot]){
+    memmove(mem, pi->page[slot], PGSIZE);
+    kfree(pi->page[slot]);
+  }
+  pi->page[slot] = mem;
+  return 0;
+}
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
   int i = 0;
+  uint off, m;
+  uint64 pa;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -86,17 +138,34 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       return -1;
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      wakeq(&pi->rq);
+      pollwake(&pi->pollers);
+      sleepon(&pi->wq, &pi->lock);
+      continue;
+    }
+    off = pi->nwrite % PIPESIZE;
+    if(off % PGSIZE == 0 && (addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+       pi->nwrite - pi->nread <= PIPESIZE - PGSIZE &&
+       uvmshare(pr->pagetable, addr + i, &pa) == 0){
+      // take the writer's page for this slot.
+      if(pi->page[off / PGSIZE])
+        kfree(pi->page[off / PGSIZE]);
+      pi->page[off / PGSIZE] = (char*)pa;
+      pi->nwrite += PGSIZE;
+      i += PGSIZE;
+      continue;
     }
+    m = min(n - i, PIPESIZE - (pi->nwrite - pi->nread));
+    m = min(m, PGSIZE - off % PGSIZE);
+    if(pipeslot(pi, off / PGSIZE) < 0)
+      break;
+    if(copyin(pr->pagetable, pi->page[off / PGSIZE] + off % PGSIZE, addr + i, m) == -1)
+      break;
+    pi->nwrite += m;
+    i += m;
   }
-  wakeup(&pi->nread);
+  wakeq(&pi->rq);
+  pollwake(&pi->pollers);
   release(&pi->lock);
 
   return i;
@@ -105,9 +174,9 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i = 0;
+  uint off, m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -115,16 +184,55 @@ piperead(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    sleepon(&pi->rq, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  while(i < n && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    off = pi->nread % PIPESIZE;
+    if(off % PGSIZE == 0 && (addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+       pi->nwrite - pi->nread >= PGSIZE &&
+       uvmremap(pr->pagetable, addr + i, (uint64)pi->page[off / PGSIZE]) == 0){
+      // give this slot's page to the reader.
+      pi->page[off / PGSIZE] = 0;
+      pi->nread += PGSIZE;
+      i += PGSIZE;
+      continue;
+    }
+    m = min(n - i, pi->nwrite - pi->nread);
+    m = min(m, PGSIZE - off % PGSIZE);
+    if(copyout(pr->pagetable, addr + i, pi->page[off / PGSIZE] + off % PGSIZE, m) == -1)
       break;
+    pi->nread += m;
+    i += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wakeq(&pi->wq);  //DOC: piperead-wakeup
+  pollwake(&pi->pollers);
   release(&pi->lock);
   return i;
 }
+
+// The pipe end's poll() readiness, for filepoll(): the
+// read end is ready for reading when there is data, and of
+// POLLHUP once the write end is closed; the write end is
+// ready when there is room, or POLLHUP if no one can read.
+int
+pipepoll(struct pipe *pi, int writable, struct pollwait *pw)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(pw)
+    pollregister(pw, &pi->pollers, &pi->lock);
+  if(writable){
+    if(!pi->readopen)
+      r = POLLHUP;
+    else if(pi->nwrite != pi->nread + PIPESIZE)
+      r = POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r = POLLIN;
+    if(!pi->writeopen)
+      r |= POLLHUP;
+  }
+  release(&pi->lock);
+  return r;
+}
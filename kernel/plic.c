@@ -7,13 +7,33 @@
 //
 // the riscv Platform Level Interrupt Controller (PLIC).
 //
+// Every hart enables both the uart and the virtio disk, but
+// disk interrupts are steered to one hart at a time with the
+// priority thresholds: the disk's priority is below the
+// uart's, and the other harts' thresholds mask it. DISKIRQ
+// in param.h picks the hart: the one that last notified the
+// disk of new requests (DISKIRQ_SUBMIT), so a completion
+// wakes its waiter on the same CPU and finds disk state in
+// that CPU's cache; a fixed hart; or any (DISKIRQ_ANY).
+// Masking by threshold rather than disabling the interrupt
+// lets a hart that has already claimed one complete it.
+//
+
+#define UARTPRIO 2
+#define DISKPRIO 1
+#define NETPRIO  2  // any hart takes e1000 interrupts
+
+static int diskhart;  // takes disk interrupts; under vdisk_lock
 
 void
 plicinit(void)
 {
   // set desired IRQ priorities non-zero (otherwise disabled).
-  *(uint32*)(PLIC + UART0_IRQ*4) = 1;
-  *(uint32*)(PLIC + VIRTIO0_IRQ*4) = 1;
+  *(uint32*)(PLIC + UART0_IRQ*4) = UARTPRIO;
+  *(uint32*)(PLIC + VIRTIO0_IRQ*4) = DISKPRIO;
+#ifdef LAB_NET
+  *(uint32*)(PLIC + E1000_IRQ*4) = NETPRIO;
+#endif
 }
 
 void
@@ -24,9 +44,34 @@ plicinithart(void)
   // set enable bits for this hart's S-mode
   // for the uart and virtio disk.
   *(uint32*)PLIC_SENABLE(hart) = (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
+#ifdef LAB_NET
+  // and the e1000, in the next word of enable bits.
+  *(uint32*)(PLIC_SENABLE(hart) + 4) = 1 << (E1000_IRQ - 32);
+#endif
 
-  // set this hart's S-mode priority threshold to 0.
+  // set this hart's S-mode priority threshold: 0 takes
+  // both, DISKPRIO only the uart. the boot hart takes
+  // disk interrupts until DISKIRQ's hart starts.
+  if(DISKIRQ == DISKIRQ_ANY || hart == 0){
+    *(uint32*)PLIC_SPRIORITY(hart) = 0;
+  } else {
+    *(uint32*)PLIC_SPRIORITY(hart) = DISKPRIO;
+    if(DISKIRQ == hart)
+      plic_diskroute(hart);
+  }
+}
+
+// route disk interrupts to hart, for DISKIRQ_SUBMIT or
+// DISKIRQ's own hart. caller must hold vdisk_lock, or be
+// starting a hart.
+void
+plic_diskroute(int hart)
+{
+  if(DISKIRQ == DISKIRQ_ANY || hart == diskhart)
+    return;
   *(uint32*)PLIC_SPRIORITY(hart) = 0;
+  *(uint32*)PLIC_SPRIORITY(diskhart) = DISKPRIO;
+  diskhart = hart;
 }
 
 // ask the PLIC what interrupt we should serve.
@@ -4,19 +4,43 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "slab.h"
+#include "ktrace.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
+// The process table starts as proc[], and grows, up to
+// MAXPROC, with procs from proccache. procs[] lists them
+// all; entries are added, never removed, and a proc's
+// index there picks its kernel stack. proc_lock protects
+// growing the table and the free list of UNUSED procs.
 struct proc proc[NPROC];
+struct proc *procs[MAXPROC];
+int nprocs;
+static struct kcache proccache;
+struct spinlock proc_lock;
+static struct proc *freeprocs;
 
 struct proc *initproc;
 
+// pid_lock protects nextpid and the pid hash table.
+#define NPIDHASH 64
 int nextpid = 1;
 struct spinlock pid_lock;
+static struct proc *pidhash[NPIDHASH];
+
+extern pagetable_t kernel_pagetable;
 
 extern void forkret(void);
+static void kthreadret(void);
+static void spawnret(void);
 static void freeproc(struct proc *p);
+static void runqput(struct proc *p);
+static int pickcpu(void);
+static int reap(struct proc *p, uint64 addr, int threads, int intr);
+static void finishswitch(void);
+static int killproc(struct proc *p, int pid);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,21 +50,27 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
+// Allocate a page for p's kernel stack, and map it high in
+// memory at va, followed by an invalid guard page. Done when
+// p is first used rather than for all of proc[] at boot;
+// kvmmake() made the page-table pages, so only this hart's
+// TLB needs a fence. Caller must hold proc_lock, which keeps changes to the
+// kernel page table one at a time.
+// Returns 0, or -1 if memory is short.
+static int
+kstackalloc(struct proc *p, uint64 va)
 {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  char *stack;
+
+  if((stack = kalloc()) == 0)
+    return -1;
+  if(mappages(kernel_pagetable, va, PGSIZE, (uint64)stack, PTE_R | PTE_W) != 0){
+    kfree(stack);
+    return -1;
   }
+  sfence_vma();
+  p->kstack = va;
+  return 0;
 }
 
 // initialize the proc table.
@@ -51,11 +81,68 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
+  initlock(&proc_lock, "proc_lock");
+  kcacheinit(&proccache, "proc", sizeof(struct proc));
+  for(int i = 0; i < NCPU; i++)
+    initlock(&cpus[i].rq.lock, "runq");
+  for(p = &proc[NPROC-1]; p >= proc; p--) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
+      procs[p - proc] = p;
+      p->freenext = freeprocs;
+      freeprocs = p;
+  }
+  nprocs = NPROC;
+}
+
+// Add a proc to the table, with a kernel stack mapped
+// at the next free slot, when proc[] is all in use.
+// Returns the proc, UNUSED, or 0 if the table is full
+// or memory is short. Caller must hold proc_lock.
+static struct proc*
+newproc(void)
+{
+  struct proc *p;
+
+  if(nprocs == MAXPROC)
+    return 0;
+  if((p = kcalloc(&proccache)) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
+  if(kstackalloc(p, KSTACK(nprocs)) < 0){
+    kcfree(&proccache, p);
+    return 0;
   }
+  initlock(&p->lock, "proc");
+  p->state = UNUSED;
+  procs[nprocs] = p;
+  __sync_synchronize();  // for scans of procs[] without proc_lock
+  nprocs++;
+  return p;
+}
+
+// The process with pid, or 0. It may exit and its proc be
+// reused once pid_lock is released, so callers must check
+// p->pid again with p->lock held.
+static struct proc*
+pidlookup(int pid)
+{
+  struct proc *p;
+
+  acquire(&pid_lock);
+  for(p = pidhash[(uint)pid % NPIDHASH]; p && p->pid != pid; p = p->pidnext)
+    ;
+  release(&pid_lock);
+  return p;
+}
+
+// Make p a child of parent. Caller must hold wait_lock.
+static void
+setparent(struct proc *p, struct proc *parent)
+{
+  p->parent = parent;
+  p->sibling = parent->children;
+  parent->children = p;
 }
 
 // Must be called with interrupts disabled,
@@ -102,35 +189,71 @@ allocpid()
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// Take an UNUSED proc off the free list, growing the
+// table if there is none, initialize state required to
+// run in the kernel, and return with p->lock held.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
+  acquire(&proc_lock);
+  if((p = freeprocs) != 0){
+    freeprocs = p->freenext;
+    // one of proc[] that has never run.
+    if(p->kstack == 0 && kstackalloc(p, KSTACK((int) (p - proc))) < 0){
+      p->freenext = freeprocs;
+      freeprocs = p;
+      p = 0;
     }
+  } else {
+    p = newproc();
   }
-  return 0;
+  release(&proc_lock);
+  if(p == 0)
+    return 0;
 
-found:
+  // freeproc() may still hold the lock.
+  acquire(&p->lock);
+  if(p->state != UNUSED)
+    panic("allocproc");
   p->pid = allocpid();
+  acquire(&pid_lock);
+  p->pidnext = pidhash[(uint)p->pid % NPIDHASH];
+  pidhash[(uint)p->pid % NPIDHASH] = p;
+  release(&pid_lock);
   p->state = USED;
+  p->prio = p->baseprio = 0;
+  p->ticksused = 0;
+  p->epoch = 0;
+  p->cpu = 0;
+  memset(p->asidgen, 0, sizeof(p->asidgen));
+  p->group = p;
+  p->tfva = TRAPFRAME;
+  p->nthread = 0;
+  p->tslots = 0;
+  p->noasid = 0;
+
+  // Allocate a trapframe page, zeroed: fork() copies the
+  // parent's into it, but a spawn()ed child starts from
+  // exec()'s few registers, and mustn't see old kernel data
+  // in the rest.
+  if((p->trapframe = (struct trapframe *)kzalloc()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  // A page to share with user code.
+  if((p->usyscall = (struct usyscall *)kzalloc()) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
   }
+  p->usyscall->pid = p->pid;
+  p->usyscall->tickcycles = TICKCYCLES;
+  p->usyscall->timefreq = TIMEFREQ;
 
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
@@ -150,25 +273,60 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages, and put it on the free list.
+// p->lock must be held, and wait_lock too if p has a parent.
 static void
 freeproc(struct proc *p)
 {
+  struct proc **pp;
+
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->usyscall)
+    kfree((void*)p->usyscall);
+  p->usyscall = 0;
+  if(p->group != p){
+    // a thread: the page table is its process's.
+    if(p->pagetable)
+      uvmunmap(p->pagetable, p->tfva, 1, 0);
+    p->group->tslots &= ~(1 << ((USYSCALL - p->tfva) / PGSIZE - 1));
+    p->group->nthread--;
+    p->group = p;
+    p->pagetable = 0;
+  }
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  if(p->pid){
+    acquire(&pid_lock);
+    for(pp = &pidhash[(uint)p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+      ;
+    *pp = p->pidnext;
+    release(&pid_lock);
+  }
   p->pid = 0;
+  if(p->parent){
+    for(pp = &p->parent->children; *pp != p; pp = &(*pp)->sibling)
+      ;
+    *pp = p->sibling;
+  }
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
+  p->spawn = 0;
+  p->pollwoken = 0;
+  p->tracemask = 0;
   p->state = UNUSED;
+
+  acquire(&proc_lock);
+  p->freenext = freeprocs;
+  freeprocs = p;
+  release(&proc_lock);
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -182,27 +340,43 @@ proc_pagetable(struct proc *p)
   pagetable = uvmcreate();
   if(pagetable == 0)
     return 0;
+  if(proc_mapfixed(p, pagetable) < 0){
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+  return pagetable;
+}
 
+// Map p's trampoline, trapframe and USYSCALL pages into
+// pagetable. Returns 0, or -1 with none of them mapped.
+int
+proc_mapfixed(struct proc *p, pagetable_t pagetable)
+{
   // map the trampoline code (for system call return)
   // at the highest user virtual address.
   // only the supervisor uses it, on the way
   // to/from user space, so not PTE_U.
   if(mappages(pagetable, TRAMPOLINE, PGSIZE,
-              (uint64)trampoline, PTE_R | PTE_X) < 0){
-    uvmfree(pagetable, 0);
-    return 0;
-  }
+              (uint64)trampoline, PTE_R | PTE_X) < 0)
+    return -1;
 
   // map the trapframe page just below the trampoline page, for
   // trampoline.S.
   if(mappages(pagetable, TRAPFRAME, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-    uvmfree(pagetable, 0);
-    return 0;
+    return -1;
   }
 
-  return pagetable;
+  // map the usyscall page just below the trapframe page,
+  // read-only for user code.
+  if(mappages(pagetable, USYSCALL, PGSIZE,
+              (uint64)(p->usyscall), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    return -1;
+  }
+  return 0;
 }
 
 // Free a process's page table, and free the
@@ -212,6 +386,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USYSCALL, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -250,30 +425,80 @@ userinit(void)
   p->cwd = namei("/");
 
   p->state = RUNNABLE;
+  runqput(p);
+
+  release(&p->lock);
+}
+
+// Start a kernel thread that runs fn(), which must never
+// return. It has no user memory, isn't anyone's child, and
+// can't be killed. Returns its pid, or -1.
+int
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  pid = p->pid;
+
+  p->state = RUNNABLE;
+  runqput(p);
 
   release(&p->lock);
+  return pid;
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only moves the size; uvmfault() allocates
+// each new page when it is first touched. Threads
+// share their process's size, p->group->sz, and
+// memory can't shrink under them; the group's lock
+// keeps two threads from growing it to the same place.
+// Sets *oldsz to the size before.
 // Return 0 on success, -1 on failure.
 int
-growproc(int n)
+growproc(int n, uint64 *oldsz)
 {
   uint64 sz;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->group;
 
-  sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    acquire(&p->lock);
+    sz = *oldsz = p->sz;
+    if(sz + n < sz || sz + n > mmapbase(p)){
+      release(&p->lock);
       return -1;
     }
-  } else if(n < 0){
+    p->sz = sz + n;
+    release(&p->lock);
+    return 0;
+  }
+  sz = *oldsz = p->sz;
+  if(n < 0){
+    // no other thread, so no lock needed.
+    if(sharedvm(p))
+      return -1;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    segtrim(p, sz);
+    p->sz = sz;
   }
-  p->sz = sz;
   return 0;
 }
 
+// Does p's memory have threads in it? If so, the mappings
+// may only be added to, not changed: fork(), exec(), mmap()
+// and munmap() refuse, as does shrinking the heap.
+int
+sharedvm(struct proc *p)
+{
+  return p->group != p || p->nthread > 0;
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int
@@ -283,6 +508,9 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  if(sharedvm(p))
+    return -1;
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
@@ -296,6 +524,13 @@ fork(void)
   }
   np->sz = p->sz;
 
+  // Copy memory-mapped regions.
+  if(mmapfork(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -307,21 +542,199 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  np->baseprio = np->prio = p->baseprio;
+  np->cpu = pickcpu();
+  np->tracemask = p->tracemask;
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  setparent(np, p);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  runqput(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a thread of the current process: a process of its
+// own as far as the scheduler is concerned, but running in
+// p's page table, starting at fn(arg) on the user stack
+// stack. Its trapframe is mapped at a THREADFRAME() slot of
+// p's, rather than TRAPFRAME, which holds p's. The thread
+// gets copies of p's file descriptors, like a fork() child.
+// Only p itself, not one of its threads, may clone() and
+// join(). Returns the thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, slot, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if(p->group != p)
+    return -1;
+  for(slot = 0; slot < NTHREAD && (p->tslots & (1 << slot)); slot++)
+    ;
+  if(slot == NTHREAD)
+    return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = p->pagetable;
+  np->group = p;
+  np->tfva = THREADFRAME(slot);
+  p->tslots |= 1 << slot;
+  p->nthread++;
+  if(mappages(np->pagetable, np->tfva, PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  // other CPUs may hold TLB entries for p's page table,
+  // under ASIDs that are only flushed when it changes.
+  if(!p->noasid){
+    p->noasid = 1;
+    uvmflush(p->pagetable, -1);
+  }
+  np->sz = p->sz;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = arg;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
+  // for mmapfault(); the files stay p's.
+  memmove(np->vma, p->vma, sizeof(p->vma));
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  np->baseprio = np->prio = p->baseprio;
+  np->cpu = pickcpu();
+  np->tracemask = p->tracemask;
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  setparent(np, p);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  runqput(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// What spawn() hands its child, for spawnret().
+struct spawn {
+  char *path;
+  char **argv;
+  int ret;       // exec()'s result
+  int done;      // has the child called exec()? see wait_lock
+};
+
+// Create a child process running the program path with
+// arguments argv, without copying the current process's
+// memory as fork() followed by exec() would. The child's
+// file descriptor i is a dup of the caller's fds[i] for
+// i < nfds, or closed if fds[i] is -1; it gets no others.
+// The child calls exec() itself, in spawnret(), and the
+// caller waits for the result, so that a program that
+// can't be run is reported here rather than by a child
+// that exits. Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fds, int nfds)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct spawn sp;
+
+  for(i = 0; i < nfds; i++){
+    if(fds[i] != -1 && (fds[i] < 0 || fds[i] >= NOFILE || p->ofile[fds[i]] == 0))
+      return -1;
+  }
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  sp.path = path;
+  sp.argv = argv;
+  sp.done = 0;
+  np->spawn = &sp;
+  np->context.ra = (uint64)spawnret;
+
+  for(i = 0; i < nfds; i++)
+    if(fds[i] != -1)
+      np->ofile[i] = filedup(p->ofile[fds[i]]);
+  np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  np->baseprio = np->prio = p->baseprio;
+  np->cpu = pickcpu();
+  np->tracemask = p->tracemask;
+
   pid = np->pid;
 
   release(&np->lock);
 
   acquire(&wait_lock);
-  np->parent = p;
+  setparent(np, p);
   release(&wait_lock);
 
   acquire(&np->lock);
   np->state = RUNNABLE;
+  runqput(np);
   release(&np->lock);
 
+  // sp is on this stack, so wait even if killed.
+  acquire(&wait_lock);
+  while(!sp.done)
+    sleepon(&p->childq, &wait_lock);
+  if(sp.ret < 0){
+    // the child is exiting; free it here, so that
+    // wait() never sees it.
+    for(;;){
+      acquire(&np->lock);
+      if(np->state == ZOMBIE)
+        break;
+      release(&np->lock);
+      sleepon(&p->childq, &wait_lock);
+    }
+    freeproc(np);
+    release(&np->lock);
+    pid = -1;
+  }
+  release(&wait_lock);
+
   return pid;
 }
 
@@ -332,12 +745,13 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  while((pp = p->children) != 0){
+    p->children = pp->sibling;
+    setparent(pp, initproc);
   }
+  wakeq(&initproc->childq);
 }
 
 // Exit the current process.  Does not return.
@@ -351,6 +765,25 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // p's threads use its memory, so they go first.
+  if(p->nthread > 0){
+    acquire(&wait_lock);
+    for(struct proc *pp = p->children; pp; pp = pp->sibling){
+      if(pp->group == p)
+        killproc(pp, pp->pid);
+    }
+    release(&wait_lock);
+    while(p->nthread > 0)
+      reap(p, 0, 1, 0);
+  }
+
+  // Unmap memory-mapped files, writing back changes.
+  // A thread's regions are its process's.
+  if(p->group == p)
+    munmapall(p);
+  else
+    memset(p->vma, 0, sizeof(p->vma));
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -362,8 +795,11 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -371,7 +807,7 @@ exit(int status)
   reparent(p);
 
   // Parent might be sleeping in wait().
-  wakeup(p->parent);
+  wakeq(&p->parent->childq);
   
   acquire(&p->lock);
 
@@ -385,22 +821,23 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child of p to exit, free it and return its pid:
+// a child process, or if threads is set, one of p's threads.
+// Return -1 if p has no such children, or if intr is set
+// and p has been killed.
+static int
+reap(struct proc *p, uint64 addr, int threads, int intr)
 {
   struct proc *pp;
   int havekids, pid;
-  struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through the children looking for exited ones.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
+    for(pp = p->children; pp; pp = pp->sibling){
+      if((pp->group != pp) == threads){
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
 
@@ -424,20 +861,247 @@ wait(uint64 addr)
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || killed(p)){
+    if(!havekids || (intr && killed(p))){
       release(&wait_lock);
       return -1;
     }
     
     // Wait for a child to exit.
-    sleep(p, &wait_lock);  //DOC: wait-sleep
+    sleepon(&p->childq, &wait_lock);  //DOC: wait-sleep
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr)
+{
+  return reap(myproc(), addr, 0, 1);
+}
+
+// Wait for a thread of this process to exit and return
+// its pid. Return -1 if this process has no threads.
+int
+join(uint64 addr)
+{
+  return reap(myproc(), addr, 1, 1);
+}
+
+// Run queues.
+//
+// Each CPU has its own queue of RUNNABLE processes, so picking
+// the next process costs O(NPRIO) instead of a scan of proc[].
+// A process is on a run queue exactly when it is RUNNABLE,
+// except while one that gave up the CPU is still switching
+// away: every transition to RUNNABLE goes through runqput(),
+// and only the scheduler and sched() take processes off. A
+// yielding process is queued only once it is off its CPU,
+// by whatever runs next there (see finishswitch()), so no
+// queued process's lock is held for more than a moment.
+//
+// sched() switches straight to the next process on this
+// CPU's queue when there is one, rather than through the
+// scheduler's context, saving a swtch() each way. The
+// scheduler only runs when the queue is empty, to steal
+// or to idle.
+//
+// The policy is a multilevel feedback queue. A process runs for
+// QUANTUM(prio) timer ticks at its level before being demoted
+// one level, so CPU hogs sink while processes that mostly sleep
+// (like sh) stay at the top. Every BOOSTTICKS ticks starts a new
+// boost epoch, which puts every process back at its baseprio so
+// that demoted processes aren't starved.
+
+#define QUANTUM(prio) (1 << (prio))
+#define BOOSTTICKS 10
+
+static void
+runqappend(struct runq *rq, struct proc *p)
+{
+  p->rqnext = 0;
+  if(rq->tail[p->prio])
+    rq->tail[p->prio]->rqnext = p;
+  else
+    rq->head[p->prio] = p;
+  rq->tail[p->prio] = p;
+  rq->n++;
+}
+
+// Wake idle CPU c from wfi(). Returns 0 if c wasn't idle,
+// or someone else has already woken it.
+static int
+kick(struct cpu *c)
+{
+  if(c->idle && __sync_bool_compare_and_swap(&c->idle, 1, 0)){
+    ipi(c - cpus);
+    return 1;
+  }
+  return 0;
+}
+
+// Put p on the tail of the run queue of CPU p->cpu,
+// at level p->prio. Asks that CPU to preempt the process
+// it is running if p has higher priority.
+// Caller must hold p->lock, and p must be RUNNABLE.
+static void
+runqput(struct proc *p)
+{
+  struct cpu *c = &cpus[p->cpu];
+  struct proc *cur;
+  uint epoch = ticks / BOOSTTICKS;
+
+  if(p->epoch != epoch){
+    // a boost has happened since p's priority was last reset.
+    p->epoch = epoch;
+    p->prio = p->baseprio;
+    p->ticksused = 0;
+  }
+
+  acquire(&c->rq.lock);
+  runqappend(&c->rq, p);
+  release(&c->rq.lock);
+
+  // if c is idle, wake it. otherwise wake some idle CPU
+  // to steal p, rather than leave p waiting behind c's
+  // current process. pairs with the fence in idle().
+  __sync_synchronize();
+  if(!kick(c)){
+    for(int i = 0; i < NCPU; i++){
+      if(kick(&cpus[i]))
+        break;
+    }
+  }
+
+  // racy peek at c->proc; it's only a hint, and proc[]
+  // entries are never freed.
+  cur = c->proc;
+  if(cur != 0 && cur != p && cur->prio > p->prio)
+    c->resched = 1;
+}
+
+// Start a new boost epoch on rq: move every queued
+// process back to its base priority, keeping their order.
+// Queued processes are only touched under rq->lock.
+// Caller must hold rq->lock.
+static void
+runqboost(struct runq *rq, uint epoch)
+{
+  struct proc *list, **tailp, *p;
+  int i;
+
+  list = 0;
+  tailp = &list;
+  for(i = 0; i < NPRIO; i++){
+    if(rq->head[i]){
+      *tailp = rq->head[i];
+      tailp = &rq->tail[i]->rqnext;
+    }
+    rq->head[i] = rq->tail[i] = 0;
+  }
+  *tailp = 0;
+  rq->n = 0;
+
+  while((p = list) != 0){
+    list = p->rqnext;
+    p->prio = p->baseprio;
+    p->ticksused = 0;
+    p->epoch = epoch;
+    runqappend(rq, p);
+  }
+  rq->epoch = epoch;
+}
+
+// Remove and return the highest-priority process on rq
+// at level prio or better, or 0 if there is none.
+static struct proc*
+runqget(struct runq *rq, int prio)
+{
+  struct proc *p;
+  uint epoch;
+
+  if(rq->n == 0)  // racy peek, to keep idle CPUs off the lock.
+    return 0;
+
+  acquire(&rq->lock);
+  epoch = ticks / BOOSTTICKS;
+  if(rq->epoch != epoch)
+    runqboost(rq, epoch);
+  for(int i = 0; i <= prio; i++){
+    if((p = rq->head[i]) != 0){
+      rq->head[i] = p->rqnext;
+      if(rq->head[i] == 0)
+        rq->tail[i] = 0;
+      rq->n--;
+      release(&rq->lock);
+      return p;
+    }
+  }
+  release(&rq->lock);
+  return 0;
+}
+
+// Take a process from some other CPU's run queue,
+// for a CPU that has nothing of its own to run.
+static struct proc*
+runqsteal(int id)
+{
+  struct proc *p;
+
+  for(int i = 1; i < NCPU; i++){
+    if((p = runqget(&cpus[(id + i) % NCPU].rq, NPRIO-1)) != 0)
+      return p;
+  }
+  return 0;
+}
+
+// Choose a run queue for a new process: the running
+// CPU with the fewest queued processes. The lengths
+// are read without locks; this only balances load.
+static int
+pickcpu(void)
+{
+  int best = cpuid();
+
+  for(int i = 0; i < NCPU; i++){
+    if(cpus[i].active && cpus[i].rq.n < cpus[best].rq.n)
+      best = i;
+  }
+  return best;
+}
+
+// Wait for something to do on CPU c, which has found all
+// run queues empty, without spinning: wfi() until an
+// interrupt. Sets c->idle before checking the queues a last
+// time, so a runqput() that this check misses sees c->idle
+// and sends an IPI. Interrupts stay off, so that they're
+// taken only with c->idle clear, by the scheduler's intr_on().
+static void
+idle(struct cpu *c)
+{
+  uint64 start;
+  int i;
+
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++){
+    if(cpus[i].rq.n)
+      break;
+  }
+  if(i == NCPU){
+    start = clocktime();
+    wfi();
+    c->idletime += clocktime() - start;
+  }
+  c->idle = 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the highest-priority process off this CPU's
+//    run queue, or steal one from another CPU, or
+//    wait for an interrupt if there's none.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,32 +1110,50 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
   c->proc = 0;
+  c->active = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    c->resched = 0;
+    if((p = runqget(&c->rq, NPRIO-1)) == 0 && (p = runqsteal(id)) == 0){
+      // make use of the time to zero a page, or else wait.
+      if(!kprezero())
+        idle(c);
+      continue;
     }
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: queued process not runnable");
+    p->state = RUNNING;
+    p->cpu = id;
+    ktrace(KT_SWITCH, 0, p->pid);
+    c->proc = p;
+    clockresume();
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now. It may not be
+    // the one we started, if it switched to another.
+    // It should have changed its p->state before coming back.
+    p = c->proc;
+    c->proc = 0;
+    if(p->state == RUNNABLE)
+      runqput(p);
+    release(&p->lock);
   }
 }
 
-// Switch to scheduler.  Must hold only p->lock
+// Switch to the next process on this CPU's run queue, or
+// to the scheduler if there is none. A RUNNABLE (yielding)
+// process carries on if nothing at its level or better is
+// queued. Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -483,6 +1165,8 @@ sched(void)
 {
   int intena;
   struct proc *p = myproc();
+  struct proc *q;
+  struct cpu *c = mycpu();
 
   if(!holding(&p->lock))
     panic("sched p->lock");
@@ -493,11 +1177,52 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
-  intena = mycpu()->intena;
-  swtch(&p->context, &mycpu()->context);
+  intena = c->intena;
+  c->resched = 0;
+  q = runqget(&c->rq, p->state == RUNNABLE ? p->prio : NPRIO-1);
+  if(q == 0 && p->state == RUNNABLE){
+    // nothing else here as deserving: carry on.
+    p->state = RUNNING;
+  } else if(q == 0){
+    ktrace(KT_SWITCH, p->pid, 0);
+    swtch(&p->context, &c->context);
+    finishswitch();
+  } else {
+    // hand the CPU straight to q. q can't be running
+    // or switching away, being on a queue, so no one
+    // holds q->lock for long.
+    acquire(&q->lock);
+    if(q->state != RUNNABLE)
+      panic("sched: queued process not runnable");
+    q->state = RUNNING;
+    q->cpu = c - cpus;
+    ktrace(KT_SWITCH, p->pid, q->pid);
+    c->proc = q;
+    c->prev = p;
+    swtch(&p->context, &q->context);
+    finishswitch();
+  }
   mycpu()->intena = intena;
 }
 
+// Called by a process that has just been switched to
+// directly from another, on its CPU, before anything
+// else: release the process it took over from, and
+// queue it if it only yielded.
+static void
+finishswitch(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p = c->prev;
+
+  if(p == 0)
+    return;
+  c->prev = 0;
+  if(p->state == RUNNABLE)
+    runqput(p);
+  release(&p->lock);
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
@@ -509,6 +1234,73 @@ yield(void)
   release(&p->lock);
 }
 
+// Called by usertrap() and kerneltrap() in the running
+// process before returning from a trap. On a timer
+// interrupt, charge the process a tick, demoting it once
+// it has used its quantum at this level. Give up the CPU
+// when the quantum is used up, or if a higher-priority
+// process has been queued on this CPU.
+// Most returns, from system calls especially, have nothing
+// to do, so p->lock is only taken to switch or demote.
+void
+preempt(int timer)
+{
+  struct proc *p = myproc();
+  int resched, used;
+
+  push_off();
+  resched = mycpu()->resched;  // a hint; sched() sorts it out
+  pop_off();
+  // only p counts its own ticks, but setpriority() may reset
+  // them, which is why the add is atomic and p->lock rechecks.
+  used = timer && __sync_add_and_fetch(&p->ticksused, 1) >= QUANTUM(p->prio);
+  if(!resched && !used)
+    return;
+
+  acquire(&p->lock);
+  if(used && p->ticksused >= QUANTUM(p->prio)){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->ticksused = 0;
+    resched = 1;
+  }
+  if(resched){
+    p->state = RUNNABLE;
+    sched();
+  }
+  release(&p->lock);
+}
+
+// Set the base priority of process pid (0 is the highest;
+// pid 0 means the caller), and move it to that level.
+// Returns 0, or -1 if there is no such process or the
+// priority is out of range.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+
+  if((p = pidlookup(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if(p->pid == pid && p->state != UNUSED){
+    // if p is queued it stays at its old level
+    // until it next runs.
+    p->baseprio = prio;
+    p->prio = prio;
+    p->ticksused = 0;
+    release(&p->lock);
+    return 0;
+  }
+  release(&p->lock);
+  return -1;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -516,7 +1308,8 @@ forkret(void)
 {
   static int first = 1;
 
-  // Still holding p->lock from scheduler.
+  // Still holding p->lock from scheduler or sched().
+  finishswitch();
   release(&myproc()->lock);
 
   if (first) {
@@ -530,6 +1323,49 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler or sched().
+  finishswitch();
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
+// A spawn() child's very first scheduling by scheduler()
+// will swtch to spawnret, to exec() its program.
+static void
+spawnret(void)
+{
+  struct proc *p = myproc();
+  struct spawn *sp = p->spawn;
+  int r;
+
+  // Still holding p->lock from scheduler or sched().
+  finishswitch();
+  release(&p->lock);
+
+  r = exec(sp->path, sp->argv);
+
+  acquire(&wait_lock);
+  sp->ret = r;
+  sp->done = 1;
+  p->spawn = 0;
+  wakeq(&p->parent->childq);
+  release(&wait_lock);
+
+  if(r < 0)
+    exit(-1);
+  p->trapframe->a0 = r;  // argc, as exec() would return it
+  usertrapret();
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -561,6 +1397,47 @@ sleep(void *chan, struct spinlock *lk)
   acquire(lk);
 }
 
+// Atomically release lock and sleep on wait queue q, until
+// wakeq(q). lk must be the lock that protects q.
+// Reacquires lock when awakened.
+// Unlike wakeup(), wakeq() touches only the processes
+// waiting on q.
+void
+sleepon(struct waitq *q, struct spinlock *lk)
+{
+  struct proc *p = myproc();
+  struct proc **pp;
+
+  p->wq = q;
+  p->wqnext = q->head;
+  q->head = p;
+
+  sleep(q, lk);
+
+  // kill() may have woken us with p still on q.
+  if(p->wq == q){
+    for(pp = &q->head; *pp != p; pp = &(*pp)->wqnext)
+      ;
+    *pp = p->wqnext;
+    p->wq = 0;
+  }
+}
+
+// Wake up all processes sleeping on q.
+// Caller must hold the lock that protects q,
+// and no p->lock.
+void
+wakeq(struct waitq *q)
+{
+  struct proc *p;
+
+  while((p = q->head) != 0){
+    q->head = p->wqnext;
+    p->wq = 0;
+    wakeproc(p, q);
+  }
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void
@@ -568,17 +1445,70 @@ wakeup(void *chan)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(int i = 0; i < nprocs; i++) {
+    p = procs[i];
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
         p->state = RUNNABLE;
+        runqput(p);
       }
       release(&p->lock);
     }
   }
 }
 
+// Wake p if it is sleeping on chan, when the caller
+// knows which process to wake.
+void
+wakeproc(struct proc *p, void *chan)
+{
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan){
+    p->state = RUNNABLE;
+    runqput(p);
+  }
+  release(&p->lock);
+}
+
+// Wake p from pollsleep(), or keep its next one from
+// sleeping, for a file that p's poll() is waiting on.
+void
+pollwakeproc(struct proc *p)
+{
+  acquire(&p->lock);
+  p->pollwoken = 1;
+  if(p->state == SLEEPING && p->chan == &p->wakeat){
+    p->state = RUNNABLE;
+    runqput(p);
+  }
+  release(&p->lock);
+}
+
+// Sleep for poll() until pollwakeproc(), kill(), or, if
+// timed, the clockalarm() deadline. Returns 1 if the
+// deadline has passed. There's no condition lock: p->lock
+// is held from the checks to the sleep, and clockintr()
+// clears p->tqueued before it wakes p, so no wakeup is lost.
+int
+pollsleep(int timed)
+{
+  struct proc *p = myproc();
+  int expired;
+
+  acquire(&p->lock);
+  if(!p->pollwoken && !p->killed && (!timed || p->tqueued)){
+    p->chan = &p->wakeat;
+    p->state = SLEEPING;
+    sched();
+    p->chan = 0;
+  }
+  p->pollwoken = 0;
+  expired = timed && !p->tqueued;
+  release(&p->lock);
+  return expired;
+}
+
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
@@ -587,19 +1517,27 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
+  if((p = pidlookup(pid)) == 0)
+    return -1;
+  return killproc(p, pid);
+}
+
+// Kill p, if it is still process pid.
+static int
+killproc(struct proc *p, int pid)
+{
+  acquire(&p->lock);
+  if(p->pid == pid && p->kfn == 0){
+    p->killed = 1;
+    if(p->state == SLEEPING){
+      // Wake process from sleep().
+      p->state = RUNNABLE;
+      runqput(p);
     }
     release(&p->lock);
+    return 0;
   }
+  release(&p->lock);
   return -1;
 }
 
@@ -670,14 +1608,34 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(int i = 0; i < nprocs; i++){
+    p = procs[i];
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s prio %d", p->pid, state, p->name, p->prio);
     printf("\n");
   }
 }
+
+// Format per-CPU idle time, in milliseconds, into buf.
+// Returns the number of bytes written.
+int
+statscpu(char *buf, int sz)
+{
+  int n;
+
+  n = snprintf(buf, sz, "--- cpu stats\n#uptime ms %d\n",
+               (int)(clocktime() / (TIMEFREQ/1000)));
+  for(int i = 0; i < NCPU; i++){
+    if(!cpus[i].active)
+      continue;
+    n += snprintf(buf+n, sz-n, "cpu %d: #idle ms %d #uart intr %d #disk intr %d\n",
+                  i, (int)(cpus[i].idletime / (TIMEFREQ/1000)),
+                  cpus[i].nuartintr, cpus[i].ndiskintr);
+  }
+  return n;
+}
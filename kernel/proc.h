@@ -18,12 +18,37 @@ struct context {
   uint64 s11;
 };
 
+// Per-CPU run queue of RUNNABLE processes: a FIFO for
+// each priority level, level 0 being the highest.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;                      // Number of queued processes.
+  uint epoch;                 // Boost epoch of the queued priorities.
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct runq rq;             // Processes waiting to run on this cpu.
+  int resched;                // A higher-priority process is queued here.
+  struct proc *prev;          // Switched away from by sched(), still locked.
+  int active;                 // Has this cpu entered scheduler()?
+  int tickless;               // Idle, with no periodic timer interrupt.
+  uint tick;                  // The tick clockintr() last saw.
+  int idle;                   // In wfi; runqput() must send an IPI.
+  uint64 idletime;            // Timer cycles spent in wfi.
+  uint asidmax;               // Largest ASID the MMU has, 0 if none.
+  uint nextasid;              // Next ASID to hand out.
+  uint asidgen;               // Generation of the ASIDs handed out.
+  pagetable_t userpt;         // User page table, while in user mode.
+  uint ntrap;                 // Traps from user mode, for shootdown().
+  uint nuartintr;             // Device interrupts taken, for statscpu().
+  uint ndiskintr;
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,6 +106,29 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A memory-mapped region of a file, made by mmap(), or
+// of a shared memory segment.
+struct vma {
+  int used;
+  uint64 addr;                 // page-aligned start
+  uint64 len;                  // page-aligned length
+  int prot;                    // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // mapped file
+  struct shm *shm;             // ... or segment, if not 0
+  uint off;                    // file offset of addr
+};
+
+// A program segment that exec() left to be paged in
+// from the program file by execfault().
+struct seg {
+  uint64 va;                   // page-aligned start
+  uint64 memsz;
+  uint off;                    // file offset of va
+  uint filesz;
+  int perm;                    // PTE_ flags
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -91,17 +139,63 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int prio;                    // MLFQ level, 0 is the highest priority
+  int baseprio;                // Level to start at, set by setpriority()
+  int ticksused;               // Timer ticks used at this level
+  uint epoch;                  // Boost epoch prio was last reset in
+  int cpu;                     // Run queue to join when runnable
+  void (*kfn)(void);           // If non-zero, a kernel thread running kfn
+  struct spawn *spawn;         // If non-zero, spawn()'s program to exec
+  int pollwoken;               // pollwakeproc() since the last pollsleep()
 
-  // wait_lock must be held when using this:
+  int logres;                  // Log blocks reserved by begin_op()
+  uint64 tracemask;            // System calls to time, as 1L<<SYS_...
+
+  // the waitq's lock must be held when using these:
+  struct waitq *wq;            // If non-zero, queued on wq
+  struct proc *wqnext;         // Next process in wq
+  uint64 futex;                // User address futexwait() sleeps on
+
+  // tickslock must be held when using these:
+  uint64 wakeat;               // sys_sleep() deadline, in timer cycles
+  struct proc *tnext;          // Next process in the sleep queue
+  int tqueued;                 // In the sleep queue?
+
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next process in the run queue
+
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // Its children, threads too
+  struct proc *sibling;        // Next child of parent
+
+  struct proc *freenext;       // Next on free list, under proc_lock
+  struct proc *pidnext;        // Next in pid hash chain, under pid_lock
+
+  // set by allocproc() and clone(); a thread's are changed
+  // only by its process, which alone makes and joins threads.
+  struct proc *group;          // Process whose memory this thread shares, or p
+  uint64 tfva;                 // User address of the trapframe
+  int nthread;                 // Threads cloned and not yet joined
+  uint tslots;                 // THREADFRAME() slots in use, a bitmask
+  int noasid;                  // Has had threads: no ASIDs until exec()
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
+  uint64 sz;                   // Size of process memory (bytes); see group
+  uint64 swaphand;             // Where pageout()'s clock sweep goes on from
   pagetable_t pagetable;       // User page table
+  struct waitq childq;         // wait() for a child to exit; see wait_lock
   struct trapframe *trapframe; // data page for trampoline.S
+  struct usyscall *usyscall;   // data page shared with user code
+  uint asid[NCPU];             // ASID on each CPU, see uvmsatp()
+  uint asidgen[NCPU];          // ... valid if the CPU's asidgen
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
+  struct vma vma[NVMA];        // Memory-mapped files
+  struct inode *exe;           // Program file, for execfault()
+  struct seg seg[NSEG];        // Its segments not yet read in
+  int nseg;
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
 };
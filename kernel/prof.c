@@ -0,0 +1,196 @@
+//
+// the sampling profiler.
+//
+// While profile() has a sampling period set, each CPU
+// running a process takes a timer interrupt at least that
+// often, and devintr() records the call stack it
+// interrupted in the CPU's buffer: the kernel's, walked by
+// frame pointer from sepc, and the process's user stack
+// from its trapframe. Reading the profile device takes the
+// samples out, as struct profsamples.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NPROFSAMPLE 256  // samples each CPU keeps until read
+
+struct profbuf {
+  struct spinlock lock;
+  int n;                // samples in s
+  int ndrop;            // samples dropped since profile()
+  struct profsample s[NPROFSAMPLE];
+};
+
+static struct profbuf profbufs[NCPU];
+
+// sampling period in timer cycles, or 0 if not sampling.
+uint64 profcycles;
+
+extern char kernelvec[];
+extern char etext[];
+
+// Is fp a frame pointer in the stack page of fp0?
+static int
+profframe(uint64 fp, uint64 fp0)
+{
+  return fp % 16 == 0 && fp >= 16 && PGROUNDDOWN(fp - 1) == PGROUNDDOWN(fp0 - 1);
+}
+
+// Walk the kernel stack the interrupt came in on: skip this
+// handler's frames up to kerneltrap(), called by kernelvec,
+// whose saved frame pointer is the interrupted code's.
+static int
+profkernel(uint64 *pc, int max)
+{
+  uint64 fp, fp0, ra;
+  int n, found;
+
+  fp = fp0 = r_fp();
+  n = 0;
+  pc[n++] = r_sepc();
+  found = 0;
+  while(n < max && profframe(fp, fp0)){
+    ra = *(uint64*)(fp - 8);
+    fp = *(uint64*)(fp - 16);
+    if(found){
+      if(ra < KERNBASE || ra >= (uint64)etext)
+        break;
+      pc[n++] = ra;
+    } else if(ra >= (uint64)kernelvec && ra < (uint64)kernelvec + 256){
+      found = 1;
+    }
+  }
+  return n;
+}
+
+// Walk p's user stack from its trapframe, reading it
+// through the page table, which doesn't change under us
+// since p isn't running and has no threads.
+static int
+profuser(struct proc *p, uint64 *pc, int max)
+{
+  uint64 fp, fp0, pa, *frame;
+  int n;
+
+  n = 0;
+  pc[n++] = p->trapframe->epc;
+  if(sharedvm(p))
+    return n;
+  fp = fp0 = p->trapframe->s0;
+  while(n < max && profframe(fp, fp0)){
+    if((pa = walkaddr(p->pagetable, fp - 16)) == 0)
+      break;
+    frame = (uint64*)(pa + (fp - 16) % PGSIZE);
+    pc[n++] = frame[1];
+    fp = frame[0];
+  }
+  return n;
+}
+
+// Record a sample of what this CPU was doing when the
+// timer interrupted it. Called by devintr(), with
+// interrupts off.
+void
+profsample(void)
+{
+  struct profbuf *b = &profbufs[cpuid()];
+  struct proc *p = myproc();
+  struct profsample *s;
+
+  acquire(&b->lock);
+  if(b->n == NPROFSAMPLE){
+    b->ndrop++;
+    release(&b->lock);
+    return;
+  }
+  s = &b->s[b->n++];
+  s->pid = p ? p->pid : 0;
+  safestrcpy(s->name, p ? p->name : "-", sizeof(s->name));
+  s->nk = s->nu = 0;
+  if(r_sstatus() & SSTATUS_SPP)
+    s->nk = profkernel(s->pc, PROFDEPTH);
+  if(p && p->kfn == 0 && p->trapframe)
+    s->nu = profuser(p, s->pc + s->nk, PROFDEPTH - s->nk);
+  release(&b->lock);
+}
+
+// Sample every cycles timer cycles from now on, or stop if
+// cycles is 0, and throw away the samples not yet read.
+// Returns the number of samples dropped, for lack of room,
+// since the last call.
+int
+profile(uint64 cycles)
+{
+  struct profbuf *b;
+  int ndrop = 0;
+
+  if(cycles > 0 && cycles < PROFMIN)
+    cycles = PROFMIN;
+  profcycles = cycles;
+  for(b = profbufs; b < &profbufs[NCPU]; b++){
+    acquire(&b->lock);
+    ndrop += b->ndrop;
+    b->ndrop = 0;
+    b->n = 0;
+    release(&b->lock);
+  }
+  return ndrop;
+}
+
+// Read whole samples, taking them out of the CPUs' buffers.
+static int
+profread(int user_dst, uint64 dst, int n)
+{
+  struct profsample s[4];
+  struct profbuf *b;
+  int tot, m;
+
+  tot = 0;
+  for(b = profbufs; b < &profbufs[NCPU]; b++){
+    for(;;){
+      // copy a few out at a time, so as not to copy to
+      // the user while holding b->lock.
+      acquire(&b->lock);
+      m = (n - tot) / sizeof(s[0]);
+      if(m > NELEM(s))
+        m = NELEM(s);
+      if(m > b->n)
+        m = b->n;
+      memmove(s, b->s, m * sizeof(s[0]));
+      b->n -= m;
+      memmove(b->s, b->s + m, b->n * sizeof(s[0]));
+      release(&b->lock);
+      if(m == 0)
+        break;
+      if(either_copyout(user_dst, dst + tot, s, m * sizeof(s[0])) < 0)
+        return tot > 0 ? tot : -1;
+      tot += m * sizeof(s[0]);
+    }
+  }
+  return tot;
+}
+
+static int
+profwrite(int user_src, uint64 src, int n)
+{
+  return -1;
+}
+
+void
+profinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&profbufs[i].lock, "prof");
+  devsw[PROFILE].read = profread;
+  devsw[PROFILE].write = profwrite;
+}
@@ -0,0 +1,11 @@
+#define PROFDEPTH 12  // most PCs in a sample
+
+// A profiler sample: the call stack a timer interrupt
+// found, as read from the profile device.
+struct profsample {
+  int pid;              // 0 if no process was running
+  char name[16];        // the process's name
+  uchar nk;             // kernel PCs in pc[], innermost first,
+  uchar nu;             //   followed by this many user PCs
+  uint64 pc[PROFDEPTH];
+};
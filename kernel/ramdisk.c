@@ -1,5 +1,12 @@
 //
-// ramdisk that uses the disk image loaded by qemu -initrd fs.img
+// ramdisk: with make RAMDISK=1, fs.img is linked into the
+// kernel (at fsimg, see the Makefile) and used as the disk
+// instead of virtio.
+//
+// A buffer's data is the block in the image itself, set by
+// bget(), so reading a block is free and writing one back
+// is already done. Only writes of a buffer to some other
+// block, as the log does, copy.
 //
 
 #include "types.h"
@@ -12,34 +19,33 @@
 #include "fs.h"
 #include "buf.h"
 
+extern uchar fsimg[], fsimgend[];
+
 void
 ramdiskinit(void)
 {
+  if((uint64)fsimg % PGSIZE != 0 || fsimgend - fsimg != (uint64)FSSIZE * BSIZE)
+    panic("ramdiskinit: bad fs.img");
 }
 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-ramdiskrw(struct buf *b)
+// The image's copy of block blockno.
+uchar*
+ramdiskblock(uint blockno)
 {
-  if(!holdingsleep(&b->lock))
-    panic("ramdiskrw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("ramdiskrw: nothing to do");
-
-  if(b->blockno >= FSSIZE)
-    panic("ramdiskrw: blockno too big");
+  if(blockno >= FSSIZE)
+    panic("ramdiskblock: blockno too big");
+  return fsimg + (uint64)blockno * BSIZE;
+}
 
-  uint64 diskaddr = b->blockno * BSIZE;
-  char *addr = (char *)RAMDISK + diskaddr;
+// Write b's contents to block blockno, which is
+// normally b's own.
+void
+ramdiskwrite(struct buf *b, uint blockno)
+{
+  uchar *addr = ramdiskblock(blockno);
 
-  if(b->flags & B_DIRTY){
-    // write
+  if(!holdingsleep(&b->lock))
+    panic("ramdiskwrite: buf not locked");
+  if(addr != b->data)
     memmove(addr, b->data, BSIZE);
-    b->flags &= ~B_DIRTY;
-  } else {
-    // read
-    memmove(b->data, addr, BSIZE);
-    b->flags |= B_VALID;
-  }
 }
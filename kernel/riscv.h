@@ -201,6 +201,12 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// the address space identifier field of satp; trampoline.S
+// extracts it with shifts of 4 and 48.
+#define SATP_ASIDSHIFT 44
+#define SATP_ASIDMASK (0xffffL << SATP_ASIDSHIFT)
+#define SATP_ASID(asid) (((uint64)(asid)) << SATP_ASIDSHIFT)
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -256,6 +262,23 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor Counter-Enable, for user mode
+static inline void
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
+#define COUNTEREN_TM (1L << 1) // the time CSR
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -287,6 +310,14 @@ intr_get()
   return (x & SSTATUS_SIE) != 0;
 }
 
+// wait for an interrupt. returns when one is pending,
+// even if device interrupts are disabled.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 static inline uint64
 r_sp()
 {
@@ -319,6 +350,15 @@ r_ra()
   return x;
 }
 
+// read the frame pointer.
+static inline uint64
+r_fp()
+{
+  uint64 x;
+  asm volatile("mv %0, s0" : "=r" (x) );
+  return x;
+}
+
 // flush the TLB.
 static inline void
 sfence_vma()
@@ -327,6 +367,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of address space asid.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entries for address va of address space asid.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -338,11 +392,21 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+#define SUPERPGSIZE (512*PGSIZE) // bytes per 2MB superpage (megapage)
+
+#define SUPERPGROUNDUP(sz)  (((sz)+SUPERPGSIZE-1) & ~(SUPERPGSIZE-1))
+#define SUPERPGROUNDDOWN(a) (((a)) & ~(SUPERPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_SWAP (1L << 5) // with PTE_V clear: paged out to swap
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty: written since mapped
+#define PTE_COW (1L << 8) // RSW bit: copy-on-write page
+#define PTE_SUPER (1L << 9) // RSW bit: level-1 leaf, a 2MB superpage
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -351,6 +415,10 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a paged-out PTE holds its swap slot in place of the PPN.
+#define SLOT2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SLOT(pte) ((uint)((pte) >> 10))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
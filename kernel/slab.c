@@ -0,0 +1,210 @@
+//
+// Object caches for small kernel objects.
+//
+// A kcache hands out objects of one size, packed into slabs:
+// pages from kalloc() with a struct slab at the start and the
+// objects after it. A slab with free objects is on its cache's
+// partial list; a slab whose objects are all free goes back to
+// kalloc(), unless it is the cache's only one.
+//
+// Each CPU keeps a magazine of free objects per cache, used
+// with interrupts off and no lock, so most kcalloc()s and
+// kcfree()s don't touch the cache's lock. An empty magazine is
+// refilled with half a magazine's worth from the slabs; a full
+// one gives half back.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "defs.h"
+
+struct slab {
+  struct slab *next;    // on the cache's partial list
+  struct slab *prev;
+  struct kcache *cache;
+  void *free;           // list of free objects, through their first word
+  int nfree;
+};
+
+#define NCACHE 16
+static struct {
+  struct spinlock lock;
+  struct kcache *cache[NCACHE];
+  int n;
+} caches;
+
+#define SLABOBJS(c) ((PGSIZE - sizeof(struct slab)) / (c)->size)
+
+static void
+partialinsert(struct kcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+static void
+partialremove(struct kcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+void
+slabinit(void)
+{
+  initlock(&caches.lock, "kcaches");
+}
+
+// Set up cache c for objects of size bytes.
+void
+kcacheinit(struct kcache *c, char *name, uint size)
+{
+  if(size < sizeof(void*))
+    size = sizeof(void*);
+  size = (size + 7) & ~7;
+  if(size > PGSIZE - sizeof(struct slab))
+    panic("kcacheinit: too big");
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->partial = 0;
+  c->nslab = 0;
+  c->nused = 0;
+  for(int i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+
+  acquire(&caches.lock);
+  if(caches.n < NCACHE)
+    caches.cache[caches.n++] = c;
+  release(&caches.lock);
+}
+
+// Allocate a slab for c and put it on the partial list.
+// Caller must hold c->lock. Returns 0 if out of memory.
+static struct slab*
+slabgrow(struct kcache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->free = 0;
+  s->nfree = SLABOBJS(c);
+  for(i = s->nfree - 1; i >= 0; i--){
+    o = (char*)(s + 1) + i * c->size;
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  partialinsert(c, s);
+  c->nslab++;
+  return s;
+}
+
+// Return object o to its slab.
+// Caller must hold c->lock.
+static void
+slabput(struct kcache *c, void *o)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)o);
+
+  if(s->cache != c)
+    panic("kcfree: wrong cache");
+  *(void**)o = s->free;
+  s->free = o;
+  if(s->nfree++ == 0)
+    partialinsert(c, s);
+  if(s->nfree == SLABOBJS(c) && c->nslab > 1){
+    partialremove(c, s);
+    c->nslab--;
+    kfree((char*)s);
+  }
+}
+
+// Allocate a zeroed object from c.
+// Returns 0 if out of memory.
+void*
+kcalloc(struct kcache *c)
+{
+  struct kmag *m;
+  struct slab *s;
+  void *o;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE/2){
+      if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+        break;
+      o = s->free;
+      s->free = *(void**)o;
+      if(--s->nfree == 0)
+        partialremove(c, s);
+      m->obj[m->n++] = o;
+    }
+    release(&c->lock);
+  }
+  o = 0;
+  if(m->n > 0){
+    o = m->obj[--m->n];
+    __sync_fetch_and_add(&c->nused, 1);
+  }
+  pop_off();
+
+  if(o)
+    memset(o, 0, c->size);
+  return o;
+}
+
+// Free object o, which came from kcalloc(c).
+void
+kcfree(struct kcache *c, void *o)
+{
+  struct kmag *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2)
+      slabput(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = o;
+  __sync_fetch_and_sub(&c->nused, 1);
+  pop_off();
+}
+
+// Format object cache counters into buf.
+// Returns the number of bytes written.
+int
+statsslab(char *buf, int sz)
+{
+  struct kcache *c;
+  int n;
+
+  n = snprintf(buf, sz, "--- slab stats\n");
+  acquire(&caches.lock);
+  for(int i = 0; i < caches.n; i++){
+    c = caches.cache[i];
+    n += snprintf(buf+n, sz-n, "%s: #size %d #used %d #slabs %d\n",
+                  c->name, c->size, c->nused, c->nslab);
+  }
+  release(&caches.lock);
+  return n;
+}
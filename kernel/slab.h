@@ -0,0 +1,20 @@
+// Object caches, see slab.c.
+
+#define MAGSIZE 16
+
+// A CPU's stock of free objects.
+struct kmag {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+// A cache of equal-sized kernel objects.
+struct kcache {
+  struct spinlock lock;  // protects partial and nslab
+  char *name;
+  uint size;             // object size, in bytes
+  struct slab *partial;  // slabs with free objects
+  int nslab;             // slabs allocated
+  int nused;             // objects allocated
+  struct kmag mag[NCPU]; // per-CPU, used with interrupts off
+};
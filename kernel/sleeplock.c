@@ -16,17 +16,45 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->wq.head = 0;
 }
 
+// Is o, which holds lk, still holding it and running (on
+// another CPU)? A racy peek at o->state is fine, since proc[]
+// entries are never freed, and this only decides whether
+// to keep spinning.
+static int
+ownerrunning(struct sleeplock *lk, struct proc *o)
+{
+  return __atomic_load_n(&lk->locked, __ATOMIC_RELAXED) &&
+         __atomic_load_n(&lk->owner, __ATOMIC_RELAXED) == o &&
+         __atomic_load_n(&o->state, __ATOMIC_RELAXED) == RUNNING;
+}
+
+// Most sleep locks (inodes, buffers) are held briefly, so
+// while the holder is running, spin rather than pay for
+// two context switches; sleep only once it blocks or is
+// preempted.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *o;
+
   acquire(&lk->lk);
   while (lk->locked) {
-    sleep(lk, &lk->lk);
+    if((o = lk->owner) != 0 && o->state == RUNNING){
+      release(&lk->lk);
+      while(ownerrunning(lk, o))
+        ;
+      acquire(&lk->lk);
+      continue;
+    }
+    sleepon(&lk->wq, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
   release(&lk->lk);
 }
 
@@ -36,7 +64,19 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->owner = 0;
+  wakeq(&lk->wq);
+  release(&lk->lk);
+}
+
+// lk stays held, but not by the running process: an
+// interrupt handler will release it, like bradone() does.
+// Waiters mustn't spin on the process meanwhile.
+void
+disownsleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->owner = 0;
   release(&lk->lk);
 }
 
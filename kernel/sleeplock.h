@@ -2,9 +2,11 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct waitq wq;   // processes waiting for it
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct proc *owner; // ... and its proc, for acquiresleep()
 };
 
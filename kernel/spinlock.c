@@ -8,29 +8,98 @@
 #include "proc.h"
 #include "defs.h"
 
+// Every initialized lock is recorded in locks[], so that
+// statslock() can report the most contended ones. Locks in
+// memory that is freed must be removed with freelock().
+// There's room for the buffers, the log's snapshot and
+// pending buffers, the inodes and the procs, each with a
+// lock, and the rest; a lock made once it's full just isn't
+// counted.
+#define NLOCK (NBUF + 2*LOGSIZE + NINODE + MAXPROC + 500)
+
+#ifdef TICKETLOCK
+#define LOCKKIND "ticket"
+#else
+#define LOCKKIND "test-and-set"
+#endif
+
+static struct spinlock *locks[NLOCK];
+static struct spinlock lock_locks;
+
+static void
+findslot(struct spinlock *lk)
+{
+  acquire(&lock_locks);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == 0){
+      locks[i] = lk;
+      release(&lock_locks);
+      return;
+    }
+  }
+  release(&lock_locks);
+}
+
+// Forget lk, which is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&lock_locks);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == lk){
+      locks[i] = 0;
+      break;
+    }
+  }
+  release(&lock_locks);
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
+#ifdef TICKETLOCK
+  lk->next = 0;
+  lk->owner = 0;
+#else
   lk->locked = 0;
+#endif
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+  lk->maxspin = 0;
+  findslot(lk);
 }
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
+//
+// The test-and-set lock lets every waiter write the lock's
+// cache line at once, and whichever's swap lands first after
+// a release wins, however long the others have waited. A
+// ticket lock (make TICKETLOCK=1) costs one atomic add per
+// acquire; waiters then only read, and take the lock in turn.
 void
 acquire(struct spinlock *lk)
 {
+  int spins = 0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
+#ifdef TICKETLOCK
+  uint ticket = __sync_fetch_and_add(&lk->next, 1);
+  while(__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) != ticket)
+    spins++;
+#else
   // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
   while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+    spins++;
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +109,13 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+  // counted now that the lock is held, so that
+  // waiters don't write its cache line.
+  lk->n++;
+  lk->nts += spins;
+  if(spins > lk->maxspin)
+    lk->maxspin = spins;
 }
 
 // Release the lock.
@@ -59,6 +135,10 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
+#ifdef TICKETLOCK
+  // serve the next ticket. only the holder writes owner.
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELAXED);
+#else
   // Release the lock, equivalent to lk->locked = 0.
   // This code doesn't use a C assignment, since the C standard
   // implies that an assignment might be implemented with
@@ -67,6 +147,7 @@ release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+#endif
 
   pop_off();
 }
@@ -77,7 +158,11 @@ int
 holding(struct spinlock *lk)
 {
   int r;
+#ifdef TICKETLOCK
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
+#else
   r = (lk->locked && lk->cpu == mycpu());
+#endif
   return r;
 }
 
@@ -108,3 +193,51 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+static int
+snprint_lock(char *buf, int sz, struct spinlock *lk)
+{
+  return snprintf(buf, sz, "lock: %s: #spin %d #acquire() %d #maxspin %d\n",
+                  lk->name, lk->nts, lk->n, lk->maxspin);
+}
+
+// Format the contention counters of the kmem and bcache locks,
+// and of the five most contended locks, into buf.
+// Returns the number of bytes written.
+int
+statslock(char *buf, int sz)
+{
+  int n, tot, t, i, top, last;
+
+  acquire(&lock_locks);
+  n = snprintf(buf, sz, "--- lock kmem/bcache stats (%s)\n", LOCKKIND);
+  tot = 0;
+  for(i = 0; i < NLOCK; i++){
+    if(locks[i] == 0)
+      continue;
+    if(strncmp(locks[i]->name, "bcache", strlen("bcache")) == 0 ||
+       strncmp(locks[i]->name, "kmem", strlen("kmem")) == 0){
+      tot += locks[i]->nts;
+      n += snprint_lock(buf+n, sz-n, locks[i]);
+    }
+  }
+
+  n += snprintf(buf+n, sz-n, "--- top 5 contended locks:\n");
+  last = 0x7fffffff;
+  for(t = 0; t < 5; t++){
+    top = -1;
+    for(i = 0; i < NLOCK; i++){
+      if(locks[i] == 0 || locks[i]->nts >= last)
+        continue;
+      if(top < 0 || locks[i]->nts > locks[top]->nts)
+        top = i;
+    }
+    if(top < 0 || locks[top]->nts == 0)
+      break;
+    n += snprint_lock(buf+n, sz-n, locks[top]);
+    last = locks[top]->nts;
+  }
+  n += snprintf(buf+n, sz-n, "tot= %d\n", tot);
+  release(&lock_locks);
+  return n;
+}
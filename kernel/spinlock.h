@@ -1,9 +1,26 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock. With TICKETLOCK, waiters are
+// served in the order in which they arrived.
 struct spinlock {
+#ifdef TICKETLOCK
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket being served; held if != next.
+#else
   uint locked;       // Is the lock held?
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For statistics:
+  int n;             // Number of acquire()s.
+  int nts;           // Number of times round the spin loop.
+  int maxspin;       // Most times round it in one acquire().
+};
+
+// Processes sleeping until a condition, see sleepon().
+// Protected by the spinlock that protects the condition.
+struct waitq {
+  struct proc *head;
 };
 
@@ -0,0 +1,76 @@
+//
+// the statistics device: reading it returns a snapshot of
+// kernel counters, taken when a read starts at offset 0.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define BUFSZ 8192
+
+static struct {
+  struct spinlock lock;
+  char buf[BUFSZ];
+  int sz;   // bytes in buf
+  int off;  // bytes of buf already read
+} stats;
+
+int
+statswrite(int user_src, uint64 src, int n)
+{
+  return -1;
+}
+
+int
+statsread(int user_dst, uint64 dst, int n)
+{
+  int m;
+
+  acquire(&stats.lock);
+
+  if(stats.sz == 0) {
+    stats.sz = statslock(stats.buf, BUFSZ);
+    stats.sz += statsbcache(stats.buf+stats.sz, BUFSZ-stats.sz);
+    stats.sz += statslog(stats.buf+stats.sz, BUFSZ-stats.sz);
+    stats.sz += statscpu(stats.buf+stats.sz, BUFSZ-stats.sz);
+    stats.sz += statskmem(stats.buf+stats.sz, BUFSZ-stats.sz);
+    stats.sz += statsslab(stats.buf+stats.sz, BUFSZ-stats.sz);
+    stats.sz += statspcache(stats.buf+stats.sz, BUFSZ-stats.sz);
+    stats.sz += statsdcache(stats.buf+stats.sz, BUFSZ-stats.sz);
+    stats.sz += statssyscall(stats.buf+stats.sz, BUFSZ-stats.sz);
+  }
+  m = stats.sz - stats.off;
+
+  if (m > 0) {
+    if(m > n)
+      m = n;
+    if(either_copyout(user_dst, dst, stats.buf+stats.off, m) == -1) {
+      release(&stats.lock);
+      return -1;
+    }
+    stats.off += m;
+  } else {
+    // end of this snapshot; the next read starts a new one.
+    m = 0;
+    stats.sz = 0;
+    stats.off = 0;
+  }
+  release(&stats.lock);
+
+  return m;
+}
+
+void
+statsinit(void)
+{
+  initlock(&stats.lock, "stats");
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
@@ -1,13 +1,44 @@
 #include "types.h"
 
+// memset(), memcmp(), memmove() and strlen() work a 64-bit
+// word at a time on the aligned middle of their buffers,
+// and a byte at a time on the head and tail. memmove() and
+// memcmp() can only do so if both pointers are equally
+// aligned.
+
+typedef uint64 __attribute__((__may_alias__)) word;
+#define WSIZE sizeof(word)
+#define ALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+#define COALIGNED(p, q) ((((uint64)(p) ^ (uint64)(q)) & (WSIZE-1)) == 0)
+// non-zero if a byte of w is zero.
+#define HASZERO(w) (((w) - 0x0101010101010101UL) & ~(w) & 0x8080808080808080UL)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  word w, *wdst;
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (word *) cdst;
+  for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
   }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wdst++ = w;
+
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +49,17 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(COALIGNED(s1, s2)){
+    for(; n > 0 && !ALIGNED(s1); n--, s1++, s2++){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    }
+    // the bytes of the first unequal word are compared below.
+    for(; n >= WSIZE && *(word *)s1 == *(word *)s2; n -= WSIZE){
+      s1 += WSIZE;
+      s2 += WSIZE;
+    }
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -41,11 +83,33 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(COALIGNED(s, d)){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *--d = *--s;
+      for(; n >= WSIZE; n -= WSIZE){
+        d -= WSIZE;
+        s -= WSIZE;
+        *(word *)d = *(word *)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(COALIGNED(s, d)){
+      for(; n > 0 && !ALIGNED(d); n--)
+        *d++ = *s++;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, d += 4*WSIZE, s += 4*WSIZE){
+        ((word *)d)[0] = ((word *)s)[0];
+        ((word *)d)[1] = ((word *)s)[1];
+        ((word *)d)[2] = ((word *)s)[2];
+        ((word *)d)[3] = ((word *)s)[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE, d += WSIZE, s += WSIZE)
+        *(word *)d = *(word *)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -95,13 +159,23 @@ safestrcpy(char *s, const char *t, int n)
   return os;
 }
 
+// reads whole aligned words, which never cross into the
+// next page, so may look past the terminating 0 but not
+// past the page it is on.
 int
 strlen(const char *s)
 {
-  int n;
+  const char *p = s;
+  const word *w;
 
-  for(n = 0; s[n]; n++)
+  for(; !ALIGNED(p); p++){
+    if(*p == 0)
+      return p - s;
+  }
+  for(w = (const word *) p; !HASZERO(*w); w++)
+    ;
+  for(p = (const char *) w; *p; p++)
     ;
-  return n;
+  return p - s;
 }
 
@@ -0,0 +1,155 @@
+//
+// Swap space, where user pages go when memory runs out.
+//
+// mkfs leaves sb.nswap blocks after the file system, at
+// sb.swapstart, which are used as slots of a page each. A
+// paged-out page's PTE holds its slot in place of the
+// physical page number (see PTE_SWAP), and fork() shares
+// a slot between parent and child as it shares pages, so
+// each slot has a count of the PTEs that refer to it.
+//
+// Pages go to and from the disk through buffers of swap's
+// own, rather than the buffer cache, which paging would
+// only fill with blocks no one reads twice.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)  // blocks per slot
+#define NSLOT (SWAPSIZE / SLOTBLOCKS)
+
+struct {
+  struct spinlock lock;
+  uint start;          // block of slot 0
+  int nslot;           // 0 if there's no swap space
+  int next;            // where to look for a free slot
+  int nfree;           // slots with no references
+  ushort ref[NSLOT];   // PTEs holding each slot
+} swap;
+
+// one batch of page transfers at a time.
+struct {
+  struct sleeplock lock;
+  struct buf buf[SWAPBATCH * SLOTBLOCKS];
+} swapio;
+
+void
+swapinit(int dev, struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swapio.lock, "swapio");
+  for(int i = 0; i < SWAPBATCH * SLOTBLOCKS; i++)
+    swapio.buf[i].dev = dev;
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap / SLOTBLOCKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+  swap.nfree = swap.nslot;
+}
+
+// Find a free slot and give it one reference.
+// Returns -1 if swap is full.
+static int
+slotalloc(void)
+{
+  int i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; swap.nfree > 0 && i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.next = s + 1;
+      swap.nfree--;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Another PTE refers to slot, e.g. a child's after fork().
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A PTE no longer refers to slot.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nfree++;
+  release(&swap.lock);
+}
+
+// Write the n (at most SWAPBATCH) pages to swap, each in a
+// new slot, returned in slots[], as one batch of disk
+// requests. The caller still owns the pages.
+// Returns how many were written: fewer than n if swap filled.
+int
+swapout(char **pages, uint *slots, int n)
+{
+  struct buf *b;
+  int i, j, s;
+
+  if(n > SWAPBATCH)
+    panic("swapout");
+  acquiresleep(&swapio.lock);
+  for(i = 0; i < n && (s = slotalloc()) >= 0; i++){
+    slots[i] = s;
+    for(j = 0; j < SLOTBLOCKS; j++){
+      b = &swapio.buf[i*SLOTBLOCKS + j];
+      memmove(b->data, pages[i] + j*BSIZE, BSIZE);
+      virtio_disk_start(b, swap.start + s*SLOTBLOCKS + j, 1);
+    }
+  }
+  for(j = 0; j < i*SLOTBLOCKS; j++)
+    virtio_disk_wait(&swapio.buf[j]);
+  releasesleep(&swapio.lock);
+  return i;
+}
+
+// Read slot back into page mem. The caller holds a
+// reference to the slot.
+void
+swapin(uint slot, char *mem)
+{
+  struct buf *b;
+  int j;
+
+  acquiresleep(&swapio.lock);
+  for(j = 0; j < SLOTBLOCKS; j++)
+    virtio_disk_start(&swapio.buf[j], swap.start + slot*SLOTBLOCKS + j, 0);
+  for(j = 0; j < SLOTBLOCKS; j++){
+    b = &swapio.buf[j];
+    virtio_disk_wait(b);
+    memmove(mem + j*BSIZE, b->data, BSIZE);
+  }
+  releasesleep(&swapio.lock);
+}
+
+// Is there a free slot? A hint, without the lock, of
+// whether paging out is worth a try.
+int
+swapavail(void)
+{
+  return swap.nfree > 0;
+}
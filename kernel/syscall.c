@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "ktrace.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
@@ -12,7 +13,8 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  uint64 sz = p->group->sz;
+  if(addr >= sz || addr+sizeof(uint64) > sz) // both tests needed, in case of overflow
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -101,6 +103,31 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_uptimens(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_trace(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futexwait(void);
+extern uint64 sys_futexwake(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_profile(void);
+extern uint64 sys_shmcreate(void);
+extern uint64 sys_shmattach(void);
+extern uint64 sys_openat(void);
+#ifdef LAB_NET
+extern uint64 sys_connect(void);
+extern uint64 sys_recvpage(void);
+#endif
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,22 +153,152 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_setpriority] sys_setpriority,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_uptimens] sys_uptimens,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_fsync]   sys_fsync,
+[SYS_trace]   sys_trace,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futexwait] sys_futexwait,
+[SYS_futexwake] sys_futexwake,
+[SYS_getdents] sys_getdents,
+[SYS_spawn]   sys_spawn,
+[SYS_poll]    sys_poll,
+[SYS_profile] sys_profile,
+[SYS_shmcreate] sys_shmcreate,
+[SYS_shmattach] sys_shmattach,
+[SYS_openat]  sys_openat,
+#ifdef LAB_NET
+[SYS_connect] sys_connect,
+[SYS_recvpage] sys_recvpage,
+#endif
 };
 
+static char *syscallnames[] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_setpriority] "setpriority",
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_uptimens] "uptimens",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_fsync]   "fsync",
+[SYS_trace]   "trace",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futexwait] "futexwait",
+[SYS_futexwake] "futexwake",
+[SYS_getdents] "getdents",
+[SYS_spawn]   "spawn",
+[SYS_poll]    "poll",
+[SYS_connect] "connect",
+[SYS_recvpage] "recvpage",
+[SYS_profile] "profile",
+[SYS_shmcreate] "shmcreate",
+[SYS_shmattach] "shmattach",
+[SYS_openat]  "openat",
+};
+
+// Counts and latencies of the system calls made by processes
+// with their bits set in tracemask, for statssyscall().
+// hist[i] counts calls that took [2^i, 2^(i+1)) timer cycles,
+// the last bucket longer ones too.
+#define NHIST 20
+static struct {
+  int n;
+  uint64 cycles;
+  int hist[NHIST];
+} sysstats[NELEM(syscalls)];
+
+static void
+sysrecord(int num, uint64 cycles)
+{
+  int i;
+
+  for(i = 0; i < NHIST-1 && (cycles >> (i+1)) != 0; i++)
+    ;
+  __sync_fetch_and_add(&sysstats[num].n, 1);
+  __sync_fetch_and_add(&sysstats[num].cycles, cycles);
+  __sync_fetch_and_add(&sysstats[num].hist[i], 1);
+}
+
 void
 syscall(void)
 {
   int num;
+  uint64 t0;
   struct proc *p = myproc();
 
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
-    p->trapframe->a0 = syscalls[num]();
+    ktrace(KT_SYSCALL, num, p->trapframe->a0);
+    if(p->tracemask & (1L << num)){
+      t0 = r_time();
+      p->trapframe->a0 = syscalls[num]();
+      sysrecord(num, r_time() - t0);
+    } else {
+      p->trapframe->a0 = syscalls[num]();
+    }
+    ktrace(KT_SYSRET, num, p->trapframe->a0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
     p->trapframe->a0 = -1;
   }
 }
+
+// Format system call counts, mean latencies and latency
+// histograms, in timer cycles, into buf.
+// Returns the number of bytes written.
+int
+statssyscall(char *buf, int sz)
+{
+  int n, num, i, last;
+
+  n = snprintf(buf, sz, "--- syscall stats\n");
+  for(num = 1; num < NELEM(syscalls); num++){
+    if(sysstats[num].n == 0)
+      continue;
+    last = 0;
+    for(i = 0; i < NHIST; i++)
+      if(sysstats[num].hist[i])
+        last = i;
+    n += snprintf(buf+n, sz-n, "%s: #calls %d #cycles %d hist",
+                  syscallnames[num], sysstats[num].n,
+                  (int)(sysstats[num].cycles / sysstats[num].n));
+    for(i = 0; i <= last; i++)
+      n += snprintf(buf+n, sz-n, " %d", sysstats[num].hist[i]);
+    n += snprintf(buf+n, sz-n, "\n");
+  }
+  return n;
+}
@@ -20,3 +20,26 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_setpriority 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_uptimens 25
+#define SYS_readv  26
+#define SYS_writev 27
+#define SYS_pread  28
+#define SYS_pwrite 29
+#define SYS_fsync  30
+#define SYS_trace  31
+#define SYS_clone  32
+#define SYS_join   33
+#define SYS_futexwait 34
+#define SYS_futexwake 35
+#define SYS_getdents 36
+#define SYS_spawn  37
+#define SYS_poll   38
+#define SYS_connect 39
+#define SYS_recvpage 40
+#define SYS_profile 41
+#define SYS_shmcreate 42
+#define SYS_shmattach 43
+#define SYS_openat 44
@@ -94,6 +94,109 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the iovec array and count in the nth and n+1th system
+// call arguments into iov, which has room for NIOV.
+// Returns the count, or -1 if it's bad or the total is too big.
+static int
+argiov(int n, struct iovec *iov)
+{
+  uint64 addr, tot;
+  int cnt;
+
+  argaddr(n, &addr);
+  argint(n+1, &cnt);
+  if(cnt < 0 || cnt > NIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, cnt*sizeof(struct iovec)) < 0)
+    return -1;
+  tot = 0;
+  for(int i = 0; i < cnt; i++){
+    if(iov[i].iov_len > 0x7fffffff || (tot += iov[i].iov_len) > 0x7fffffff)
+      return -1;
+  }
+  return cnt;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if((cnt = argiov(1, iov)) < 0)
+    return -1;
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, 0);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if((cnt = argiov(1, iov)) < 0)
+    return -1;
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, 0);
+}
+
+// Read or write at a given offset, leaving the file's own
+// offset alone, for pread() and pwrite().
+static uint64
+prw(int write)
+{
+  struct file *f;
+  struct iovec iov;
+  uint64 p;
+  int n, off;
+  uint uoff;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(n < 0 || off < 0)
+    return -1;
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  uoff = off;
+  if(write)
+    return filewritev(f, &iov, 1, &uoff);
+  return filereadv(f, &iov, 1, &uoff);
+}
+
+uint64
+sys_pread(void)
+{
+  return prw(0);
+}
+
+uint64
+sys_pwrite(void)
+{
+  return prw(1);
+}
+
+// Wait for the file system changes made so far to be
+// committed to disk. The log doesn't track which file a
+// change belongs to, so this waits for all of them.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
 uint64
 sys_close(void)
 {
@@ -107,6 +210,55 @@ sys_close(void)
   return 0;
 }
 
+// Read up to n entries of the directory open as fd, from
+// its offset, into the array of struct dirstat at addr:
+// one system call instead of a read() and a stat() (with
+// its path lookup) per entry. Returns the number read,
+// 0 at the end of the directory.
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  struct inode *dp;
+  struct dirent de;
+  struct dirstat ds;
+  struct stat st;
+  uint64 addr;
+  uint off;
+  int n, i;
+
+  argaddr(1, &addr);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+    return -1;
+  dp = f->ip;
+
+  begin_op();
+  ilock(dp);
+  if(dp->type != T_DIR){
+    iunlock(dp);
+    end_op();
+    return -1;
+  }
+  off = f->off;
+  for(i = 0; i < n && dirnext(dp, &off, &de, &st); i++){
+    ds.ino = st.ino;
+    ds.type = st.type;
+    ds.nlink = st.nlink;
+    ds.size = st.size;
+    memmove(ds.name, de.name, DIRSIZ);
+    ds.name[DIRSIZ] = 0;
+    if(copyout(myproc()->pagetable, addr + i*sizeof(ds), (char *)&ds, sizeof(ds)) < 0){
+      i = -1;
+      break;
+    }
+    f->off = off;
+  }
+  iunlock(dp);
+  end_op();
+  return i;
+}
+
 uint64
 sys_fstat(void)
 {
@@ -222,6 +374,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheforget(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -242,13 +395,15 @@ bad:
   return -1;
 }
 
+// Create path, which if relative starts at directory at,
+// or the cwd if at is 0.
 static struct inode*
-create(char *path, short type, short major, short minor)
+create(struct inode *at, char *path, short type, short major, short minor)
 {
   struct inode *ip, *dp;
   char name[DIRSIZ];
 
-  if((dp = nameiparent(path, name)) == 0)
+  if((dp = nameiparentat(at, path, name)) == 0)
     return 0;
 
   ilock(dp);
@@ -301,29 +456,24 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path, relative to directory dp or, if dp is 0, the cwd.
+static int
+fileopen(struct inode *dp, char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
   if(omode & O_CREATE){
-    ip = create(path, T_FILE, 0, 0);
+    ip = create(dp, path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
       return -1;
     }
   } else {
-    if((ip = namei(path)) == 0){
+    if((ip = nameiat(dp, path)) == 0){
       end_op();
       return -1;
     }
@@ -370,6 +520,37 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return fileopen(0, path, omode);
+}
+
+// Open a path relative to the directory open as dirfd,
+// rather than the cwd, so that a walk of a tree needn't
+// look up each directory's full path. Absolute paths
+// ignore dirfd.
+uint64
+sys_openat(void)
+{
+  char path[MAXPATH];
+  int omode;
+  struct file *f;
+
+  argint(2, &omode);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  if(argstr(1, path, MAXPATH) < 0)
+    return -1;
+  return fileopen(f->ip, path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -377,7 +558,7 @@ sys_mkdir(void)
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(0, path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -397,7 +578,7 @@ sys_mknod(void)
   argint(1, &major);
   argint(2, &minor);
   if((argstr(0, path, MAXPATH)) < 0 ||
-     (ip = create(path, T_DEVICE, major, minor)) == 0){
+     (ip = create(0, path, T_DEVICE, major, minor)) == 0){
     end_op();
     return -1;
   }
@@ -431,47 +612,111 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Free an argument vector from fetchargv(). The first
+// string in each page starts the page.
+static void
+freeargv(char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
-  int i;
-  uint64 uargv, uarg;
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    if((uint64)argv[i] % PGSIZE == 0)
+      kfree(argv[i]);
+  kfree(argv);
+}
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+// Copy the user argument vector at uargv into the kernel:
+// argv[] in a page of its own, and the strings packed one
+// after another into at most ARGPAGES more, whose unused
+// ends are zeroed, since exec() maps the pages into the new
+// image as they are. Returns argv, for the caller to free
+// with freeargv() unless exec() takes it, or 0.
+static char**
+fetchargv(uint64 uargv)
+{
+  char **argv, *page = 0;
+  int i, n, used = PGSIZE, npage = 0;
+  uint64 uarg;
+
+  if((argv = kzalloc()) == 0)
+    return 0;
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
       goto bad;
     }
-    if(uarg == 0){
-      argv[i] = 0;
+    if(uarg == 0)
       break;
+    if(used == PGSIZE || (n = fetchstr(uarg, page + used, PGSIZE - used)) < 0){
+      // it doesn't fit in what's left of this page.
+      if(page)
+        memset(page + used, 0, PGSIZE - used);
+      if(npage == ARGPAGES || (page = kalloc()) == 0)
+        goto bad;
+      npage++;
+      used = 0;
+      argv[i] = page;
+      if((n = fetchstr(uarg, page, PGSIZE)) < 0)
+        goto bad;
     }
-    argv[i] = kalloc();
-    if(argv[i] == 0)
-      goto bad;
-    if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+    argv[i] = page + used;
+    used += n + 1;
   }
+  if(page)
+    memset(page + used, 0, PGSIZE - used);
+  return argv;
 
-  int ret = exec(path, argv);
+ bad:
+  freeargv(argv);
+  return 0;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], **argv;
+  uint64 uargv;
 
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if((argv = fetchargv(uargv)) == 0)
+    return -1;
+
+  int ret = exec(path, argv);
+
+  // on success, the new image has argv's pages.
+  if(ret < 0)
+    freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], **argv;
+  int fds[NOFILE], nfds, ret;
+  uint64 uargv, ufds;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufds);
+  argint(3, &nfds);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if(nfds < 0 || nfds > NOFILE)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)fds, ufds, nfds*sizeof(int)) < 0)
+    return -1;
+  if((argv = fetchargv(uargv)) == 0)
+    return -1;
+
+  ret = spawn(path, argv, fds, nfds);
+
+  // the child's exec() has argv's pages if it succeeded.
+  if(ret < 0)
+    freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -503,3 +748,180 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Wait until one of nfds descriptors is ready for the
+// events asked for, or timeout milliseconds pass (-1 for
+// no limit, 0 to just look). Returns the number with
+// revents set, 0 on a timeout, or -1.
+uint64
+sys_poll(void)
+{
+  struct pollfd fds[NPOLL];
+  struct pollwait pw[NPOLL];
+  struct file *f[NPOLL];
+  struct proc *p = myproc();
+  uint64 ufds;
+  int nfds, timeout, timed, i, n, fd;
+
+  argaddr(0, &ufds);
+  argint(1, &nfds);
+  argint(2, &timeout);
+  if(nfds < 0 || nfds > NPOLL)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, ufds, nfds * sizeof(fds[0])) < 0)
+    return -1;
+
+  // hold on to the files, in case another thread
+  // closes them while we wait.
+  for(i = 0; i < nfds; i++){
+    fd = fds[i].fd;
+    f[i] = fd >= 0 && fd < NOFILE && p->ofile[fd] ? filedup(p->ofile[fd]) : 0;
+    pw[i].p = p;
+    pw[i].head = 0;
+  }
+  timed = timeout > 0;
+  if(timed)
+    clockalarm(clocktime() + (uint64)timeout * (TIMEFREQ / 1000));
+
+  for(;;){
+    // register with every file before checking it, so a
+    // change after the check wakes us.
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      if(f[i])
+        fds[i].revents = filepoll(f[i], fds[i].events, timeout ? &pw[i] : 0);
+      else
+        fds[i].revents = fds[i].fd >= 0 ? POLLNVAL : 0;
+      if(fds[i].revents)
+        n++;
+    }
+    if(n > 0 || timeout == 0)
+      break;
+    if(pollsleep(timed))
+      timeout = 0;  // one last look
+    for(i = 0; i < nfds; i++)
+      pollremove(&pw[i]);
+    if(killed(p)){
+      n = -1;
+      break;
+    }
+  }
+
+  for(i = 0; i < nfds; i++){
+    pollremove(&pw[i]);
+    if(f[i])
+      fileclose(f[i]);
+  }
+  if(timed)
+    clockcancel();
+  if(n >= 0 && copyout(p->pagetable, ufds, (char*)fds, nfds * sizeof(fds[0])) < 0)
+    return -1;
+  return n;
+}
+
+uint64
+sys_mmap(void)
+{
+  int len, prot, flags, off;
+  struct file *f;
+
+  // argument 0, the address hint, is ignored.
+  argint(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(argfd(4, 0, &f) < 0 || len <= 0 || off < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// Make a shared memory segment named by argument 0, of
+// argument 1 bytes, and map it. Returns its address, or -1.
+uint64
+sys_shmcreate(void)
+{
+  char name[SHMNAME];
+  int len;
+
+  argint(1, &len);
+  if(argstr(0, name, sizeof(name)) < 0 || len <= 0)
+    return -1;
+  return shmcreate(name, len);
+}
+
+// Map the shared memory segment named by argument 0, and
+// store its size at argument 1, unless that is 0.
+// Returns its address, or -1.
+uint64
+sys_shmattach(void)
+{
+  char name[SHMNAME];
+  uint64 lenaddr;
+
+  argaddr(1, &lenaddr);
+  if(argstr(0, name, sizeof(name)) < 0)
+    return -1;
+  return shmattach(name, lenaddr);
+}
+
+#ifdef LAB_NET
+// Open a UDP socket to raddr:rport from local port lport,
+// or, if raddr is 0, one that takes packets to lport from
+// anyone. Returns its file descriptor, or -1.
+uint64
+sys_connect(void)
+{
+  struct file *f;
+  int fd;
+  uint32 raddr;
+  uint32 rport;
+  uint32 lport;
+
+  argint(0, (int*)&raddr);
+  argint(1, (int*)&lport);
+  argint(2, (int*)&rport);
+
+  if(sockalloc(&f, raddr, lport, rport) < 0)
+    return -1;
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Receive a packet on socket fd into the page at va, by
+// mapping its page there. Returns the payload's length,
+// storing its offset in the page at off, or -1.
+uint64
+sys_recvpage(void)
+{
+  struct file *f;
+  uint64 va, uoff;
+  int n, off;
+
+  argaddr(1, &va);
+  argaddr(2, &uoff);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_SOCK || !f->readable)
+    return -1;
+  if((n = sockrecvpage(f->sock, va, &off)) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, uoff, (char*)&off, sizeof(off)) < 0)
+    return -1;
+  return n;
+}
+#endif
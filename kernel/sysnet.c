@@ -0,0 +1,340 @@
+//
+// network system calls.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+#include "slab.h"
+#include "net.h"
+
+// A UDP socket. raddr 0 makes it unconnected: it takes
+// packets from anyone to lport, and sends to whoever sent
+// the last packet it read.
+struct sock {
+  struct sock *next; // the next socket in the list
+  uint32 raddr;      // the remote IPv4 address, or 0
+  uint16 lport;      // the local UDP port number
+  uint16 rport;      // the remote UDP port number
+  struct spinlock lock; // protects everything below
+  struct mbufq rxq;  // a queue of packets waiting to be received
+  int nrx;           // packets on rxq
+  uint32 lastaddr;   // sender of the last packet read,
+  uint16 lastport;   //   for an unconnected socket
+  struct pollwait *pollers;
+};
+
+// packets a socket queues before dropping more.
+#define NSOCKRX 64
+
+static struct spinlock lock;
+static struct sock *sockets;
+static struct kcache sockcache;
+
+void
+sockinit(void)
+{
+  initlock(&lock, "socktbl");
+  kcacheinit(&sockcache, "sock", sizeof(struct sock));
+  mbufinit();
+}
+
+// Find the socket for a packet from raddr:rport to lport,
+// preferring a connected one. Caller must hold lock.
+static struct sock *
+socklookup(uint32 raddr, uint16 lport, uint16 rport)
+{
+  struct sock *si, *any;
+
+  any = 0;
+  for (si = sockets; si; si = si->next) {
+    if (si->lport != lport)
+      continue;
+    if (si->raddr == raddr && si->rport == rport)
+      return si;
+    if (si->raddr == 0)
+      any = si;
+  }
+  return any;
+}
+
+int
+sockalloc(struct file **f, uint32 raddr, uint16 lport, uint16 rport)
+{
+  struct sock *si, *pos;
+
+  si = 0;
+  *f = 0;
+  if ((*f = filealloc()) == 0)
+    goto bad;
+  if ((si = kcalloc(&sockcache)) == 0)
+    goto bad;
+
+  // initialize objects
+  if (raddr == 0)
+    rport = 0;
+  si->raddr = raddr;
+  si->lport = lport;
+  si->rport = rport;
+  initlock(&si->lock, "sock");
+  mbufq_init(&si->rxq);
+  (*f)->type = FD_SOCK;
+  (*f)->readable = 1;
+  (*f)->writable = 1;
+  (*f)->sock = si;
+
+  // add to list of sockets
+  acquire(&lock);
+  pos = socklookup(raddr, lport, rport);
+  if (pos && pos->raddr == raddr && pos->rport == rport) {
+    release(&lock);
+    goto bad;
+  }
+  si->next = sockets;
+  sockets = si;
+  release(&lock);
+  return 0;
+
+bad:
+  if (si) {
+    freelock(&si->lock);
+    kcfree(&sockcache, si);
+  }
+  if (*f) {
+    (*f)->type = FD_NONE;  // so fileclose() leaves si alone
+    fileclose(*f);
+  }
+  return -1;
+}
+
+void
+sockclose(struct sock *si)
+{
+  struct sock **pos;
+  struct mbuf *m;
+
+  // remove from list of sockets
+  acquire(&lock);
+  pos = &sockets;
+  while (*pos) {
+    if (*pos == si){
+      *pos = si->next;
+      break;
+    }
+    pos = &(*pos)->next;
+  }
+  release(&lock);
+
+  // free any pending mbufs
+  while (!mbufq_empty(&si->rxq)) {
+    m = mbufq_pophead(&si->rxq);
+    mbuffree(m);
+  }
+
+  freelock(&si->lock);
+  kcfree(&sockcache, si);
+}
+
+// Wait for a packet on si, and take it off the queue.
+// Caller must hold si->lock. Returns 0 if killed.
+static struct mbuf *
+sockwait(struct sock *si)
+{
+  struct mbuf *m;
+
+  while (mbufq_empty(&si->rxq)) {
+    if (killed(myproc()))
+      return 0;
+    sleep(&si->rxq, &si->lock);
+  }
+  m = mbufq_pophead(&si->rxq);
+  si->nrx--;
+  si->lastaddr = m->raddr;
+  si->lastport = m->rport;
+  return m;
+}
+
+// Read a packet into each of the cnt user buffers in iov,
+// waiting for the first but not for the rest; a packet
+// longer than its buffer is cut short. Returns the number of
+// bytes read, or -1.
+int
+sockread(struct sock *si, struct iovec *iov, int cnt)
+{
+  struct proc *pr = myproc();
+  struct mbuf *m;
+  int i, len, tot;
+
+  tot = 0;
+  acquire(&si->lock);
+  for (i = 0; i < cnt; i++) {
+    if (i > 0 && mbufq_empty(&si->rxq))
+      break;
+    if ((m = sockwait(si)) == 0)
+      break;
+    release(&si->lock);
+    len = m->len;
+    if (len > iov[i].iov_len)
+      len = iov[i].iov_len;
+    if (copyout(pr->pagetable, (uint64)iov[i].iov_base, m->head, len) == -1) {
+      mbuffree(m);
+      return tot > 0 ? tot : -1;
+    }
+    mbuffree(m);
+    tot += len;
+    acquire(&si->lock);
+  }
+  release(&si->lock);
+  return i > 0 ? tot : -1;
+}
+
+// Wait for a packet on si and map its page at user address
+// va, which must be page-aligned and writable, instead of
+// copying it; the page is copy-on-write, so the user may
+// keep it, write it, or unmap it. If the page can't be
+// mapped the payload is copied there instead. The rest of
+// a mapped page is zeroed, since pool pages are reused
+// without being cleared and may hold others' old packets,
+// and the card only writes the bytes it receives. Returns the
+// payload's length, and its offset in the page in *off, or
+// -1.
+int
+sockrecvpage(struct sock *si, uint64 va, int *off)
+{
+  struct proc *pr = myproc();
+  struct mbuf *m;
+  char *pg;
+  int len, o;
+
+  if (va % PGSIZE != 0)
+    return -1;
+  acquire(&si->lock);
+  m = sockwait(si);
+  release(&si->lock);
+  if (m == 0)
+    return -1;
+
+  len = m->len;
+  o = m->head - m->page;
+  pg = mbuftake(m);
+  memset(pg, 0, o);
+  memset(pg + o + len, 0, PGSIZE - o - len);
+  if (uvmremap(pr->pagetable, va, (uint64)pg) == 0) {
+    *off = o;
+  } else {
+    *off = 0;
+    if (copyout(pr->pagetable, va, pg + o, len) < 0)
+      len = -1;
+    kfree(pg);
+  }
+  return len;
+}
+
+// Send each of the cnt user buffers in iov as a packet, all
+// to the card at once. Returns the number of bytes sent, or
+// -1.
+int
+sockwrite(struct sock *si, struct iovec *iov, int cnt)
+{
+  struct proc *pr = myproc();
+  struct mbuf *m, *chain, **tail;
+  uint32 raddr;
+  uint16 rport;
+  int i, tot;
+
+  raddr = si->raddr;
+  rport = si->rport;
+  if (raddr == 0) {
+    acquire(&si->lock);
+    raddr = si->lastaddr;
+    rport = si->lastport;
+    release(&si->lock);
+    if (raddr == 0)
+      return -1;
+  }
+
+  chain = 0;
+  tail = &chain;
+  tot = 0;
+  for (i = 0; i < cnt; i++) {
+    if (iov[i].iov_len > MBUF_SIZE - MBUF_DEFAULT_HEADROOM ||
+        (m = mbufalloc(MBUF_DEFAULT_HEADROOM)) == 0)
+      goto bad;
+    *tail = m;
+    tail = &m->next;
+    if (copyin(pr->pagetable, mbufput(m, iov[i].iov_len),
+               (uint64)iov[i].iov_base, iov[i].iov_len) == -1)
+      goto bad;
+    tot += iov[i].iov_len;
+  }
+  if (chain)
+    net_tx_udp(chain, raddr, si->lport, rport);
+  return tot;
+
+bad:
+  while ((m = chain) != 0) {
+    chain = m->next;
+    mbuffree(m);
+  }
+  return -1;
+}
+
+// Which of events (POLLIN, POLLOUT) si is ready for; it can
+// always send. Adds pw, if not 0, to si's pollers.
+int
+sockpoll(struct sock *si, struct pollwait *pw)
+{
+  int r;
+
+  acquire(&si->lock);
+  if (pw)
+    pollregister(pw, &si->pollers, &si->lock);
+  r = POLLOUT;
+  if (!mbufq_empty(&si->rxq))
+    r |= POLLIN;
+  release(&si->lock);
+  return r;
+}
+
+// called by protocol handler layer to deliver UDP packets
+void
+sockrecvudp(struct mbuf *m, uint32 raddr, uint16 lport, uint16 rport)
+{
+  //
+  // Find the socket that handles this mbuf and deliver it, waking
+  // any sleeping reader. Free the mbuf if there are no sockets
+  // registered to handle it.
+  //
+  struct sock *si;
+
+  acquire(&lock);
+  if ((si = socklookup(raddr, lport, rport)) == 0) {
+    release(&lock);
+    mbuffree(m);
+    return;
+  }
+
+  m->raddr = raddr;
+  m->rport = rport;
+  acquire(&si->lock);
+  if (si->nrx >= NSOCKRX) {
+    release(&si->lock);
+    release(&lock);
+    mbuffree(m);
+    return;
+  }
+  mbufq_pushtail(&si->rxq, m);
+  si->nrx++;
+  wakeup(&si->rxq);
+  pollwake(&si->pollers);
+  release(&si->lock);
+  release(&lock);
+}
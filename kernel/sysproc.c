@@ -35,6 +35,47 @@ sys_wait(void)
   return wait(p);
 }
 
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  uint64 p;
+  argaddr(0, &p);
+  return join(p);
+}
+
+uint64
+sys_futexwait(void)
+{
+  uint64 addr;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  return futexwait(addr, val);
+}
+
+uint64
+sys_futexwake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futexwake(addr, n);
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -42,8 +83,7 @@ sys_sbrk(void)
   int n;
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if(growproc(n, &addr) < 0)
     return -1;
   return addr;
 }
@@ -52,20 +92,9 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return clocksleep(n);
 }
 
 uint64
@@ -82,10 +111,50 @@ sys_kill(void)
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  // not ticks, which may lag while every CPU is idle.
+  return (uint)(clocktime() / TICKCYCLES);
+}
+
+// return the time since start in nanoseconds.
+uint64
+sys_uptimens(void)
+{
+  return clocktime() * (1000000000 / TIMEFREQ);
+}
+
+// time the system calls in mask, as 1L<<SYS_..., made by
+// this process and the children it forks from now on.
+uint64
+sys_trace(void)
+{
+  uint64 mask;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  argaddr(0, &mask);
+  myproc()->tracemask = mask;
+  return 0;
+}
+
+// sample call stacks every cycles timer cycles, for the
+// profile device, or stop if cycles is 0. returns the
+// number of samples dropped since the last call.
+uint64
+sys_profile(void)
+{
+  int cycles;
+
+  argint(0, &cycles);
+  if(cycles < 0)
+    return -1;
+  return profile(cycles);
+}
+
+// set the scheduling priority level of a process.
+uint64
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  argint(0, &pid);
+  argint(1, &prio);
+  return setpriority(pid, prio);
 }
@@ -9,6 +9,10 @@
 struct spinlock tickslock;
 uint ticks;
 
+// processes in sys_sleep() or a timed poll(), soonest
+// deadline first. protected by tickslock.
+static struct proc *sleepq;
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -45,6 +49,11 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // out of user mode, for shootdown().
+  struct cpu *c = mycpu();
+  c->ntrap++;
+  c->userpt = 0;
+
   struct proc *p = myproc();
   
   // save user program counter.
@@ -67,6 +76,20 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault on a lazily allocated, copy-on-write or
+    // memory-mapped file page.
+    uint64 scause = r_scause();
+    uint64 va = r_stval();
+
+    // reading a mapped file sleeps; done with the registers.
+    intr_on();
+
+    if(uvmfault(p->pagetable, va, scause == 15) < 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, va);
+      setkilled(p);
+    }
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -76,9 +99,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
-    yield();
+  // give up the CPU if this process's quantum is used up,
+  // or a higher-priority process is waiting.
+  preempt(which_dev == 2);
 
   usertrapret();
 }
@@ -120,13 +143,19 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = uvmsatp(p);
+
+  // shootdown() must see this before the TLB is loaded
+  // from the page table.
+  mycpu()->userpt = p->pagetable;
+  __sync_synchronize();
 
   // jump to userret in trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // switches to the user page table, restores user registers
+  // from the trapframe at p->tfva, and switches to user mode
+  // with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, p->tfva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -150,9 +179,10 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+  // give up the CPU if this process's quantum is used up,
+  // or a higher-priority process is waiting.
+  if(which_dev != 0 && myproc() != 0 && myproc()->state == RUNNING)
+    preempt(which_dev == 2);
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -160,19 +190,182 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
+// The timer.
+//
+// Every CPU has its own timer interrupt. timervec in
+// kernelvec.S disarms it and passes it on to clockintr(),
+// which sets the next deadline: the next tick if the CPU
+// is running a process, which may need preempting, or else
+// the earliest sys_sleep() deadline, if any. An idle CPU
+// thus only takes interrupts when there is something to do;
+// the scheduler re-arms the tick when it finds a process.
+// ticks is derived from the time, so it stays right while
+// every CPU is idle. While profiling, a busy CPU's timer
+// also goes off every profcycles, to take a sample.
+
+// The time since boot, in timer cycles (TIMEFREQ per second).
+uint64
+clocktime(void)
+{
+  return *(volatile uint64*)CLINT_MTIME;
+}
+
+// Ask for this CPU's next timer interrupt at time when.
+static void
+clockset(uint64 when)
+{
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = when;
+}
+
+static uint64
+nexttick(uint64 now)
+{
+  return (now / TICKCYCLES + 1) * TICKCYCLES;
+}
+
+// Returns 1 if this CPU has started a new tick, which
+// counts towards the running process's quantum, or 0 if
+// a profiler sample or a sleeper brought it here early.
+int
 clockintr()
 {
+  struct cpu *c = mycpu();
+  struct proc *p;
+  uint64 now, next;
+  int tick;
+
+  now = clocktime();
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  ticks = now / TICKCYCLES;
+  tick = ticks != c->tick;
+  c->tick = ticks;
+
+  // wake just the sleepers whose deadline has passed.
+  while((p = sleepq) != 0 && p->wakeat <= now){
+    sleepq = p->tnext;
+    p->tqueued = 0;
+    wakeproc(p, &p->wakeat);
+  }
+
+  if(c->proc == 0){
+    c->tickless = 1;
+    clockset(sleepq ? sleepq->wakeat : ~0UL);
+  } else {
+    next = nexttick(now);
+    if(profcycles && now + profcycles < next)
+      next = now + profcycles;
+    clockset(next);
+  }
+  release(&tickslock);
+  return tick;
+}
+
+// The scheduler is about to run a process on this CPU;
+// restart the tick if the CPU was idle without one.
+// Called with interrupts off.
+void
+clockresume(void)
+{
+  struct cpu *c = mycpu();
+
+  if(c->tickless){
+    c->tickless = 0;
+    clockset(nexttick(clocktime()));
+  }
+}
+
+// Interrupt CPU id, to wake it from wfi. The interrupt
+// arrives as a machine software interrupt, which timervec
+// forwards like the timer's; clockintr() on an idle CPU
+// just re-arms its timer.
+void
+ipi(int id)
+{
+  *(volatile uint32*)CLINT_MSIP(id) = 1;
+}
+
+// Put p on the sleep queue, for clockintr() to wake from
+// &p->wakeat at time when. Caller must hold tickslock.
+static void
+sleepqput(struct proc *p, uint64 when)
+{
+  struct proc **pp;
+
+  p->wakeat = when;
+  for(pp = &sleepq; *pp && (*pp)->wakeat <= p->wakeat; pp = &(*pp)->tnext)
+    ;
+  p->tnext = *pp;
+  *pp = p;
+  p->tqueued = 1;
+}
+
+// Take p off the sleep queue, if it is still on it.
+// Caller must hold tickslock.
+static void
+sleepqremove(struct proc *p)
+{
+  struct proc **pp;
+
+  if(!p->tqueued)
+    return;
+  for(pp = &sleepq; *pp != p; pp = &(*pp)->tnext)
+    ;
+  *pp = p->tnext;
+  p->tqueued = 0;
+}
+
+// Sleep for n ticks, for sys_sleep(): until the n'th tick
+// boundary from now. Returns -1 if killed first.
+int
+clocksleep(int n)
+{
+  struct proc *p = myproc();
+  int r = 0;
+
+  if(n <= 0)
+    return 0;
+
+  acquire(&tickslock);
+  sleepqput(p, (clocktime() / TICKCYCLES + n) * TICKCYCLES);
+
+  // idle CPUs may have armed their timers for a later
+  // deadline; this CPU's tick will see to p's when it
+  // goes idle.
+  while(p->tqueued){
+    if(killed(p)){
+      sleepqremove(p);
+      r = -1;
+      break;
+    }
+    sleep(&p->wakeat, &tickslock);
+  }
+  release(&tickslock);
+  return r;
+}
+
+// Have the calling process woken from &p->wakeat at time
+// when, for pollsleep(); p->tqueued stays set until then.
+void
+clockalarm(uint64 when)
+{
+  acquire(&tickslock);
+  sleepqput(myproc(), when);
+  release(&tickslock);
+}
+
+// Cancel clockalarm(), if it hasn't gone off.
+void
+clockcancel(void)
+{
+  acquire(&tickslock);
+  sleepqremove(myproc());
   release(&tickslock);
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
-// 1 if other device,
+// returns 2 if timer interrupt starting a tick,
+// 1 if other device or an early timer interrupt,
 // 0 if not recognized.
 int
 devintr()
@@ -187,9 +380,15 @@ devintr()
     int irq = plic_claim();
 
     if(irq == UART0_IRQ){
+      mycpu()->nuartintr++;
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
+      mycpu()->ndiskintr++;
       virtio_disk_intr();
+#ifdef LAB_NET
+    } else if(irq == E1000_IRQ){
+      e1000_intr();
+#endif
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -202,18 +401,19 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
+    int tick;
 
-    if(cpuid() == 0){
-      clockintr();
-    }
+    if(profcycles)
+      profsample();
+    tick = clockintr();
     
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    return tick ? 2 : 1;
   } else {
     return 0;
   }
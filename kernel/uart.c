@@ -38,9 +38,13 @@
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
+// the UART's transmit FIFO holds this many bytes.
+#define UART_FIFO_SIZE 16
+
 // the transmit output buffer.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+struct waitq uart_tx_wq;  // uartwrite()s waiting for space
+#define UART_TX_BUF_SIZE 1024
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
@@ -77,28 +81,36 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
-// add a character to the output buffer and tell the
+// add n characters to the output buffer and tell the
 // UART to start sending if it isn't already.
-// blocks if the output buffer is full.
+// blocks while the output buffer is full.
 // because it may block, it can't be called
 // from interrupts; it's only suitable for use
 // by write().
 void
-uartputc(int c)
+uartwrite(char *s, int n)
 {
+  int i = 0;
+
   acquire(&uart_tx_lock);
 
   if(panicked){
     for(;;)
       ;
   }
-  while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
-    // buffer is full.
-    // wait for uartstart() to open up space in the buffer.
-    sleep(&uart_tx_r, &uart_tx_lock);
+  while(i < n){
+    if(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full.
+      // wait for uartstart() to open up space in the buffer.
+      uartstart();
+      sleepon(&uart_tx_wq, &uart_tx_lock);
+      continue;
+    }
+    while(i < n && uart_tx_w < uart_tx_r + UART_TX_BUF_SIZE){
+      uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = s[i++];
+      uart_tx_w += 1;
+    }
   }
-  uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
-  uart_tx_w += 1;
   uartstart();
   release(&uart_tx_lock);
 }
@@ -126,34 +138,35 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the transmit buffer, send a FIFO's worth of them.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
 void
 uartstart()
 {
-  while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
-    
-    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
-    }
-    
-    int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
+  int i;
+
+  if(uart_tx_w == uart_tx_r){
+    // transmit buffer is empty.
+    return;
+  }
+
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+    // the UART is still sending the last batch.
+    // it will interrupt when its FIFO is empty.
+    return;
+  }
+
+  // the transmit FIFO is empty, so it can
+  // take a whole batch without overflowing.
+  for(i = 0; i < UART_FIFO_SIZE && uart_tx_r != uart_tx_w; i++){
+    WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
     uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
-    WriteReg(THR, c);
   }
+
+  // maybe uartwrite() is waiting for space in the buffer.
+  wakeq(&uart_tx_wq);
 }
 
 // read one input character from the UART.
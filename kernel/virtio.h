@@ -47,7 +47,8 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// each request uses three, so NUM/3 can be in flight.
+#define NUM 128
 
 // a single descriptor, from the spec.
 struct virtq_desc {
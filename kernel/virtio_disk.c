@@ -15,6 +15,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "ktrace.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
@@ -41,12 +42,15 @@ static struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  int unkicked;    // requests added to avail since the last notify.
+  struct waitq freeq; // virtio_disk_start()s waiting for descriptors.
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
     struct buf *b;
+    uint blockno;  // of the disk, for ktrace()
     char status;
   } info[NUM];
 
@@ -178,7 +182,7 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  wakeq(&disk.freeq);
 }
 
 // free a chain of descriptors.
@@ -212,13 +216,38 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// tell the device about the requests added to the
+// avail ring since the last notify.
+// caller must hold vdisk_lock.
+static void
+kick(void)
+{
+  if(disk.unkicked == 0)
+    return;
+  disk.unkicked = 0;
+  if(DISKIRQ == DISKIRQ_SUBMIT)
+    plic_diskroute(cpuid());  // the completion comes back here
+  __sync_synchronize();
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+// queue a request to transfer b->data to or from disk
+// block blockno, which is usually b->blockno, and return
+// without waiting for it. the device isn't notified until
+// virtio_disk_wait() (or until we run out of descriptors),
+// so a batch of requests costs one notify.
+// b->disk is 1 until the request finishes; b must not be
+// changed or reused until then.
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_start(struct buf *b, uint blockno, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = blockno * (BSIZE / 512);
 
   acquire(&disk.vdisk_lock);
 
+  if(b->disk)
+    panic("virtio_disk_start: busy");
+
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
   // data, one for a 1-byte status result.
@@ -229,7 +258,10 @@ virtio_disk_rw(struct buf *b, int write)
     if(alloc3_desc(idx) == 0) {
       break;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    // the requests we haven't told the device
+    // about yet may be holding the descriptors.
+    kick();
+    sleepon(&disk.freeq, &disk.vdisk_lock);
   }
 
   // format the three descriptors.
@@ -267,6 +299,8 @@ virtio_disk_rw(struct buf *b, int write)
   // record struct buf for virtio_disk_intr().
   b->disk = 1;
   disk.info[idx[0]].b = b;
+  disk.info[idx[0]].blockno = blockno;
+  ktrace(KT_DISKSTART, blockno, write);
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -275,22 +309,41 @@ virtio_disk_rw(struct buf *b, int write)
 
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
+  disk.unkicked++;
 
-  __sync_synchronize();
-
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  release(&disk.vdisk_lock);
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
+// wait for the request on b started by virtio_disk_start()
+// to finish, first notifying the device of any queued requests.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  kick();
   while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+    sleepon(&b->wq, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
+// notify the device of queued requests without waiting
+// for them, e.g. after starting read-ahead.
+void
+virtio_disk_kick(void)
+{
+  acquire(&disk.vdisk_lock);
+  kick();
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(b, b->blockno, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -317,8 +370,13 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
+    disk.info[id].b = 0;
+    ktrace(KT_DISKDONE, disk.info[id].blockno, 0);
+    free_chain(id);
     b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    wakeq(&b->wq);
+    if(b->readahead)
+      bradone(b);  // no one is waiting; release it here
 
     disk.used_idx += 1;
   }
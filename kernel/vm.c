@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -21,8 +23,7 @@ kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kzalloc();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -30,6 +31,17 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+#ifdef LAB_NET
+  // PCIe configuration space for bus 0
+  kvmmap(kpgtbl, PCIE_ECAM, PCIE_ECAM, 0x100000, PTE_R | PTE_W);
+
+  // e1000 registers
+  kvmmap(kpgtbl, E1000_REGS, E1000_REGS, 0x20000, PTE_R | PTE_W);
+#endif
+
+  // CLINT, for the time and setting the next timer interrupt
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -37,15 +49,22 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses 2MB superpages for the aligned part.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
-  
+  // kernel stacks are mapped as processes are first
+  // allocated; see kstackalloc(). Their page-table pages
+  // are made now, so that mapping one later only fills in
+  // a leaf PTE, which no other hart has used.
+  for(int i = 0; i < MAXPROC; i++){
+    if(walk(kpgtbl, KSTACK(i), 1) == 0)
+      panic("kvmmake: kstack");
+  }
+
   return kpgtbl;
 }
 
@@ -61,15 +80,121 @@ kvminit(void)
 void
 kvminithart()
 {
+  struct cpu *c = mycpu();
+
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
+  // the ASID bits the MMU doesn't implement read back as
+  // zero. the kernel itself uses ASID 0.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASIDMASK);
+  c->asidmax = (r_satp() & SATP_ASIDMASK) >> SATP_ASIDSHIFT;
+  c->nextasid = 1;
+  c->asidgen = 1;
   w_satp(MAKE_SATP(kernel_pagetable));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// ASIDs let the TLB hold entries of several page tables, so
+// switching page tables needn't flush it. Each CPU hands out
+// its own: p->asid[i] is p's ASID on CPU i, if p->asidgen[i]
+// is that CPU's current generation. A CPU that runs out of
+// ASIDs flushes its TLB and starts a new generation, in
+// which every process gets a new one.
+
+// Threads sharing a page table run without ASIDs, so that a
+// CPU's TLB has entries for it only while it is in user mode,
+// where shootdown() can reach it.
+
+// Return the satp with which to run p on this CPU, giving
+// p an ASID here if it has none. Without ASIDs, the
+// trampoline flushes the TLB instead.
+// Called with interrupts off.
+uint64
+uvmsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+
+  if(c->asidmax == 0 || p->group->noasid)
+    return MAKE_SATP(p->pagetable);
+  if(p->asidgen[id] != c->asidgen){
+    if(c->nextasid > c->asidmax){
+      c->asidgen++;
+      c->nextasid = 1;
+      sfence_vma();
+    }
+    p->asid[id] = c->nextasid++;
+    p->asidgen[id] = c->asidgen;
+    // a new ASID has no TLB entries, but this orders the
+    // writes to p's page table before the MMU reads it.
+    sfence_vma_asid(p->asid[id]);
+  }
+  return MAKE_SATP(p->pagetable) | SATP_ASID(p->asid[id]);
+}
+
+// Make the other CPUs running threads that share pagetable
+// in user mode drop its TLB entries: interrupt each, and
+// wait until it has entered the kernel, which flushes them.
+// A CPU that goes back to user mode meanwhile loads the
+// current PTEs.
+static void
+shootdown(pagetable_t pagetable)
+{
+  struct cpu *c;
+  uint n;
+
+  // pairs with the fence in usertrapret().
+  __sync_synchronize();
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c == mycpu() || c->userpt != pagetable)
+      continue;
+    n = c->ntrap;
+    ipi(c - cpus);
+    while(*(volatile pagetable_t *)&c->userpt == pagetable &&
+          *(volatile uint *)&c->ntrap == n)
+      ;
+  }
+}
+
+// Flush stale TLB entries for user address va of pagetable,
+// or all of them if va is -1, after a PTE was removed or
+// had permissions taken away, or was made valid (the TLB may
+// cache invalid entries). Only the current process's
+// page table can be in use; this CPU flushes its entries,
+// and it gives up its ASIDs on the others, where it isn't
+// running, or with threads, shoots their entries down.
+// Other page tables are new, or belong to processes that
+// will get new ASIDs, and have no entries to flush.
+void
+uvmflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+  int id;
+
+  if(p == 0 || p->pagetable != pagetable)
+    return;
+  push_off();
+  c = mycpu();
+  id = cpuid();
+  if(c->asidmax != 0 && p->asidgen[id] == c->asidgen){
+    if(va == -1)
+      sfence_vma_asid(p->asid[id]);
+    else
+      sfence_vma_page(va, p->asid[id]);
+  }
+  for(int i = 0; i < NCPU; i++){
+    if(i != id)
+      p->asidgen[i] = 0;
+  }
+  if(p->group->noasid)
+    shootdown(pagetable);
+  pop_off();
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -82,26 +207,110 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If va is in a 2MB superpage, the PTE returned is the
+// level-1 leaf for the superpage, marked PTE_SUPER.
+//
+// Threads sharing a page table may fault at once, so PTEs
+// that page faults fill in are set with compare-and-swap,
+// which also makes the zeroed page-table page visible
+// before the PTE pointing to it.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
+  pagetable_t next;
+  pte_t old;
+
   if(va >= MAXVA)
     panic("walk");
 
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
+    old = *pte;
+    if(old & PTE_V) {
+      if(old & PTE_SUPER)
+        return pte;
+      pagetable = (pagetable_t)PTE2PA(old);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (next = (pde_t*)kzalloc()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
+      if(!__sync_bool_compare_and_swap(pte, old, PA2PTE(next) | PTE_V)){
+        // someone else filled it in; look again.
+        kfree(next);
+        level++;
+        continue;
+      }
+      pagetable = next;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Return the address of the level-1 PTE for va, which
+// either maps a superpage or points to the level-0
+// page-table page. If alloc!=0, create the level-1
+// page-table page if needed.
+static pte_t *
+walksuper(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte = &pagetable[PX(2, va)];
+  pagetable_t next;
+  pte_t old;
+
+  while(((old = *pte) & PTE_V) == 0){
+    if(!alloc || (next = (pde_t*)kzalloc()) == 0)
+      return 0;
+    if(__sync_bool_compare_and_swap(pte, old, PA2PTE(next) | PTE_V))
+      break;
+    kfree(next);
+  }
+  return &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+}
+
+// Split the superpage mapped by level-1 PTE pte into 512
+// 4096-byte mappings with the same permissions. Its pages
+// are reference counted one by one, so that's all it takes.
+// Returns 0 on success, -1 if out of memory.
+static int
+demote(pte_t *pte)
+{
+  pagetable_t pt;
+  pte_t old;
+  uint64 pa, flags;
+
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  // another thread may split it first, or the MMU set
+  // its accessed or dirty bit; then try again.
+  while((old = *pte) & PTE_SUPER){
+    pa = PTE2PA(old);
+    flags = PTE_FLAGS(old) & ~PTE_SUPER;
+    for(int i = 0; i < 512; i++)
+      pt[i] = PA2PTE(pa + i*PGSIZE) | flags;
+    if(__sync_bool_compare_and_swap(pte, old, PA2PTE(pt) | PTE_V))
+      return 0;
+  }
+  kfree(pt);
+  // the translations are unchanged, so TLB entries for
+  // the superpage are still right, until the caller
+  // changes one and flushes its address.
+  return 0;
+}
+
+// If va is in a superpage of pagetable, split it, so that
+// the mapping of va's page alone can be changed.
+// Returns 0 on success, -1 if out of memory.
+static int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+
+  pte = walksuper(pagetable, va, 0);
+  if(pte && (*pte & PTE_SUPER))
+    return demote(pte);
+  return 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -122,6 +331,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(*pte & PTE_SUPER)
+    pa += PGROUNDDOWN(va % SUPERPGSIZE);
   return pa;
 }
 
@@ -137,7 +348,9 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Wherever va and pa are both 2MB-aligned
+// and at least 2MB remain, maps a superpage.
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
@@ -148,9 +361,23 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   if(size == 0)
     panic("mappages: size");
   
+  perm &= ~PTE_SUPER;
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      if((pte = walksuper(pagetable, a, 1)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        panic("mappages: remap");
+      *pte = PA2PTE(pa) | perm | PTE_SUPER | PTE_V;
+      if(a + SUPERPGSIZE - PGSIZE == last)
+        break;
+      a += SUPERPGSIZE;
+      pa += SUPERPGSIZE;
+      continue;
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -165,8 +392,11 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never faulted in (lazy
+// allocation) are skipped. A superpage only partly in
+// the range is split first.
 // Optionally free the physical memory.
+#define FLUSHPAGES 16  // more than this flushes all of p's TLB entries
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
@@ -177,10 +407,34 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+    if((pte = walk(pagetable, a, 0)) == 0){
+      // no page-table page, so nothing mapped in the
+      // rest of its 2MB range; skip to the next one.
+      a = (a | ((1L << PXSHIFT(1)) - 1)) - (PGSIZE - 1);
+      continue;
+    }
+    if((*pte & (PTE_V|PTE_SWAP)) == PTE_SWAP){
+      if(do_free)
+        swapfree(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if(*pte & PTE_SUPER){
+      if(a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= va + npages*PGSIZE){
+        if(do_free)
+          kfree2m((void*)PTE2PA(*pte));
+        *pte = 0;
+        if(npages <= FLUSHPAGES)
+          uvmflush(pagetable, a);
+        a += SUPERPGSIZE - PGSIZE;
+        continue;
+      }
+      if(demote(pte) < 0)
+        panic("uvmunmap: split");
+      pte = walk(pagetable, a, 0);
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -188,7 +442,11 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       kfree((void*)pa);
     }
     *pte = 0;
+    if(npages <= FLUSHPAGES)
+      uvmflush(pagetable, a);
   }
+  if(npages > FLUSHPAGES)
+    uvmflush(pagetable, -1);
 }
 
 // create an empty user page table.
@@ -197,10 +455,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kzalloc();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -214,8 +471,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -233,12 +489,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -296,42 +551,435 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Writable pages become read-only copy-on-write
+// pages in both; uvmfault() copies them on the
+// first store. Copies the page table but not the
 // physical memory.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+    if((pte = walk(old, i, 0)) == 0){
+      // nothing faulted in yet in this 2MB range.
+      i = (i | ((1L << PXSHIFT(1)) - 1)) - (PGSIZE - 1);
+      continue;
+    }
+    if((*pte & (PTE_V|PTE_SWAP)) == PTE_SWAP){
+      // share the paged-out copy.
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      swapdup(PTE2SLOT(*pte));
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+    if(*pte & PTE_SUPER){
+      // share the whole superpage.
+      if(mappages(new, i, SUPERPGSIZE, pa, flags) != 0)
+        goto err;
+      for(int k = 0; k < SUPERPGSIZE/PGSIZE; k++)
+        kdup((void*)(pa + k*PGSIZE));
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
     }
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
+      goto err;
+    kdup((void*)pa);
   }
+  uvmflush(old, -1);
   return 0;
 
  err:
+  uvmflush(old, -1);
   uvmunmap(new, 0, i / PGSIZE, 1);
   return -1;
 }
 
+// Give pte, va's copy-on-write mapping in pagetable, a
+// private writable page, copying the shared one unless
+// this page table holds the only reference.
+// Returns 0 on success, -1 if out of memory.
+static int
+cowcopy(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  pte_t old;
+  uint64 pa;
+  uint flags;
+  char *mem = 0;
+
+  // another thread may get it first.
+  while(((old = *pte) & (PTE_V|PTE_COW)) == (PTE_V|PTE_COW)){
+    pa = PTE2PA(old);
+    flags = (PTE_FLAGS(old) & ~PTE_COW) | PTE_W;
+    if(krefcnt((void*)pa) == 1){
+      if(__sync_bool_compare_and_swap(pte, old, PA2PTE(pa) | flags))
+        break;
+      continue;
+    }
+    if(mem == 0 && (mem = uvmpagealloc(pagetable, va)) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    if(__sync_bool_compare_and_swap(pte, old, PA2PTE(mem) | flags)){
+      kfree((void*)pa);
+      return 0;
+    }
+  }
+  if(mem)
+    kfree(mem);
+  return 0;
+}
+
+// Size of the user address space that pagetable describes,
+// if it is the current process's; pages below it that were
+// never mapped are lazily allocated heap. 0 otherwise
+// (e.g. for exec's not-yet-installed page table).
+static uint64
+uvmsize(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p != 0 && p->pagetable == pagetable)
+    return p->group->sz;
+  return 0;
+}
+
+// Split the superpage pte maps, for paging out, into pages
+// that can go one by one. Memory has run out, so rather
+// than allocate a page-table page, page out the first of
+// the superpage's own pages and use that. The caller
+// flushes the TLB.
+// Returns 0, or -1 if swap is full.
+static int
+splitout(pte_t *pte)
+{
+  char *pa = (char*)PTE2PA(*pte);
+  pagetable_t pt = (pagetable_t)pa;
+  uint64 flags = PTE_FLAGS(*pte) & ~(PTE_SUPER|PTE_A);
+  uint slot;
+
+  if(swapout(&pa, &slot, 1) == 0)
+    return -1;
+  pt[0] = SLOT2PTE(slot) | PTE_SWAP | (flags & (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW));
+  for(int i = 1; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(pt) | PTE_V;
+  return 0;
+}
+
+// Page out up to SWAPBATCH of the current process's pages,
+// if pagetable is its, to make room. The clock algorithm
+// picks them: sweep the pages below its size from where
+// the last sweep stopped, give a page the MMU marked
+// accessed another chance by clearing the mark, and take
+// pages still unmarked since. Only pages this page table
+// alone refers to go, never the page at skip (the one
+// being faulted in), and none at all if the
+// process has threads: they might store to a page while
+// it is on its way out. An unmarked superpage is split.
+// Returns the number of pages freed.
+static int
+pageout(pagetable_t pagetable, uint64 skip)
+{
+  struct proc *p = myproc();
+  char *pages[SWAPBATCH];
+  pte_t *ptes[SWAPBATCH];
+  uint slots[SWAPBATCH];
+  uint64 sz, va, next, scanned;
+  pte_t *pte;
+  int i, n;
+
+  if(p == 0 || p->pagetable != pagetable || sharedvm(p) || !swapavail())
+    return 0;
+  sz = PGROUNDDOWN(p->sz);
+  skip = PGROUNDDOWN(skip);
+  va = p->swaphand;
+  n = 0;
+  for(scanned = 0; scanned < 2 * (sz / PGSIZE) && n < SWAPBATCH; ){
+    if(va >= sz)
+      va = 0;
+    pte = walk(pagetable, va, 0);
+    if(pte && (*pte & (PTE_SUPER|PTE_U|PTE_A)) == (PTE_SUPER|PTE_U) &&
+       SUPERPGROUNDDOWN(va) != SUPERPGROUNDDOWN(skip) &&
+       krefcnt((void*)PTE2PA(*pte)) == 1 && splitout(pte) == 0)
+      pte = walk(pagetable, va, 0);
+    if(pte == 0 || (*pte & PTE_SUPER)){
+      // nothing to take in the rest of this 2MB range.
+      if(pte)
+        *pte &= ~PTE_A;
+      next = SUPERPGROUNDDOWN(va) + SUPERPGSIZE;
+      scanned += (next - va) / PGSIZE;
+      va = next;
+      continue;
+    }
+    if((*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) && va != skip &&
+       krefcnt((void*)PTE2PA(*pte)) == 1){
+      if(*pte & PTE_A){
+        *pte &= ~PTE_A;
+      } else {
+        // a small space's sweep may come round to it twice.
+        for(i = 0; i < n && ptes[i] != pte; i++)
+          ;
+        if(i == n){
+          ptes[n] = pte;
+          pages[n++] = (char*)PTE2PA(*pte);
+        }
+      }
+    }
+    va += PGSIZE;
+    scanned++;
+  }
+  p->swaphand = va;
+
+  n = n > 0 ? swapout(pages, slots, n) : 0;
+  for(i = 0; i < n; i++)
+    *ptes[i] = SLOT2PTE(slots[i]) | PTE_SWAP |
+      (PTE_FLAGS(*ptes[i]) & (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW));
+  // without the TLB's copies, the MMU sets the accessed
+  // bits cleared above again on the next touch.
+  uvmflush(pagetable, -1);
+  for(i = 0; i < n; i++)
+    kfree(pages[i]);
+  return n;
+}
+
+// Allocate a page for a fault on va in pagetable. If memory
+// has run out, page out some of the process's other pages
+// to make room.
+// Returns 0 if that failed too.
+char *
+uvmpagealloc(pagetable_t pagetable, uint64 va)
+{
+  char *mem;
+  int nested;
+
+  while((mem = kalloc()) == 0){
+    // writing to swap sleeps; see mmapfault().
+    push_off();
+    nested = mycpu()->noff > 1;
+    pop_off();
+    if(nested || pageout(pagetable, va) == 0)
+      return 0;
+  }
+  return mem;
+}
+
+// Read va's page, which pte says is paged out, back in
+// from swap. Returns 0, or -1 if out of memory or a
+// spinlock is held.
+static int
+pagein(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  pte_t old = *pte;
+  char *mem;
+  int nested;
+
+  // reading swap sleeps; see mmapfault().
+  push_off();
+  nested = mycpu()->noff > 1;
+  pop_off();
+  if(nested || (mem = uvmpagealloc(pagetable, va)) == 0)
+    return -1;
+  swapin(PTE2SLOT(old), mem);
+  // another thread may have read it in meanwhile. mark it
+  // accessed, so the clock doesn't take it straight back.
+  if(__sync_bool_compare_and_swap(pte, old, PA2PTE(mem) | PTE_V | PTE_A |
+                                  (PTE_FLAGS(old) & ~PTE_SWAP)))
+    swapfree(PTE2SLOT(old));
+  else
+    kfree(mem);
+  uvmflush(pagetable, va);
+  return 0;
+}
+
+// Map a zeroed page at va, the first touch of a page
+// that sbrk() handed out without allocating. If nothing at
+// all is mapped yet in va's aligned 2MB, and all of it is
+// below the heap's end, map a whole superpage instead.
+// Returns 0 on success, -1 if out of memory.
+static int
+lazyalloc(pagetable_t pagetable, uint64 va)
+{
+  char *mem;
+  pte_t *pte;
+
+  if(SUPERPGROUNDDOWN(va) + SUPERPGSIZE <= uvmsize(pagetable) &&
+     !execseg(pagetable, SUPERPGROUNDDOWN(va), SUPERPGSIZE) &&
+     (pte = walksuper(pagetable, va, 1)) != 0 && *pte == 0 &&
+     (mem = kalloc2m()) != 0){
+    memset(mem, 0, SUPERPGSIZE);
+    if(!__sync_bool_compare_and_swap(pte, 0, PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_SUPER | PTE_V))
+      kfree2m(mem);
+    uvmflush(pagetable, va);
+    return 0;
+  }
+
+  if((mem = uvmpagealloc(pagetable, va)) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(uvminstall(pagetable, PGROUNDDOWN(va), (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Map page pa at user address va (page-aligned) of
+// pagetable, for a page fault, unless another thread sharing
+// pagetable mapped va meanwhile; then pa is freed. Either
+// way the TLB may still hold the invalid entry that faulted,
+// so va is flushed.
+// Returns 0, or -1 (leaving pa to the caller) if out of
+// memory for the page table.
+int
+uvminstall(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+
+  if((pte = walk(pagetable, va, 1)) == 0)
+    return -1;
+  if(!__sync_bool_compare_and_swap(pte, 0, PA2PTE(pa) | perm | PTE_V))
+    kfree((void*)pa);
+  uvmflush(pagetable, va);
+  return 0;
+}
+
+// Handle a page fault on user address va in pagetable,
+// either from usertrap() or on behalf of copyin()/copyout():
+// the program's pages, left by exec() to be read in, lazily
+// allocated heap, copy-on-write, paged out to swap, or
+// (above the heap) memory-mapped files.
+// write is non-zero for a store.
+// Returns 0 if the access may now proceed,
+// -1 if it is illegal or memory ran out.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & (PTE_V|PTE_SWAP)) == PTE_SWAP && pagein(pagetable, va, pte) < 0)
+    return -1;
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(va >= uvmsize(pagetable))
+      return mmapfault(pagetable, va, write);
+    if(!execseg(pagetable, va, 1))
+      return lazyalloc(pagetable, va);
+    // a store to a data page must still copy it.
+    if(execfault(pagetable, va) < 0)
+      return -1;
+    pte = walk(pagetable, va, 0);
+  }
+  if((*pte & PTE_U) == 0)
+    return -1;
+  if(write && (*pte & PTE_W) == 0){
+    if((*pte & PTE_COW) == 0)
+      return -1;
+    if(*pte & PTE_SUPER){
+      // copy just the page being written.
+      if(demote(pte) < 0)
+        return -1;
+      pte = walk(pagetable, va, 0);
+    }
+    if(cowcopy(pagetable, va, pte) < 0)
+      return -1;
+    // the TLB may hold the read-only mapping.
+    uvmflush(pagetable, va);
+  }
+  return 0;
+}
+
+// Is pagetable the current process's, shared with threads?
+// Its mappings mustn't then be changed under them.
+static int
+uvmthreaded(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  return p != 0 && p->pagetable == pagetable && sharedvm(p);
+}
+
+// Share the user page at va (page-aligned) with the kernel,
+// for zero-copy transfers: make it copy-on-write if it was
+// writable, take a reference, and return its physical
+// address in *pa. The caller must kfree() *pa when done.
+// Returns -1 if the page isn't mapped and readable, or is
+// in a mapped region (above the heap), whose pages must
+// stay shared with a file or other processes.
+int
+uvmshare(pagetable_t pagetable, uint64 va, uint64 *pa)
+{
+  pte_t *pte;
+
+  if(va >= uvmsize(pagetable) || uvmthreaded(pagetable) || uvmsplit(pagetable, va) < 0)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_R)) != (PTE_V|PTE_U|PTE_R))
+    return -1;
+  if(*pte & PTE_W){
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    uvmflush(pagetable, va);
+  }
+  *pa = PTE2PA(*pte);
+  kdup((void*)*pa);
+  return 0;
+}
+
+// Replace the user page at va (page-aligned) with page pa,
+// handing the caller's reference to pagetable. The new page
+// is mapped copy-on-write, since others may share it.
+// Returns -1, leaving the reference with the caller, if va
+// isn't mapped, the user couldn't write to it, or it is in
+// a mapped region, as for uvmshare().
+int
+uvmremap(pagetable_t pagetable, uint64 va, uint64 pa)
+{
+  pte_t *pte;
+  uint64 old;
+
+  if(va >= uvmsize(pagetable) || uvmthreaded(pagetable) || uvmsplit(pagetable, va) < 0)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) ||
+     (*pte & (PTE_W|PTE_COW)) == 0)
+    return -1;
+  old = PTE2PA(*pte);
+  *pte = PA2PTE(pa) | ((PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW);
+  uvmflush(pagetable, va);
+  kfree((void*)old);
+  return 0;
+}
+
+// Move the page tables under old's last root entry, from
+// UTOPTABLE up, to new, which has nothing mapped there.
+// exec() uses it to keep the trampoline, trapframe and
+// USYSCALL mappings, rather than free them and make them
+// again.
+void
+uvmmovetop(pagetable_t old, pagetable_t new)
+{
+  int i = PX(2, UTOPTABLE);
+
+  if(new[i] != 0)
+    panic("uvmmovetop");
+  new[i] = old[i];
+  old[i] = 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -339,10 +987,52 @@ uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   
+  if(uvmsplit(pagetable, va) < 0)
+    panic("uvmclear: split");
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
+  uvmflush(pagetable, va);
+}
+
+// Look up user address va for a kernel copy, faulting its
+// page in as usertrap() would: allocate lazy pages, and for
+// a write break copy-on-write sharing and refuse read-only
+// pages. Return the physical address, and in *n the number
+// of bytes from there to the end of the page or superpage,
+// or return 0 if va is not accessible. A page to be written
+// is marked dirty, as the hardware would for a user store,
+// so that munmap() writes a shared file page back.
+// *last is the PTE this returned for the copy's previous
+// page, or 0 at the start. When va is the next page in the
+// same 2MB range, its PTE is the one after, so a copy walks
+// the page table once per 2MB rather than once per page.
+static uint64
+uvmcopyaddr(pagetable_t pagetable, uint64 va, int write, pte_t **last, uint64 *n)
+{
+  pte_t *pte = *last;
+
+  if(pte && (*pte & PTE_SUPER) == 0 && va % SUPERPGSIZE != 0)
+    pte++;
+  else
+    pte = va < MAXVA ? walk(pagetable, va, 0) : 0;
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) ||
+     (write && (*pte & PTE_W) == 0)){
+    if(uvmfault(pagetable, va, write) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  *last = pte;
+  if(write)
+    *pte |= PTE_D;
+
+  if(*pte & PTE_SUPER){
+    *n = SUPERPGSIZE - va % SUPERPGSIZE;
+    return PTE2PA(*pte) + va % SUPERPGSIZE;
+  }
+  *n = PGSIZE - va % PGSIZE;
+  return PTE2PA(*pte) + va % PGSIZE;
 }
 
 // Copy from kernel to user.
@@ -351,21 +1041,20 @@ uvmclear(pagetable_t pagetable, uint64 va)
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
-  uint64 n, va0, pa0;
+  uint64 n, pa;
+  pte_t *pte = 0;
 
   while(len > 0){
-    va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    pa = uvmcopyaddr(pagetable, dstva, 1, &pte, &n);
+    if(pa == 0)
       return -1;
-    n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
-    memmove((void *)(pa0 + (dstva - va0)), src, n);
+    memmove((void *)pa, src, n);
 
     len -= n;
     src += n;
-    dstva = va0 + PGSIZE;
+    dstva += n;
   }
   return 0;
 }
@@ -376,21 +1065,20 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
-  uint64 n, va0, pa0;
+  uint64 n, pa;
+  pte_t *pte = 0;
 
   while(len > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    pa = uvmcopyaddr(pagetable, srcva, 0, &pte, &n);
+    if(pa == 0)
       return -1;
-    n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
-    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    memmove(dst, (void *)pa, n);
 
     len -= n;
     dst += n;
-    srcva = va0 + PGSIZE;
+    srcva += n;
   }
   return 0;
 }
@@ -402,19 +1090,19 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
+  uint64 n, m, pa;
+  pte_t *pte = 0;
   int got_null = 0;
 
   while(got_null == 0 && max > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    pa = uvmcopyaddr(pagetable, srcva, 0, &pte, &n);
+    if(pa == 0)
       return -1;
-    n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
+    m = n;
 
-    char *p = (char *) (pa0 + (srcva - va0));
+    char *p = (char *) pa;
     while(n > 0){
       if(*p == '\0'){
         *dst = '\0';
@@ -429,7 +1117,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       dst++;
     }
 
-    srcva = va0 + PGSIZE;
+    srcva += m;
   }
   if(got_null){
     return 0;
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #define stat xv6_stat  // avoid clash with host struct stat
 #include "kernel/types.h"
@@ -19,25 +20,38 @@
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// followed by nswap blocks of swap space, left as a hole.
+//
+// The image is built in place in a shared mapping of the
+// output file, which starts out as a hole of FSSIZE blocks:
+// sectors are read and written with memmove(), and only the
+// blocks that hold something are ever written to the host's
+// disk.
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
+#ifdef RAMDISK
+int nswap = 0;  // paging out to a disk in memory gains nothing
+#else
+int nswap = SWAPSIZE;
+#endif
 
 int fsfd;
+uchar *img;       // the image, mapped from fsfd
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+uint freeindex;   // index blocks are allocated downwards from the end
 
 
-void balloc(int);
+void balloc(int, int);
+void *sect(uint);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
-void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
 void die(const char *);
@@ -72,6 +86,7 @@ main(int argc, char *argv[])
   uint rootino, inum, off;
   struct dirent de;
   char buf[BSIZE];
+  static char fbuf[64*BSIZE];
   struct dinode din;
 
 
@@ -88,6 +103,11 @@ main(int argc, char *argv[])
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
     die(argv[1]);
+  if(ftruncate(fsfd, (off_t)(FSSIZE + nswap) * BSIZE) < 0)
+    die("ftruncate");
+  img = mmap(0, (size_t)FSSIZE * BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fsfd, 0);
+  if(img == MAP_FAILED)
+    die("mmap");
 
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
@@ -101,14 +121,14 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(nswap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d swap %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE, nswap);
 
   freeblock = nmeta;     // the first free block that we can allocate
-
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  freeindex = FSSIZE - 1;  // the last
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -154,8 +174,8 @@ main(int argc, char *argv[])
     strncpy(de.name, shortname, DIRSIZ);
     iappend(rootino, &de, sizeof(de));
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    while((cc = read(fd, fbuf, sizeof(fbuf))) > 0)
+      iappend(inum, fbuf, cc);
 
     close(fd);
   }
@@ -167,56 +187,47 @@ main(int argc, char *argv[])
   din.size = xint(off);
   winode(rootino, &din);
 
-  balloc(freeblock);
+  balloc(freeblock, freeindex + 1);
 
+  if(munmap(img, (size_t)FSSIZE * BSIZE) < 0)
+    die("munmap");
+  if(close(fsfd) < 0)
+    die(argv[1]);
   exit(0);
 }
 
+// The image's sector sec.
+void*
+sect(uint sec)
+{
+  assert(sec < FSSIZE);
+  return img + (size_t)sec * BSIZE;
+}
+
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(write(fsfd, buf, BSIZE) != BSIZE)
-    die("write");
+  memmove(sect(sec), buf, BSIZE);
 }
 
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
-  uint bn;
   struct dinode *dip;
 
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = (struct dinode*)sect(IBLOCK(inum, sb)) + (inum % IPB);
   *dip = *ip;
-  wsect(bn, buf);
 }
 
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
-  uint bn;
   struct dinode *dip;
 
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = (struct dinode*)sect(IBLOCK(inum, sb)) + (inum % IPB);
   *ip = *dip;
 }
 
-void
-rsect(uint sec, void *buf)
-{
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(read(fsfd, buf, BSIZE) != BSIZE)
-    die("read");
-}
-
 uint
 ialloc(ushort type)
 {
@@ -231,33 +242,72 @@ ialloc(ushort type)
   return inum;
 }
 
+// Set bits [from, to) of the bitmap at bm: a byte at a
+// time, apart from the ends.
 void
-balloc(int used)
+setbits(uchar *bm, int from, int to)
 {
-  uchar buf[BSIZE];
-  int i;
-
-  printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  for(; from < to && from % 8 != 0; from++)
+    bm[from/8] |= 1 << (from%8);
+  if(from < to - to%8){
+    memset(bm + from/8, 0xff, (to - to%8 - from) / 8);
+    from = to - to%8;
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  for(; from < to; from++)
+    bm[from/8] |= 1 << (from%8);
+}
+
+// Mark blocks [0, used) and [top, FSSIZE) allocated.
+void
+balloc(int used, int top)
+{
+  uchar *bm;
+
+  printf("balloc: first %d and last %d blocks have been allocated\n",
+         used, FSSIZE - top);
+  assert(used <= top);
+  // the bitmap blocks are consecutive, so bit b of the
+  // whole bitmap is block b's.
+  bm = sect(sb.bmapstart);
+  assert(sb.bmapstart + nbitmap <= FSSIZE);
+  memset(bm, 0, nbitmap * BSIZE);
+  setbits(bm, 0, used);
+  setbits(bm, top, FSSIZE);
+  printf("balloc: wrote %d bitmap blocks at sector %d\n", nbitmap, sb.bmapstart);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry i of index block *addr (in disk byte order),
+// allocating the index block from the end of the disk, and
+// the entry as the next data block, if need be.
+uint
+bindex(uint *addr, uint i, int data)
+{
+  uint *indirect;
+
+  if(xint(*addr) == 0){
+    assert(freeindex >= freeblock);
+    *addr = xint(freeindex--);
+  }
+  indirect = sect(xint(*addr));
+  if(indirect[i] == 0){
+    assert(freeindex >= freeblock);
+    indirect[i] = xint(data ? freeblock++ : freeindex--);
+  }
+  return indirect[i];
+}
+
+// Data blocks are allocated in order, so each file's data
+// is contiguous on disk apart from the root directory's
+// blocks; index blocks go at the end of the disk.
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  uint x, ind;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -270,21 +320,16 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
+    } else if(fbn < NDIRECT + NINDIRECT){
+      x = xint(bindex(&din.addrs[NDIRECT], fbn - NDIRECT, 1));
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
+      fbn -= NDIRECT + NINDIRECT;
+      ind = bindex(&din.addrs[NDIRECT+1], fbn / NINDIRECT, 0);
+      x = xint(bindex(&ind, fbn % NINDIRECT, 1));
+      fbn = off / BSIZE;
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    bcopy(p, (char*)sect(x) + off - (fbn * BSIZE), n1);
     n -= n1;
     off += n1;
     p += n1;
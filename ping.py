@@ -0,0 +1,21 @@
+# Send a UDP packet a second to xv6's port 2000, through
+# qemu's forward from the port given on the command line,
+# and print the replies (run nettests -e in xv6).
+
+import socket
+import sys
+import time
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+sock.settimeout(1)
+buf = "this is a ping!".encode('utf-8')
+
+while True:
+    print("pinging xv6...", file=sys.stderr)
+    sock.sendto(buf, ("127.0.0.1", int(sys.argv[1])))
+    try:
+        reply, raddr = sock.recvfrom(4096)
+        print(reply.decode("utf-8"), file=sys.stderr)
+    except socket.timeout:
+        pass
+    time.sleep(1)
@@ -0,0 +1,275 @@
+// Timed microbenchmarks of system calls, processes, pipes
+// and the file system, for spotting performance regressions.
+//
+// usage: bench [name ...]
+//
+// Runs the named benchmarks, or all of them. Each prints
+// one line for bench-xv6 to read:
+//
+//   bench name ops ns ops/s ns/op cycles/op
+//
+// where ns is the elapsed time of ops operations, and cycles
+// are time CSR (timer) cycles, which tick at a fixed rate
+// whatever the CPU's clock.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "user/user.h"
+
+#define BUFSZ 4096
+
+char buf[BUFSZ];
+char *progname;
+
+struct bench {
+  char *name;
+  int ops;
+  void (*fn)(int);
+};
+
+void
+fail(char *what)
+{
+  printf("bench: %s failed\n", what);
+  exit(1);
+}
+
+void
+forkexit(int n)
+{
+  int pid;
+
+  for(int i = 0; i < n; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+}
+
+void
+forkexec(int n)
+{
+  char *argv[] = { progname, "-exit", 0 };
+  int pid;
+
+  for(int i = 0; i < n; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      exec(progname, argv);
+      fail("exec");
+    }
+    wait(0);
+  }
+}
+
+void
+spawnexit(int n)
+{
+  char *argv[] = { progname, "-exit", 0 };
+  int fds[] = { 0, 1, 2 };
+
+  for(int i = 0; i < n; i++){
+    if(spawn(progname, argv, fds, 3) < 0)
+      fail("spawn");
+    wait(0);
+  }
+}
+
+// round trips of a byte between two processes.
+void
+pingpong(int n)
+{
+  int p1[2], p2[2], pid, i;
+  char c = 0;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    for(i = 0; i < n; i++){
+      if(read(p1[0], &c, 1) != 1 || write(p2[1], &c, 1) != 1)
+        fail("child read/write");
+    }
+    exit(0);
+  }
+  for(i = 0; i < n; i++){
+    if(write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1)
+      fail("read/write");
+  }
+  wait(0);
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+  close(p2[1]);
+}
+
+// BUFSZ-byte writes through a pipe to another process.
+void
+pipebw(int n)
+{
+  int p[2], pid, i, m, total;
+
+  if(pipe(p) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(p[0]);
+    for(i = 0; i < n; i++)
+      if(write(p[1], buf, BUFSZ) != BUFSZ)
+        fail("write");
+    exit(0);
+  }
+  close(p[1]);
+  total = 0;
+  while((m = read(p[0], buf, BUFSZ)) > 0)
+    total += m;
+  close(p[0]);
+  wait(0);
+  if(total != n * BUFSZ)
+    fail("pipe read");
+}
+
+// create, write 512 bytes, close, reopen and read back.
+void
+smallfile(int n)
+{
+  int fd;
+
+  for(int i = 0; i < n; i++){
+    if((fd = open("bench.small", O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+      fail("create");
+    if(write(fd, buf, 512) != 512)
+      fail("write");
+    close(fd);
+    if((fd = open("bench.small", O_RDONLY)) < 0)
+      fail("open");
+    if(read(fd, buf, 512) != 512)
+      fail("read");
+    close(fd);
+  }
+  unlink("bench.small");
+}
+
+// write one file in BUFSZ chunks, then read it back.
+void
+largefile(int n)
+{
+  int fd, i;
+
+  if((fd = open("bench.large", O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+    fail("create");
+  for(i = 0; i < n/2; i++)
+    if(write(fd, buf, BUFSZ) != BUFSZ)
+      fail("write");
+  close(fd);
+  if((fd = open("bench.large", O_RDONLY)) < 0)
+    fail("open");
+  for(i = 0; i < n/2; i++)
+    if(read(fd, buf, BUFSZ) != BUFSZ)
+      fail("read");
+  close(fd);
+  unlink("bench.large");
+}
+
+void
+createunlink(int n)
+{
+  int fd;
+
+  for(int i = 0; i < n; i++){
+    if((fd = open("bench.cu", O_CREATE|O_WRONLY)) < 0)
+      fail("create");
+    close(fd);
+    if(unlink("bench.cu") < 0)
+      fail("unlink");
+  }
+}
+
+// grow the heap by a page, touch it, and shrink it again.
+void
+sbrkpage(int n)
+{
+  char *p;
+
+  for(int i = 0; i < n; i++){
+    if((p = sbrk(4096)) == (char*)-1)
+      fail("sbrk");
+    *p = 1;
+    sbrk(-4096);
+  }
+}
+
+// a real system call: getpid() itself doesn't trap.
+void
+getpidtrap(int n)
+{
+  for(int i = 0; i < n; i++)
+    _getpid();
+}
+
+struct bench benches[] = {
+  { "forkexit",   200,     forkexit },
+  { "forkexec",   100,     forkexec },
+  { "spawnexit",  100,     spawnexit },
+  { "pingpong",   2000,    pingpong },
+  { "pipebw",     2048,    pipebw },
+  { "smallfile",  200,     smallfile },
+  { "largefile",  1024,    largefile },
+  { "createunlink", 200,   createunlink },
+  { "sbrk",       2000,    sbrkpage },
+  { "getpid",     100000,  getpidtrap },
+};
+
+void
+run(struct bench *b)
+{
+  uint64 t0, t1, ns;
+
+  // once untimed, to warm up caches and the page cache.
+  b->fn(b->ops / 10 > 0 ? b->ops / 10 : 1);
+
+  t0 = r_time();
+  b->fn(b->ops);
+  t1 = r_time();
+  ns = (t1 - t0) * (1000000000 / ((struct usyscall *)USYSCALL)->timefreq);
+  if(ns == 0)
+    ns = 1;
+  printf("bench %s %d %l %l %l %l\n", b->name, b->ops, ns,
+         (uint64)b->ops * 1000000000 / ns, ns / b->ops, (t1 - t0) / b->ops);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, k, nbench = sizeof(benches)/sizeof(benches[0]);
+
+  if(argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit(0);
+  progname = argv[0];
+  memset(buf, 'b', sizeof(buf));
+
+  if(argc <= 1){
+    for(k = 0; k < nbench; k++)
+      run(&benches[k]);
+    exit(0);
+  }
+  for(i = 1; i < argc; i++){
+    for(k = 0; k < nbench && strcmp(benches[k].name, argv[i]) != 0; k++)
+      ;
+    if(k == nbench){
+      fprintf(2, "bench: no benchmark %s\n", argv[i]);
+      exit(1);
+    }
+    run(&benches[k]);
+  }
+  exit(0);
+}
@@ -0,0 +1,220 @@
+// Find files by name.
+//
+// usage: find [-P procs] dir name
+//
+// Prints the path of each file and directory below dir that
+// is called name. Each directory is opened with openat()
+// relative to its parent's fd, and read with getdents(),
+// which gives every entry's type, so the walk neither looks
+// up full paths nor stat()s each entry.
+//
+// With -P, the top of the tree is split breadth first into
+// a few directories for each process, and procs processes
+// take them from a pipe and walk them at once.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define NDS 16        // entries per getdents()
+#define NQUEUE 64     // most directories to split the tree into
+
+char *target;
+char path[512];       // of the directory being walked
+int failed;
+
+char *queue[NQUEUE];  // directories left for the processes
+int qhead, qtail;
+
+void
+usage(void)
+{
+  fprintf(2, "usage: find [-P procs] dir name\n");
+  exit(1);
+}
+
+void
+error(char *msg)
+{
+  fprintf(2, "find: %s %s\n", msg, path);
+  failed = 1;
+}
+
+// Append /name to the path[0..n) of its directory.
+// Returns the new length, or -1 if it doesn't fit.
+int
+append(int n, char *name)
+{
+  int len;
+
+  len = strlen(name);
+  if(n + 1 + len + 1 >= sizeof(path))  // and found()'s '\n'
+    return -1;
+  if(n == 0 || path[n-1] != '/')
+    path[n++] = '/';
+  memmove(path + n, name, len + 1);
+  return n + len;
+}
+
+// Print path[0..n) with one write(), so that lines from
+// different processes don't mix.
+void
+found(int n)
+{
+  path[n] = '\n';
+  write(1, path, n + 1);
+  path[n] = 0;
+}
+
+// Save path[0..n) in the queue, if there's room.
+int
+enqueue(int n)
+{
+  char *s;
+
+  if(qtail == NQUEUE || (s = malloc(n + 1)) == 0)
+    return -1;
+  memmove(s, path, n + 1);
+  queue[qtail++] = s;
+  return 0;
+}
+
+// Walk directory fd, whose path is path[0..n), and what's
+// below it. If split is set, leave subdirectories to the
+// queue rather than walking them now.
+void
+walk(int fd, int n, int split)
+{
+  struct dirstat *ds;
+  int i, m, len, sub;
+
+  if((ds = malloc(NDS * sizeof(*ds))) == 0){
+    fprintf(2, "find: out of memory\n");
+    exit(1);
+  }
+  while((m = getdents(fd, ds, NDS)) > 0){
+    for(i = 0; i < m; i++){
+      if(strcmp(ds[i].name, ".") == 0 || strcmp(ds[i].name, "..") == 0)
+        continue;
+      if((len = append(n, ds[i].name)) < 0){
+        error("path too long in");
+        continue;
+      }
+      if(strcmp(ds[i].name, target) == 0)
+        found(len);
+      if(ds[i].type == T_DIR && (!split || enqueue(len) < 0)){
+        if((sub = openat(fd, ds[i].name, O_RDONLY)) < 0){
+          error("cannot open");
+        } else {
+          walk(sub, len, 0);
+          close(sub);
+        }
+      }
+      path[n] = 0;
+    }
+  }
+  if(m < 0)
+    error("cannot read");
+  free(ds);
+}
+
+// Open directory path[0..n) and walk it.
+void
+walkpath(int n, int split)
+{
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    error("cannot open");
+    return;
+  }
+  walk(fd, n, split);
+  close(fd);
+}
+
+// Walk the queue's directories in procs processes. Each
+// takes the next directory's index from a pipe when it's
+// done with the last, so that one big directory doesn't
+// hold up the others' share.
+void
+parallel(int procs)
+{
+  int p[2], i, q, pid, xstatus;
+
+  if(pipe(p) < 0){
+    fprintf(2, "find: pipe failed\n");
+    exit(1);
+  }
+  // all of it fits in the pipe, and since each read() asks
+  // for one whole index, none is split between processes.
+  for(i = qhead; i < qtail; i++)
+    write(p[1], &i, sizeof(i));
+  close(p[1]);
+
+  for(i = 0; i < procs; i++){
+    if((pid = fork()) < 0){
+      fprintf(2, "find: fork failed\n");
+      failed = 1;
+      break;
+    }
+    if(pid == 0){
+      while(read(p[0], &q, sizeof(q)) == sizeof(q)){
+        strcpy(path, queue[q]);
+        walkpath(strlen(path), 0);
+      }
+      exit(failed);
+    }
+  }
+  close(p[0]);
+  if(i == 0){
+    // no processes at all; walk them here.
+    for(; qhead < qtail; qhead++){
+      strcpy(path, queue[qhead]);
+      walkpath(strlen(path), 0);
+    }
+  }
+  while(i-- > 0){
+    if(wait(&xstatus) < 0 || xstatus != 0)
+      failed = 1;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct stat st;
+  int i, n, procs;
+
+  procs = 1;
+  i = 1;
+  if(argc > 2 && strcmp(argv[1], "-P") == 0){
+    if((procs = atoi(argv[2])) < 1)
+      usage();
+    i = 3;
+  }
+  if(argc - i != 2)
+    usage();
+  target = argv[i+1];
+  if((n = strlen(argv[i])) >= sizeof(path) - 1)
+    usage();
+  strcpy(path, argv[i]);
+
+  if(stat(path, &st) < 0 || st.type != T_DIR){
+    fprintf(2, "find: %s is not a directory\n", path);
+    exit(1);
+  }
+  if(procs == 1){
+    walkpath(n, 0);
+    exit(failed);
+  }
+
+  walkpath(n, 1);
+  while(qhead < qtail && qtail - qhead < 4*procs && qtail < NQUEUE){
+    strcpy(path, queue[qhead++]);
+    walkpath(strlen(path), 1);
+  }
+  parallel(procs < qtail - qhead ? procs : qtail - qhead);
+  exit(failed);
+}
@@ -1,35 +1,254 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// The pattern is compiled once. A plain string is searched
+// for through the whole buffer with Boyer-Moore-Horspool,
+// and only the lines it turns up in are looked at. Other
+// patterns run as a DFA, built lazily from the pattern's
+// NFA as bytes come along, so each byte costs one table
+// lookup. A pattern too long for that falls back to match().
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[1024];
+char buf[8192];
 int match(char*, char*);
 
+#define LITERAL   1
+#define DFA       2
+#define BACKTRACK 3
+
+#define MAXELEM 63    // pattern elements the DFA handles
+#define NDSTATE 64    // DFA states cached at once
+
+int mode;
+char *pattern;
+
+// LITERAL: the string's length, and how far to move the
+// window along for each byte at its end.
+int litlen;
+int skip[256];
+
+// DFA: the pattern as elements, each a byte (or -1 for
+// '.'), maybe starred. NFA state i means elements 0..i-1
+// have matched; state nelem accepts.
+struct elem {
+  int c;
+  int star;
+} elem[MAXELEM];
+int nelem;
+int bol, eol;                 // anchored by ^ or $
+uint64 startset;
+
+// each DFA state is a set of NFA states.
+uint64 dset[NDSTATE];
+short dnext[NDSTATE][256];    // successor, or -1 if not yet known
+int ndstate;
+int dstart;
+
+// Add the states reachable by skipping starred elements.
+uint64
+closure(uint64 s)
+{
+  for(int i = 0; i < nelem; i++)
+    if((s & (1UL << i)) && elem[i].star)
+      s |= 1UL << (i+1);
+  return s;
+}
+
+// The NFA states after byte c, from states s.
+uint64
+step(uint64 s, int c)
+{
+  uint64 n = 0;
+
+  for(int i = 0; i < nelem; i++){
+    if((s & (1UL << i)) && (elem[i].c == -1 || elem[i].c == c))
+      n |= elem[i].star ? 1UL << i : 1UL << (i+1);
+  }
+  n = closure(n);
+  // unanchored, a match may start at any byte.
+  if(!bol)
+    n |= startset;
+  return n;
+}
+
+int
+newstate(uint64 set)
+{
+  dset[ndstate] = set;
+  memset(dnext[ndstate], 0xff, sizeof(dnext[ndstate]));
+  return ndstate++;
+}
+
+// The DFA state after byte c from state s, building it
+// if it is new.
+int
+dfanext(int s, int c)
+{
+  uint64 set = step(dset[s], c);
+  int t;
+
+  for(t = 0; t < ndstate; t++)
+    if(dset[t] == set)
+      break;
+  if(t == ndstate){
+    if(ndstate == NDSTATE){
+      // the cache is full: start it again.
+      ndstate = 0;
+      dstart = newstate(startset);
+      return set == startset ? dstart : newstate(set);
+    }
+    newstate(set);
+  }
+  dnext[s][c] = t;
+  return t;
+}
+
+#define ACCEPTS(s) ((dset[s] >> nelem) & 1)
+
+// Does the line [p, e) match, by the DFA?
+int
+dfamatch(char *p, char *e)
+{
+  int s, t;
+
+  s = dstart;
+  for(; p < e; p++){
+    if(!eol && ACCEPTS(s))
+      return 1;
+    if(dset[s] == 0)
+      return 0;  // anchored, and failed
+    if((t = dnext[s][(uchar)*p]) < 0)
+      t = dfanext(s, (uchar)*p);
+    s = t;
+  }
+  return ACCEPTS(s);
+}
+
+void
+compile(char *re)
+{
+  int i;
+
+  pattern = re;
+  nelem = 0;
+  bol = eol = 0;
+  if(re[0] == '^'){
+    bol = 1;
+    re++;
+  }
+  // the same reading of the pattern as matchhere()'s.
+  while(*re){
+    if(re[0] == '$' && re[1] == '\0'){
+      eol = 1;
+      break;
+    }
+    if(nelem == MAXELEM){
+      mode = BACKTRACK;
+      return;
+    }
+    elem[nelem].c = re[0] == '.' ? -1 : (uchar)re[0];
+    elem[nelem].star = re[1] == '*';
+    re += elem[nelem++].star ? 2 : 1;
+  }
+
+  mode = LITERAL;
+  for(i = 0; i < nelem; i++)
+    if(elem[i].c == -1 || elem[i].star)
+      mode = DFA;
+  if(bol || eol || nelem == 0)
+    mode = DFA;
+
+  if(mode == LITERAL){
+    litlen = nelem;
+    for(i = 0; i < 256; i++)
+      skip[i] = litlen;
+    for(i = 0; i < litlen-1; i++)
+      skip[(uchar)pattern[i]] = litlen-1-i;
+    return;
+  }
+
+  startset = closure(1);
+  ndstate = 0;
+  dstart = newstate(startset);
+}
+
+// Find the pattern string in [p, e), or return 0.
+char*
+litsearch(char *p, char *e)
+{
+  uchar c;
+
+  while(e - p >= litlen){
+    c = p[litlen-1];
+    if(c == (uchar)pattern[litlen-1] && memcmp(p, pattern, litlen-1) == 0)
+      return p;
+    p += skip[c];
+  }
+  return 0;
+}
+
+// Write out the matching lines of [p, e), whole lines
+// the last of which ends at e.
 void
-grep(char *pattern, int fd)
+grepbuf(char *p, char *e)
+{
+  char *q, *s;
+  int ok;
+
+  if(mode == LITERAL){
+    // the pattern has no newline, so a match
+    // lies within a line.
+    while((q = litsearch(p, e)) != 0){
+      for(s = q; s > p && s[-1] != '\n'; s--)
+        ;
+      q = memchr(q, '\n', e - q);
+      write(1, s, q+1 - s);
+      p = q+1;
+    }
+    return;
+  }
+
+  for(; p < e; p = q+1){
+    q = memchr(p, '\n', e - p);
+    if(mode == DFA){
+      ok = dfamatch(p, q);
+    } else {
+      *q = 0;
+      ok = match(pattern, p);
+      *q = '\n';
+    }
+    if(ok)
+      write(1, p, q+1 - p);
+  }
+}
+
+void
+grep(int fd)
 {
   int n, m;
-  char *p, *q;
+  char *e;
 
   m = 0;
   while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
     m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+    // hand over just the whole lines, unless a line
+    // fills the buffer: then as much as fits.
+    for(e = buf+m; e > buf && e[-1] != '\n'; e--)
+      ;
+    if(e == buf && m == sizeof(buf)-1){
+      buf[m++] = '\n';
+      e = buf+m;
     }
+    grepbuf(buf, e);
+    m -= e - buf;
+    memmove(buf, e, m);
+  }
+  if(m > 0){
+    // a last line with no newline.
+    buf[m++] = '\n';
+    grepbuf(buf, buf+m);
   }
 }
 
@@ -37,16 +256,15 @@ int
 main(int argc, char *argv[])
 {
   int fd, i;
-  char *pattern;
 
   if(argc <= 1){
     fprintf(2, "usage: grep pattern [file ...]\n");
     exit(1);
   }
-  pattern = argv[1];
+  compile(argv[1]);
 
   if(argc <= 2){
-    grep(pattern, 0);
+    grep(0);
     exit(0);
   }
 
@@ -55,7 +273,7 @@ main(int argc, char *argv[])
       printf("grep: cannot open %s\n", argv[i]);
       exit(1);
     }
-    grep(pattern, fd);
+    grep(fd);
     close(fd);
   }
   exit(0);
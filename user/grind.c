@@ -1,6 +1,18 @@
 //
 // run random system calls in parallel forever.
 //
+// grind -s [-n workers] [-t seconds] [-m mix] instead
+// measures how throughput scales: it starts workers (by
+// default one per CPU), each doing the operations named by
+// mix over and over for the given time, and prints each
+// one's and the total rate. The operations are:
+//   f  fork a child that exits, and wait for it (proc, kalloc)
+//   p  write and read back a byte through a pipe
+//   c  create, write, close and unlink a file (log)
+//   r  read a block of an already cached file (bcache)
+//   s  grow the heap, touch the page, shrink it (kalloc)
+//   g  getpid, a system call that does nothing
+//
 
 #include "kernel/param.h"
 #include "kernel/types.h"
@@ -333,9 +345,202 @@ iter()
   exit(0);
 }
 
+#define SCALEMIX "fpcrsg"
+
+// counts from a worker of grind -s, sent to the parent.
+struct scalecount {
+  int id;
+  uint64 ops;
+  uint64 ns;
+};
+
+// One worker of grind -s: do mix's operations in
+// turn until seconds have passed.
+void
+scaleworker(int id, char *mix, int seconds, int out)
+{
+  char name[16], buf[512];
+  struct scalecount sc;
+  uint64 t0, end;
+  int p[2], fd, rfd, pid;
+  char *m, *q;
+
+  name[0] = 's';
+  name[1] = '0' + id / 10;
+  name[2] = '0' + id % 10;
+  name[3] = 'r';
+  name[4] = 0;
+  if((rfd = open(name, O_CREATE|O_RDWR)) < 0 || write(rfd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("grind: create %s failed\n", name);
+    exit(1);
+  }
+  name[3] = 'c';
+  if(pipe(p) < 0){
+    printf("grind: pipe failed\n");
+    exit(1);
+  }
+
+  sc.id = id;
+  sc.ops = 0;
+  t0 = uptimens();
+  end = t0 + (uint64)seconds * 1000000000;
+  for(m = mix; uptimens() < end; sc.ops++, m++){
+    if(*m == 0)
+      m = mix;
+    switch(*m){
+    case 'f':
+      if((pid = fork()) < 0){
+        printf("grind: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        exit(0);
+      wait(0);
+      break;
+    case 'p':
+      if(write(p[1], buf, 1) != 1 || read(p[0], buf, 1) != 1){
+        printf("grind: pipe write/read failed\n");
+        exit(1);
+      }
+      break;
+    case 'c':
+      if((fd = open(name, O_CREATE|O_WRONLY)) < 0 || write(fd, buf, 100) != 100){
+        printf("grind: create %s failed\n", name);
+        exit(1);
+      }
+      close(fd);
+      unlink(name);
+      break;
+    case 'r':
+      if(pread(rfd, buf, sizeof(buf), 0) != sizeof(buf)){
+        printf("grind: pread failed\n");
+        exit(1);
+      }
+      break;
+    case 's':
+      if((q = sbrk(4096)) == (char*)-1){
+        printf("grind: sbrk failed\n");
+        exit(1);
+      }
+      *q = 1;
+      sbrk(-4096);
+      break;
+    case 'g':
+      _getpid();
+      break;
+    }
+  }
+  sc.ns = uptimens() - t0;
+  close(rfd);
+  name[3] = 'r';
+  unlink(name);
+  write(out, &sc, sizeof(sc));
+  exit(0);
+}
+
+// Count the CPUs, by their idle time lines in the
+// statistics device, which is read to the end in pieces
+// since all of it may not fit in any one buffer.
 int
-main()
+ncpu(void)
 {
+  static char key[] = "#idle ms";
+  char buf[512];
+  int fd, i, n, keep, ncpu;
+
+  if((fd = open("statistics", O_RDONLY)) < 0)
+    return 1;
+  ncpu = keep = 0;
+  while((n = read(fd, buf + keep, sizeof(buf) - keep)) > 0){
+    n += keep;
+    for(i = 0; i + sizeof(key) - 1 <= n; i++)
+      if(memcmp(buf + i, key, sizeof(key) - 1) == 0)
+        ncpu++;
+    // keep too little of the end to hold a whole key.
+    keep = n < sizeof(key) - 2 ? n : sizeof(key) - 2;
+    memmove(buf, buf + n - keep, keep);
+  }
+  close(fd);
+  return ncpu > 0 ? ncpu : 1;
+}
+
+int
+scale(int argc, char *argv[])
+{
+  struct scalecount sc;
+  uint64 total, t0, ns;
+  int i, p[2], nworker, seconds;
+  char *mix, *s;
+
+  nworker = ncpu();  // one worker per CPU by default
+  seconds = 5;
+  mix = SCALEMIX;
+
+  for(i = 2; i + 1 < argc; i += 2){
+    if(strcmp(argv[i], "-n") == 0)
+      nworker = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-t") == 0)
+      seconds = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-m") == 0)
+      mix = argv[i+1];
+    else
+      break;
+  }
+  for(s = mix; *s && strchr(SCALEMIX, *s); s++)
+    ;
+  if(i < argc || nworker < 1 || nworker > 99 || seconds < 1 || !*mix || *s){
+    fprintf(2, "usage: grind -s [-n workers] [-t seconds] [-m %s]\n", SCALEMIX);
+    exit(1);
+  }
+
+  mkdir("grindir");
+  if(chdir("grindir") != 0){
+    printf("grind: chdir grindir failed\n");
+    exit(1);
+  }
+  if(pipe(p) < 0){
+    printf("grind: pipe failed\n");
+    exit(1);
+  }
+  printf("grind: %d workers, %d seconds, mix %s\n", nworker, seconds, mix);
+  t0 = uptimens();
+  for(i = 0; i < nworker; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("grind: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(p[0]);
+      scaleworker(i, mix, seconds, p[1]);
+    }
+  }
+  close(p[1]);
+
+  total = 0;
+  for(i = 0; i < nworker; i++){
+    if(read(p[0], &sc, sizeof(sc)) != sizeof(sc)){
+      printf("grind: worker failed\n");
+      exit(1);
+    }
+    printf("worker %d: %l ops, %l ops/s\n", sc.id, sc.ops,
+           sc.ops * 1000000000 / (sc.ns ? sc.ns : 1));
+    total += sc.ops;
+  }
+  ns = uptimens() - t0;
+  for(i = 0; i < nworker; i++)
+    wait(0);
+  printf("total: %l ops, %l ops/s\n", total,
+         total * 1000000000 / (ns ? ns : 1));
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc > 1 && strcmp(argv[1], "-s") == 0)
+    scale(argc, argv);
+
   while(1){
     int pid = fork();
     if(pid == 0){
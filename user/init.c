@@ -22,6 +22,9 @@ main(void)
   }
   dup(0);  // stdout
   dup(0);  // stderr
+  mknod("statistics", STATS, 0);  // fails harmlessly if it exists
+  mknod("profile", PROFILE, 0);
+  mknod("ktrace", KTRACE, 0);
 
   for(;;){
     printf("init: starting sh\n");
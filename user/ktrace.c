@@ -0,0 +1,110 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/ktrace.h"
+#include "user/user.h"
+
+// ktrace file [command...]
+// write the kernel's trace events to file, one per line:
+//
+//   time cpu pid event a b
+//
+// with time in timer cycles. With a command, throw away the
+// events so far, run it, and write the events up to its
+// end; without, write the events recorded so far. Each CPU's
+// events are in order, but the CPUs' are interleaved only
+// roughly; sort by time for a timeline. ktrace's own events
+// are left out.
+
+char *names[KT_NTYPE] = {
+[KT_LOST]       "lost",
+[KT_SWITCH]     "switch",
+[KT_SYSCALL]    "syscall",
+[KT_SYSRET]     "sysret",
+[KT_BHIT]       "bhit",
+[KT_BMISS]      "bmiss",
+[KT_DISKSTART]  "diskstart",
+[KT_DISKDONE]   "diskdone",
+[KT_COMMIT]     "commit",
+[KT_COMMITDONE] "commitdone",
+};
+
+struct ktevent ev[64];
+
+// write the events read so far to out, or discard them if
+// out is -1.
+void
+drain(int fd, int out)
+{
+  struct ktevent *e;
+  int n, me = getpid();
+
+  while((n = read(fd, ev, sizeof(ev))) > 0){
+    if(out < 0)
+      continue;
+    for(e = ev; e < ev + n / sizeof(ev[0]); e++){
+      if(e->pid == me && e->type != KT_SWITCH)
+        continue;
+      fprintf(out, "%l %d %d %s %l %l\n", e->time, e->cpu, e->pid,
+              e->type < KT_NTYPE ? names[e->type] : "?", e->a, e->b);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct pollfd pfd;
+  int fd, out, p[2], pid;
+
+  if(argc < 2){
+    fprintf(2, "usage: ktrace file [command...]\n");
+    exit(1);
+  }
+  if((fd = open("ktrace", O_RDONLY)) < 0){
+    fprintf(2, "ktrace: cannot open ktrace\n");
+    exit(1);
+  }
+  if((out = open(argv[1], O_CREATE|O_WRONLY|O_TRUNC)) < 0){
+    fprintf(2, "ktrace: cannot create %s\n", argv[1]);
+    exit(1);
+  }
+  if(argc == 2){
+    drain(fd, out);
+    exit(0);
+  }
+
+  // the child holds the pipe's write end, and so do its
+  // children: it hangs up when they're all done.
+  if(pipe(p) < 0){
+    fprintf(2, "ktrace: pipe failed\n");
+    exit(1);
+  }
+  drain(fd, -1);
+  if((pid = fork()) < 0){
+    fprintf(2, "ktrace: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    close(fd);
+    close(out);
+    exec(argv[2], argv + 2);
+    fprintf(2, "ktrace: exec %s failed\n", argv[2]);
+    exit(1);
+  }
+  close(p[1]);
+
+  // keep up with the rings as the command runs.
+  pfd.fd = p[0];
+  pfd.events = POLLIN;
+  do {
+    pfd.revents = 0;
+    poll(&pfd, 1, 100);
+    drain(fd, out);
+  } while(!(pfd.revents & POLLHUP));
+  wait(0);
+  drain(fd, out);
+  exit(0);
+}
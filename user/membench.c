@@ -0,0 +1,56 @@
+// Time memset(), memmove(), memcmp() and strlen() on
+// buffers of a few sizes, aligned and not.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MAXN 65536
+#define TOTAL (4*1024*1024)  // bytes processed per measurement
+
+char a[MAXN + 16], b[MAXN + 16];
+
+// run op on n bytes at offset off until TOTAL bytes are done.
+// returns MB/s.
+static int
+bench(int op, int n, int off)
+{
+  uint64 t0, t;
+  int i, iters = TOTAL / n, sink = 0;
+
+  memset(a, 'x', sizeof(a));
+  memset(b, 'x', sizeof(b));
+  a[off + n - 1] = 0;
+  t0 = uptimens();
+  for(i = 0; i < iters; i++){
+    switch(op){
+    case 0: memset(a + off, 'x', n); break;
+    case 1: memmove(a + off, b, n); break;
+    case 2: sink += memcmp(a + off, b + off, n); break;
+    case 3: sink += strlen(a + off); break;
+    }
+  }
+  t = uptimens() - t0;
+  if(sink == 12345)
+    printf(" ");
+  if(t == 0)
+    t = 1;
+  return (uint64)TOTAL * 1000 / t;  // bytes per ns * 1000 = MB/s
+}
+
+int
+main(int argc, char *argv[])
+{
+  static char *ops[] = { "memset", "memmove", "memcmp", "strlen" };
+  static int sizes[] = { 16, 256, 4096, MAXN };
+  int op, s;
+
+  printf("MB/s      aligned/unaligned by size\n");
+  for(op = 0; op < 4; op++){
+    printf("%s:", ops[op]);
+    for(s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+      printf(" %d:%d/%d", sizes[s], bench(op, sizes[s], 0), bench(op, sizes[s], 1));
+    printf("\n");
+  }
+  exit(0);
+}
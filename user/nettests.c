@@ -0,0 +1,216 @@
+// Tests of the e1000 driver and UDP sockets, run against
+// the host's echo server (make server, in another window).
+//
+// usage: nettests        run the tests
+//        nettests -e     echo packets to port 2000 back to
+//                        whoever sent them (try make ping)
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "kernel/net.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define HOSTIP MAKE_IP_ADDR(10, 0, 2, 2)  // qemu's host
+#define NBATCH 8
+#define REPLY "this is the host!"
+
+// send one packet from sport and check the server's reply.
+static void
+ping(uint16 sport, uint16 dport, int attempts)
+{
+  int fd;
+  char *obuf = "a message from xv6!";
+  char ibuf[128];
+  int n;
+
+  if((fd = connect(HOSTIP, sport, dport)) < 0){
+    fprintf(2, "ping: connect() failed\n");
+    exit(1);
+  }
+
+  for(int i = 0; i < attempts; i++) {
+    if(write(fd, obuf, strlen(obuf)) < 0){
+      fprintf(2, "ping: send() failed\n");
+      exit(1);
+    }
+  }
+
+  n = read(fd, ibuf, sizeof(ibuf)-1);
+  if(n < 0){
+    fprintf(2, "ping: recv() failed\n");
+    exit(1);
+  }
+  ibuf[n] = '\0';
+  if(strcmp(ibuf, REPLY) != 0){
+    fprintf(2, "ping: unexpected reply %s\n", ibuf);
+    exit(1);
+  }
+
+  close(fd);
+}
+
+// NBATCH packets with one writev(), and their replies with
+// readv(), each packet to a buffer of its own.
+static void
+batch(uint16 sport, uint16 dport)
+{
+  static char ibuf[NBATCH][128];
+  struct iovec iov[NBATCH];
+  struct pollfd pfd;
+  char *obuf = "a batch from xv6!";
+  int fd, i, n, got;
+
+  if((fd = connect(HOSTIP, sport, dport)) < 0){
+    fprintf(2, "batch: connect() failed\n");
+    exit(1);
+  }
+  for(i = 0; i < NBATCH; i++){
+    iov[i].iov_base = obuf;
+    iov[i].iov_len = strlen(obuf);
+  }
+  if(writev(fd, iov, NBATCH) != NBATCH * strlen(obuf)){
+    fprintf(2, "batch: writev() failed\n");
+    exit(1);
+  }
+
+  for(got = 0; got < NBATCH; got += n / strlen(REPLY)){
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, 5000) != 1){
+      fprintf(2, "batch: only %d replies\n", got);
+      exit(1);
+    }
+    for(i = 0; i < NBATCH - got; i++){
+      iov[i].iov_base = ibuf[i];
+      iov[i].iov_len = sizeof(ibuf[i]);
+    }
+    if((n = readv(fd, iov, NBATCH - got)) <= 0 || n % strlen(REPLY) != 0){
+      fprintf(2, "batch: readv() failed\n");
+      exit(1);
+    }
+    for(i = 0; i < n / strlen(REPLY); i++){
+      if(memcmp(ibuf[i], REPLY, strlen(REPLY)) != 0){
+        fprintf(2, "batch: unexpected reply\n");
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+}
+
+// receive the reply by having its page mapped.
+static void
+zerocopy(uint16 sport, uint16 dport)
+{
+  char *obuf = "a message from xv6!";
+  char *page;
+  int fd, i, n, off;
+
+  if((fd = connect(HOSTIP, sport, dport)) < 0){
+    fprintf(2, "zerocopy: connect() failed\n");
+    exit(1);
+  }
+  page = sbrk(2*PGSIZE);
+  page = (char*)PGROUNDUP((uint64)page);
+  page[0] = 0;
+  if(write(fd, obuf, strlen(obuf)) < 0){
+    fprintf(2, "zerocopy: send() failed\n");
+    exit(1);
+  }
+  if((n = recvpage(fd, page, &off)) != strlen(REPLY) ||
+     off < 0 || off + n > PGSIZE || memcmp(page + off, REPLY, n) != 0){
+    fprintf(2, "zerocopy: recvpage() failed\n");
+    exit(1);
+  }
+  // nothing but the payload may be left in the page.
+  for(i = 0; i < PGSIZE; i++){
+    if((i < off || i >= off + n) && page[i] != 0){
+      fprintf(2, "zerocopy: stale byte at %d\n", i);
+      exit(1);
+    }
+  }
+  // the page is the user's now.
+  page[off] = 'T';
+  if(recvpage(fd, page + 1, &off) >= 0){
+    fprintf(2, "zerocopy: unaligned recvpage() succeeded\n");
+    exit(1);
+  }
+  close(fd);
+}
+
+// Echo each packet received on port 2000, without copying
+// it in.
+static void
+echo(void)
+{
+  char *page;
+  int fd, n, off;
+
+  if((fd = connect(0, 2000, 0)) < 0){
+    fprintf(2, "echo: connect() failed\n");
+    exit(1);
+  }
+  page = sbrk(2*PGSIZE);
+  page = (char*)PGROUNDUP((uint64)page);
+  page[0] = 0;
+  printf("nettests: echoing port 2000\n");
+  for(;;){
+    if((n = recvpage(fd, page, &off)) < 0){
+      fprintf(2, "echo: recvpage() failed\n");
+      exit(1);
+    }
+    if(write(fd, page + off, n) != n){
+      fprintf(2, "echo: send() failed\n");
+      exit(1);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, ret;
+  uint16 dport = NET_TESTS_PORT;
+
+  if(argc > 1 && strcmp(argv[1], "-e") == 0)
+    echo();
+
+  printf("nettests running on port %d\n", dport);
+
+  printf("testing ping: ");
+  ping(2000, dport, 1);
+  printf("OK\n");
+
+  printf("testing single-process pings: ");
+  for (i = 0; i < 100; i++)
+    ping(2000, dport, 1);
+  printf("OK\n");
+
+  printf("testing multi-process pings: ");
+  for (i = 0; i < 10; i++){
+    int pid = fork();
+    if (pid == 0){
+      ping(2000 + i + 1, dport, 1);
+      exit(0);
+    }
+  }
+  for (i = 0; i < 10; i++){
+    wait(&ret);
+    if (ret != 0)
+      exit(1);
+  }
+  printf("OK\n");
+
+  printf("testing batched pings: ");
+  batch(2100, dport);
+  printf("OK\n");
+
+  printf("testing zero-copy receive: ");
+  zerocopy(2200, dport);
+  printf("OK\n");
+
+  printf("all tests passed.\n");
+  exit(0);
+}
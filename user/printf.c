@@ -1,15 +1,109 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
 #include "user/user.h"
 
 #include <stdarg.h>
 
+//
+// printf() output is buffered per fd, rather than written a
+// character at a time. By default, output to the console is
+// written out at each newline, output to files and pipes when
+// the buffer fills, and output to fds other than 1 at the end
+// of each printf(). setvbuf() changes an fd's mode. fflush(),
+// fork(), exec(), exit(), and reading with getc() write out
+// the buffers.
+//
+
+#define OBUFSZ 512
+
+static struct {
+  char buf[OBUFSZ];
+  int n;     // bytes in buf
+  int mode;  // _IONBF, _IOLBF, _IOFBF, or 0 if not yet chosen
+} out[NOFILE];
+
+extern void (*stdioflush)(void);
+
 static char digits[] = "0123456789ABCDEF";
 
+static void
+flushall(void)
+{
+  fflush(-1);
+}
+
+// Write out fd's buffered output; all fds if fd is -1.
+// Returns 0, or -1 if a write failed, losing the output.
+int
+fflush(int fd)
+{
+  int i, n, r;
+
+  if(fd == -1){
+    r = 0;
+    for(i = 0; i < NOFILE; i++){
+      if(out[i].n > 0 && fflush(i) < 0)
+        r = -1;
+    }
+    return r;
+  }
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+
+  r = 0;
+  for(i = 0; i < out[fd].n; i += n){
+    if((n = write(fd, out[fd].buf + i, out[fd].n - i)) <= 0){
+      r = -1;
+      break;
+    }
+  }
+  out[fd].n = 0;
+  return r;
+}
+
+// Set fd's buffering mode, after writing out what's buffered.
+// Returns 0, or -1 for a bad fd or mode.
+int
+setvbuf(int fd, int mode)
+{
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  if(mode != _IONBF && mode != _IOLBF && mode != _IOFBF)
+    return -1;
+  fflush(fd);
+  out[fd].mode = mode;
+  return 0;
+}
+
+// fd's buffering mode, choosing the default on first use.
+static int
+bufmode(int fd)
+{
+  struct stat st;
+
+  if(out[fd].mode == 0){
+    if(fd != 1)
+      out[fd].mode = _IONBF;
+    else if(fstat(fd, &st) == 0 && st.type == T_DEVICE)
+      out[fd].mode = _IOLBF;
+    else
+      out[fd].mode = _IOFBF;
+    stdioflush = flushall;
+  }
+  return out[fd].mode;
+}
+
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  if(fd < 0 || fd >= NOFILE){
+    write(fd, &c, 1);
+    return;
+  }
+  out[fd].buf[out[fd].n++] = c;
+  if(out[fd].n == OBUFSZ || (c == '\n' && bufmode(fd) == _IOLBF))
+    fflush(fd);
 }
 
 static void
@@ -92,6 +186,8 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  if(fd >= 0 && fd < NOFILE && bufmode(fd) == _IONBF)
+    fflush(fd);
 }
 
 void
@@ -0,0 +1,97 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+// prof [-c cycles] cmd args...
+// run cmd, sampling every CPU's call stack every cycles
+// timer cycles (default 10000, a millisecond), and print the
+// samples, one per line, outermost call first:
+//
+//   prof name pc pc ...
+//
+// user PCs, then kernel ones (0x80000000 and up). prof-xv6
+// turns them into symbols and folded stacks.
+
+#define CYCLES 10000
+
+struct profsample samples[32];
+
+// print the samples read so far.
+void
+drain(int fd)
+{
+  struct profsample *s;
+  int n, i;
+
+  while((n = read(fd, samples, sizeof(samples))) > 0){
+    for(s = samples; s < samples + n / sizeof(samples[0]); s++){
+      printf("prof %s", s->pid ? s->name : "-");
+      for(i = s->nk + s->nu - 1; i >= s->nk; i--)
+        printf(" %p", s->pc[i]);
+      for(i = s->nk - 1; i >= 0; i--)
+        printf(" %p", s->pc[i]);
+      printf("\n");
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct pollfd pfd;
+  int cycles, fd, p[2], pid, dropped;
+
+  cycles = CYCLES;
+  if(argc > 2 && strcmp(argv[1], "-c") == 0){
+    cycles = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < 2 || cycles <= 0){
+    fprintf(2, "usage: prof [-c cycles] command...\n");
+    exit(1);
+  }
+  if((fd = open("profile", O_RDONLY)) < 0){
+    fprintf(2, "prof: cannot open profile\n");
+    exit(1);
+  }
+
+  // the child holds the pipe's write end, and so do its
+  // children: it hangs up when they're all done.
+  if(pipe(p) < 0){
+    fprintf(2, "prof: pipe failed\n");
+    exit(1);
+  }
+  profile(cycles);
+  if((pid = fork()) < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    close(fd);
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  close(p[1]);
+
+  // empty the kernel's buffers as the command runs.
+  pfd.fd = p[0];
+  pfd.events = POLLIN;
+  do {
+    pfd.revents = 0;
+    poll(&pfd, 1, 100);
+    drain(fd);
+  } while(!(pfd.revents & POLLHUP));
+  wait(0);
+  drain(fd);
+
+  dropped = profile(0);
+  if(dropped > 0)
+    fprintf(2, "prof: %d samples dropped\n", dropped);
+  exit(0);
+}
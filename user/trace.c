@@ -0,0 +1,37 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// trace mask cmd args...
+// run cmd, timing the system calls in mask (as 1L<<SYS_...);
+// the stats program shows the counts and latencies.
+int
+main(int argc, char *argv[])
+{
+  int i;
+  char *nargv[MAXARG], *s;
+  uint64 mask;
+
+  if(argc < 3 || (argv[1][0] < '0' || argv[1][0] > '9')){
+    fprintf(2, "usage: trace mask command...\n");
+    exit(1);
+  }
+
+  // atoi() stops at 31 bits, and there are more system calls.
+  mask = 0;
+  for(s = argv[1]; *s >= '0' && *s <= '9'; s++)
+    mask = mask*10 + *s - '0';
+  if(trace(mask) < 0){
+    fprintf(2, "trace: trace failed\n");
+    exit(1);
+  }
+
+  for(i = 2; i < argc && i < MAXARG; i++){
+    nargv[i-2] = argv[i];
+  }
+  nargv[i-2] = 0;
+  exec(nargv[0], nargv);
+  fprintf(2, "trace: exec %s failed\n", nargv[0]);
+  exit(1);
+}
@@ -1,8 +1,23 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
+// set by printf.c to a function that writes out its
+// buffers, once it has buffered something. a pointer, so
+// that programs linked without printf.c don't need it.
+void (*stdioflush)(void);
+
+static void
+flushall(void)
+{
+  if(stdioflush)
+    stdioflush();
+}
+
 //
 // wrapper so that it's OK if main() does not call exit().
 //
@@ -14,6 +29,83 @@ _main()
   exit(0);
 }
 
+// fork(), exit() and exec() write out buffered output
+// first, so that it isn't lost, or printed twice by both
+// parent and child.
+int
+fork(void)
+{
+  flushall();
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  flushall();
+  _exit(status);
+}
+
+int
+exec(const char *path, char **argv)
+{
+  flushall();
+  return _exec(path, argv);
+}
+
+// getpid(), uptime() and uptimens() read the page the
+// kernel shares at USYSCALL, and the time CSR, without
+// trapping into the kernel.
+int
+getpid(void)
+{
+  return ((struct usyscall *)USYSCALL)->pid;
+}
+
+int
+uptime(void)
+{
+  return r_time() / ((struct usyscall *)USYSCALL)->tickcycles;
+}
+
+uint64
+uptimens(void)
+{
+  return r_time() * (1000000000 / ((struct usyscall *)USYSCALL)->timefreq);
+}
+
+// where a thread finds its function and argument: at the
+// top of its stack, just above the stack pointer.
+struct threadstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static void
+threadstart(void *a)
+{
+  struct threadstart *t = a;
+
+  t->fn(t->arg);
+  // printf()'s buffers belong to the process, which
+  // writes them out when it exits.
+  _exit(0);
+}
+
+// Start a thread running fn(arg), sharing this process's
+// memory, on the stack whose highest address is stack.
+// It exits when fn returns. Returns its pid, for join().
+int
+clone(void (*fn)(void*), void *arg, void *stack)
+{
+  struct threadstart *t;
+
+  t = (struct threadstart *)(((uint64)stack & ~15) - 16);
+  t->fn = fn;
+  t->arg = arg;
+  return _clone(threadstart, t, t);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -33,27 +125,90 @@ strcmp(const char *p, const char *q)
   return (uchar)*p - (uchar)*q;
 }
 
+// memset(), memcmp(), memmove(), memchr() and strlen() work
+// a 64-bit word at a time on the aligned middle of their
+// buffers, and a byte at a time on the head and tail, like the
+// kernel's in kernel/string.c.
+
+typedef uint64 __attribute__((__may_alias__)) word;
+#define WSIZE sizeof(word)
+#define ALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+#define COALIGNED(p, q) ((((uint64)(p) ^ (uint64)(q)) & (WSIZE-1)) == 0)
+// non-zero if a byte of w is zero.
+#define HASZERO(w) (((w) - 0x0101010101010101UL) & ~(w) & 0x8080808080808080UL)
+
 uint
 strlen(const char *s)
 {
-  int n;
+  const char *p = s;
+  const word *w;
 
-  for(n = 0; s[n]; n++)
+  for(; !ALIGNED(p); p++){
+    if(*p == 0)
+      return p - s;
+  }
+  // aligned words never cross into the next page.
+  for(w = (const word *) p; !HASZERO(*w); w++)
     ;
-  return n;
+  for(p = (const char *) w; *p; p++)
+    ;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  word w, *wdst;
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+  wdst = (word *) cdst;
+  for(; n >= 4*WSIZE; n -= 4*WSIZE, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
   }
+  for(; n >= WSIZE; n -= WSIZE)
+    *wdst++ = w;
+
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
+void*
+memchr(const void *s, int c, uint n)
+{
+  const uchar *p = (const uchar *) s;
+  const word *w;
+  word cw;
+
+  for(; n > 0 && !ALIGNED(p); n--, p++)
+    if(*p == (uchar)c)
+      return (void*)p;
+
+  cw = (uchar)c;
+  cw |= cw << 8;
+  cw |= cw << 16;
+  cw |= cw << 32;
+  // a byte of *w ^ cw is zero where *w holds c.
+  for(w = (const word *) p; n >= WSIZE && !HASZERO(*w ^ cw); n -= WSIZE)
+    w++;
+
+  for(p = (const uchar *) w; n > 0; n--, p++)
+    if(*p == (uchar)c)
+      return (void*)p;
+  return 0;
+}
+
 char*
 strchr(const char *s, char c)
 {
@@ -63,15 +218,44 @@ strchr(const char *s, char c)
   return 0;
 }
 
+// input buffers for getc(), one per fd.
+#define IBUFSZ 512
+static struct {
+  char buf[IBUFSZ];
+  int n;    // bytes in buf
+  int off;  // bytes of buf already returned
+} in[NOFILE];
+
+// Return the next byte from fd, or -1 at end of file
+// or on error. Reads up to IBUFSZ bytes at a time, so
+// don't mix with read() on the same fd.
+int
+getc(int fd)
+{
+  char c;
+  int n;
+
+  if(fd < 0 || fd >= NOFILE)
+    return read(fd, &c, 1) == 1 ? (uchar)c : -1;
+
+  if(in[fd].off == in[fd].n){
+    // show any prompt before waiting for input.
+    flushall();
+    if((n = read(fd, in[fd].buf, IBUFSZ)) <= 0)
+      return -1;
+    in[fd].n = n;
+    in[fd].off = 0;
+  }
+  return (uchar)in[fd].buf[in[fd].off++];
+}
+
 char*
 gets(char *buf, int max)
 {
-  int i, cc;
-  char c;
+  int i, c;
 
   for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
+    if((c = getc(0)) < 0)
       break;
     buf[i++] = c;
     if(c == '\n' || c == '\r')
@@ -112,14 +296,37 @@ memmove(void *vdst, const void *vsrc, int n)
   char *dst;
   const char *src;
 
+  if(n <= 0)
+    return vdst;
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    if(COALIGNED(src, dst)){
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *dst++ = *src++;
+      for(; n >= 4*WSIZE; n -= 4*WSIZE, dst += 4*WSIZE, src += 4*WSIZE){
+        ((word *)dst)[0] = ((word *)src)[0];
+        ((word *)dst)[1] = ((word *)src)[1];
+        ((word *)dst)[2] = ((word *)src)[2];
+        ((word *)dst)[3] = ((word *)src)[3];
+      }
+      for(; n >= WSIZE; n -= WSIZE, dst += WSIZE, src += WSIZE)
+        *(word *)dst = *(word *)src;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(COALIGNED(src, dst)){
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *--dst = *--src;
+      for(; n >= WSIZE; n -= WSIZE){
+        dst -= WSIZE;
+        src -= WSIZE;
+        *(word *)dst = *(word *)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -130,6 +337,17 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if(COALIGNED(p1, p2)){
+    for(; n > 0 && !ALIGNED(p1); n--, p1++, p2++){
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    }
+    // the bytes of the first unequal word are compared below.
+    for(; n >= WSIZE && *(word *)p1 == *(word *)p2; n -= WSIZE){
+      p1 += WSIZE;
+      p2 += WSIZE;
+    }
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -3,8 +3,19 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
+// Memory allocator.
+//
+// Small blocks, up to 2048 bytes with their header, come from
+// one free list per power-of-two size class, so malloc() and
+// free() of them are a pop and a push. An empty list is
+// refilled by carving a slab obtained from sbrk() into blocks
+// of its class; slabs are never given back.
+//
+// Larger blocks use the allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
+//
+// Every block starts with a Header. A small block's s.size
+// holds SMALL and its class rather than a size in units.
 
 typedef long Align;
 
@@ -21,12 +32,64 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
+#define MINSHIFT 5              // smallest class holds 32 bytes
+#define NCLASS 7                // ... and the largest 2048
+#define CLASSSIZE(c) (1 << ((c) + MINSHIFT))
+#define SLABSIZE 4096
+#define SMALL 0x80000000
+
+static Header *classfree[NCLASS];
+
+// The size class of a block holding nbytes,
+// or -1 if it's too big for one.
+static int
+sizeclass(uint nbytes)
+{
+  int c;
+
+  for(c = 0; c < NCLASS; c++){
+    if(nbytes <= CLASSSIZE(c) - sizeof(Header))
+      return c;
+  }
+  return -1;
+}
+
+// Carve a new slab into blocks of class c.
+// Returns 0, or -1 if out of memory.
+static int
+refill(int c)
+{
+  char *p;
+  Header *hp;
+  int i;
+
+  p = sbrk(SLABSIZE);
+  if(p == (char*)-1)
+    return -1;
+  for(i = 0; i + CLASSSIZE(c) <= SLABSIZE; i += CLASSSIZE(c)){
+    hp = (Header*)(p + i);
+    hp->s.size = SMALL | c;
+    hp->s.ptr = classfree[c];
+    classfree[c] = hp;
+  }
+  return 0;
+}
+
 void
 free(void *ap)
 {
   Header *bp, *p;
+  int c;
 
+  if(ap == 0)
+    return;
   bp = (Header*)ap - 1;
+  if(bp->s.size & SMALL){
+    c = bp->s.size & ~SMALL;
+    bp->s.ptr = classfree[c];
+    classfree[c] = bp;
+    return;
+  }
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -65,6 +128,15 @@ malloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
+  int c;
+
+  if((c = sizeclass(nbytes)) >= 0){
+    if(classfree[c] == 0 && refill(c) < 0)
+      return 0;
+    p = classfree[c];
+    classfree[c] = p->s.ptr;
+    return (void*)(p + 1);
+  }
 
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
@@ -88,3 +160,29 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// Resize the block at ap to hold nbytes, moving it if it has
+// to grow. Returns the block, or 0 (leaving ap alone) if out
+// of memory. realloc(0, n) is malloc(n).
+void*
+realloc(void *ap, uint nbytes)
+{
+  Header *bp;
+  uint have;
+  void *np;
+
+  if(ap == 0)
+    return malloc(nbytes);
+  bp = (Header*)ap - 1;
+  if(bp->s.size & SMALL)
+    have = CLASSSIZE(bp->s.size & ~SMALL) - sizeof(Header);
+  else
+    have = (bp->s.size - 1) * sizeof(Header);
+  if(nbytes <= have)
+    return ap;
+  if((np = malloc(nbytes)) == 0)
+    return 0;
+  memmove(np, ap, have);
+  free(ap);
+  return np;
+}
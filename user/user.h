@@ -1,4 +1,7 @@
 struct stat;
+struct iovec;
+struct pollfd;
+struct dirstat;
 
 // system calls
 int fork(void);
@@ -22,20 +25,88 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int setpriority(int, int);
+void *mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+uint64 uptimens(void);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int fsync(int);
+int trace(uint64);
+int join(int*);
+int futexwait(int*, int);
+int futexwake(int*, int);
+int getdents(int, struct dirstat*, int);
+int spawn(const char*, char**, int*, int);
+int poll(struct pollfd*, int, int);
+int connect(uint32, uint16, uint16);
+int recvpage(int, void*, int*);
+int profile(int);
+void *shmcreate(char*, int);
+void *shmattach(char*, int*);
+int openat(int, const char*, int);
+
+// the raw fork, exit and exec system calls, which
+// don't flush printf()'s buffers.
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _exec(const char*, char**);
+
+// the getpid, uptime and uptimens system calls, which
+// ulib.c answers from the usyscall page instead.
+int _getpid(void);
+int _uptime(void);
+uint64 _uptimens(void);
+
+// the clone system call, for ulib.c's clone().
+int _clone(void (*)(void*), void*, void*);
 
 // ulib.c
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
+void* memchr(const void*, int, uint);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
+int fflush(int);
+int setvbuf(int, int);
+int getc(int);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
+void* realloc(void*, uint);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int clone(void (*)(void*), void*, void*);
+
+// buffering modes for setvbuf().
+#define _IONBF 1  // write out at the end of each printf()
+#define _IOLBF 2  // write out at each newline
+#define _IOFBF 3  // write out when the buffer fills
+
+// statistics.c
+int statistics(void*, int);
+
+// usync.c: locks for threads, which sleep in the kernel
+// only when contended.
+struct mutex {
+  int state;    // 0 unlocked, 1 locked, 2 locked with waiters
+};
+struct cond {
+  int seq;      // bumped by each signal
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
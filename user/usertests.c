@@ -7,6 +7,9 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/prof.h"
+#include "kernel/ktrace.h"
+#include "kernel/elf.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -785,6 +788,69 @@ pipe1(char *s)
   }
 }
 
+// page-aligned pipe transfers move whole pages between the
+// writer and reader; check that neither side's later writes
+// leak into the data the other sees.
+void
+pipepage(char *s)
+{
+  enum { NPG=12 };
+  int fds[2], pid, xstatus, n, i, j;
+  char *a, *b;
+
+  a = sbrk(0);
+  a = sbrk(2*NPG*4096 + (4096 - ((uint64)a % 4096)));
+  if(a == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)(((uint64)a + 4095) & ~4095);
+  b = a + NPG*4096;
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < NPG*4096; i++)
+      a[i] = i / 4096;
+    if(write(fds[1], a, NPG*4096) != NPG*4096){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    // scribble on the pages the pipe may still hold.
+    for(i = 0; i < NPG*4096; i++)
+      a[i] = 0xff;
+    exit(0);
+  }
+  close(fds[1]);
+  memset(b, 0, NPG*4096);
+  for(i = 0; i < NPG*4096; i += n){
+    n = read(fds[0], b + i, NPG*4096 - i);
+    if(n <= 0){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(i = 0; i < NPG; i++){
+    for(j = 0; j < 4096; j++){
+      if(b[i*4096+j] != i){
+        printf("%s: wrong data in page %d\n", s, i);
+        exit(1);
+      }
+    }
+    b[i*4096] = 0;  // received pages must be writable
+  }
+  close(fds[0]);
+}
 
 // test if child is killed (status = -1)
 void
@@ -2421,6 +2487,109 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// exec passes MAXARG-1 arguments, more than fit on the
+// stack page, intact.
+void
+manyargs(char *s)
+{
+  static char *args[MAXARG];
+  static char arg[41];
+  int fds[2], pid, i, n, total, xstatus;
+
+  memset(arg, 'a', sizeof(arg) - 1);
+  args[0] = "echo";
+  for(i = 1; i < MAXARG-1; i++)
+    args[i] = arg;
+  args[MAXARG-1] = 0;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    dup(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    exec("echo", args);
+    printf("%s: exec failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++, total++){
+      // each argument, then a space or the final newline.
+      if(total % 41 == 40 ? buf[i] != ' ' && buf[i] != '\n' : buf[i] != 'a'){
+        printf("%s: wrong byte %d\n", s, total);
+        exit(1);
+      }
+    }
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || total != (MAXARG-2) * 41){
+    printf("%s: echo wrote %d bytes\n", s, total);
+    exit(1);
+  }
+}
+
+// exec a program loaded into the top gigabyte of the
+// address space, whose page tables an exec() from a small
+// process would otherwise take from the old image.
+void
+topexec(char *s)
+{
+  static char file[PGSIZE + 12];
+  struct elfhdr *elf = (struct elfhdr*)file;
+  struct proghdr *ph = (struct proghdr*)(file + sizeof(*elf));
+  uint32 *code = (uint32*)(file + PGSIZE);
+  char *args[] = { "topelf", 0 };
+  int fd, pid, xstatus;
+
+  elf->magic = ELF_MAGIC;
+  elf->entry = UTOPTABLE;
+  elf->phoff = sizeof(*elf);
+  elf->phentsize = sizeof(*ph);
+  elf->phnum = 1;
+  ph->type = ELF_PROG_LOAD;
+  ph->flags = ELF_PROG_FLAG_READ | ELF_PROG_FLAG_EXEC;
+  ph->off = PGSIZE;
+  ph->vaddr = UTOPTABLE;
+  ph->filesz = 12;
+  ph->memsz = PGSIZE;
+  code[0] = 0x00700513;  // li a0, 7
+  code[1] = 0x00200893;  // li a7, SYS_exit
+  code[2] = 0x00000073;  // ecall
+
+  if((fd = open("topelf", O_CREATE|O_WRONLY)) < 0 ||
+     write(fd, file, sizeof(file)) != sizeof(file)){
+    printf("%s: create topelf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    exec("topelf", args);
+    printf("%s: exec topelf failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  unlink("topelf");
+  if(xstatus != 7){
+    printf("%s: topelf exited with %d\n", s, xstatus);
+    exit(1);
+  }
+}
+
 // check that writes to text segment fault
 void
 textwrite(char *s)
@@ -2555,143 +2724,1402 @@ sbrk8000(char *s)
 }
 
 
-
-// regression test. test whether exec() leaks memory if one of the
-// arguments is invalid. the test passes if the kernel doesn't panic.
+// sbrk() far more than physical memory and touch only a few
+// pages: from user code, through fork, and via read()'s copyout.
+// only works if sbrk allocates lazily.
 void
-badarg(char *s)
+sbrklazy(char *s)
 {
-  for(int i = 0; i < 50000; i++){
-    char *argv[2];
-    argv[0] = (char*)0xffffffff;
-    argv[1] = 0;
-    exec("echo", argv);
-  }
-  
-  exit(0);
-}
+  enum { BIG=1024*1024*1024, STEP=64*1024*1024 };
+  char *a, *q;
+  int fd, pid, xstatus;
 
-struct test {
-  void (*f)(char *);
-  char *s;
-} quicktests[] = {
-  {copyin, "copyin"},
-  {copyout, "copyout"},
-  {copyinstr1, "copyinstr1"},
-  {copyinstr2, "copyinstr2"},
-  {copyinstr3, "copyinstr3"},
-  {rwsbrk, "rwsbrk" },
-  {truncate1, "truncate1"},
-  {truncate2, "truncate2"},
-  {truncate3, "truncate3"},
-  {openiputtest, "openiput"},
-  {exitiputtest, "exitiput"},
-  {iputtest, "iput"},
-  {opentest, "opentest"},
-  {writetest, "writetest"},
-  {writebig, "writebig"},
-  {createtest, "createtest"},
-  {dirtest, "dirtest"},
-  {exectest, "exectest"},
-  {pipe1, "pipe1"},
-  {killstatus, "killstatus"},
-  {preempt, "preempt"},
-  {exitwait, "exitwait"},
-  {reparent, "reparent" },
-  {twochildren, "twochildren"},
-  {forkfork, "forkfork"},
-  {forkforkfork, "forkforkfork"},
-  {reparent2, "reparent2"},
-  {mem, "mem"},
-  {sharedfd, "sharedfd"},
-  {fourfiles, "fourfiles"},
-  {createdelete, "createdelete"},
-  {unlinkread, "unlinkread"},
-  {linktest, "linktest"},
-  {concreate, "concreate"},
-  {linkunlink, "linkunlink"},
-  {subdir, "subdir"},
-  {bigwrite, "bigwrite"},
-  {bigfile, "bigfile"},
-  {fourteen, "fourteen"},
-  {rmdot, "rmdot"},
-  {dirfile, "dirfile"},
-  {iref, "iref"},
-  {forktest, "forktest"},
-  {sbrkbasic, "sbrkbasic"},
-  {sbrkmuch, "sbrkmuch"},
-  {kernmem, "kernmem"},
-  {MAXVAplus, "MAXVAplus"},
-  {sbrkfail, "sbrkfail"},
-  {sbrkarg, "sbrkarg"},
-  {validatetest, "validatetest"},
-  {bsstest, "bsstest"},
-  {bigargtest, "bigargtest"},
-  {argptest, "argptest"},
-  {stacktest, "stacktest"},
-  {textwrite, "textwrite"},
-  {pgbug, "pgbug" },
-  {sbrkbugs, "sbrkbugs" },
-  {sbrklast, "sbrklast"},
-  {sbrk8000, "sbrk8000"},
-  {badarg, "badarg" },
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(q = a; q < a + BIG; q += STEP)
+    *q = 'x';
 
-  { 0, 0},
-};
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(q = a; q < a + BIG; q += STEP){
+      if(*q != 'x' || q[PGSIZE] != 0){
+        printf("%s: child saw wrong data\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
 
-//
-// Section with tests that take a fair bit of time
-//
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  // 2000 bytes straddling two untouched pages.
+  q = a + BIG - PGSIZE - 1000;
+  if(read(fd, q, 2000) != 2000){
+    printf("%s: read into lazy pages failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  sbrk(-BIG);
+}
 
-// directory that uses indirect blocks
+// an aligned 2MB of fresh heap is mapped with a superpage;
+// check that splitting it, for a copy-on-write fault and for
+// a partial sbrk() shrink, keeps each page's contents.
 void
-bigdir(char *s)
+superpage(char *s)
 {
-  enum { N = 500 };
-  int i, fd;
-  char name[10];
+  enum { SZ=6*1024*1024, SUPER=2*1024*1024 };
+  char *a, *b, *q;
+  int pid, xstatus;
 
-  unlink("bd");
+  a = sbrk(SZ);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  b = (char*)(((uint64)a + SUPER - 1) & ~(SUPER - 1));
+  for(q = b; q < b + SUPER; q += PGSIZE)
+    *(int*)q = q - b;
 
-  fd = open("bd", O_CREATE);
-  if(fd < 0){
-    printf("%s: bigdir create failed\n", s);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    b[SUPER/2] = 1;
+    for(q = b; q < b + SUPER; q += PGSIZE){
+      if(q != b + SUPER/2 && *(int*)q != q - b){
+        printf("%s: child saw wrong data\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(*(int*)(b + SUPER/2) != SUPER/2){
+    printf("%s: child write leaked into parent\n", s);
     exit(1);
   }
-  close(fd);
 
-  for(i = 0; i < N; i++){
-    name[0] = 'x';
-    name[1] = '0' + (i / 64);
-    name[2] = '0' + (i % 64);
-    name[3] = '\0';
-    if(link("bd", name) != 0){
-      printf("%s: bigdir link(bd, %s) failed\n", s, name);
+  // cut the heap in the middle of the superpage.
+  sbrk(-((a + SZ) - (b + SUPER/2)));
+  for(q = b; q < b + SUPER/2; q += PGSIZE){
+    if(*(int*)q != q - b){
+      printf("%s: shrink lost data\n", s);
       exit(1);
     }
   }
+  sbrk(-(b + SUPER/2 - a));
+}
 
-  unlink("bd");
-  for(i = 0; i < N; i++){
-    name[0] = 'x';
-    name[1] = '0' + (i / 64);
-    name[2] = '0' + (i % 64);
-    name[3] = '\0';
-    if(unlink(name) != 0){
-      printf("%s: bigdir unlink failed", s);
+// fork a process that is using more than half of physical
+// memory. only works if fork shares pages copy-on-write.
+// the child's writes must not be visible to the parent.
+void
+cowfork(char *s)
+{
+  enum { SZ=80*1024*1024 };
+  char *a, *q;
+  int pid, ppid, xstatus;
+
+  a = sbrk(SZ);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  ppid = getpid();
+  for(q = a; q < a + SZ; q += 4096)
+    *(int*)q = ppid;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(q = a; q < a + SZ; q += 4096){
+      if(*(int*)q != ppid){
+        printf("%s: child saw wrong data\n", s);
+        exit(1);
+      }
+    }
+    for(q = a; q < a + SZ; q += 1024*1024)
+      *(int*)q = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(q = a; q < a + SZ; q += 4096){
+    if(*(int*)q != ppid){
+      printf("%s: child write leaked into parent\n", s);
       exit(1);
     }
   }
+  sbrk(-SZ);
 }
 
-// concurrent writes to try to provoke deadlock in the virtio disk
-// driver.
+// setpriority() rejects bad levels and pids, and a
+// process at the lowest level still gets to run.
 void
-manywrites(char *s)
+setprio(char *s)
 {
-  int nchildren = 4;
-  int howmany = 30; // increase to look for deadlock
-  
+  int pid, xstatus;
+
+  if(setpriority(0, -1) != -1 || setpriority(0, 1000) != -1){
+    printf("%s: setpriority accepted a bad level\n", s);
+    exit(1);
+  }
+  if(setpriority(0x7fffffff, 0) != -1){
+    printf("%s: setpriority accepted a bad pid\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(setpriority(0, 2) != 0)
+      exit(1);
+    for(volatile int i = 0; i < 10000000; i++)
+      ;
+    exit(0);
+  }
+  if(setpriority(pid, 2) != 0){
+    printf("%s: setpriority of child failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: low priority child failed\n", s);
+    exit(1);
+  }
+  if(setpriority(0, 0) != 0){
+    printf("%s: setpriority of self failed\n", s);
+    exit(1);
+  }
+}
+
+// a MAP_PRIVATE mapping reads what read() does and its writes
+// stay private; a MAP_SHARED mapping's writes reach the file
+// on munmap() or exit(), the child's as well as the parent's,
+// and so do the kernel's, e.g. by read() into the mapping.
+void
+mmapfile(char *s)
+{
+  enum { SZ=2*PGSIZE+100 };
+  char *file = "mmapfile";
+  char *p, *buf;
+  int fd, i, pid, xstatus, fds[2];
+
+  buf = sbrk(SZ);
+  fd = open(file, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 251;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(p[i] != buf[i]){
+      printf("%s: mapped byte %d wrong\n", s, i);
+      exit(1);
+    }
+  }
+  if(p[SZ] != 0){
+    printf("%s: past end of file not zero\n", s);
+    exit(1);
+  }
+  p[0] = 'x';
+  if(munmap(p, SZ) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  if(p[0] != buf[0]){
+    printf("%s: private write reached the file\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[PGSIZE] = 'y';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  p[1] = 'z';
+  if(pipe(fds) < 0 || write(fds[1], "kernel", 6) != 6 ||
+     read(fds[0], p + 2*PGSIZE, 6) != 6){
+    printf("%s: read into mapping failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(munmap(p, SZ) != 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open(file, O_RDONLY);
+  if(fd < 0 || read(fd, buf, SZ) != SZ){
+    printf("%s: reread failed\n", s);
+    exit(1);
+  }
+  if(buf[1] != 'z' || buf[PGSIZE] != 'y' || memcmp(buf + 2*PGSIZE, "kernel", 6) != 0){
+    printf("%s: shared write not in the file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(file);
+  sbrk(-SZ);
+}
+
+// sleepers wake in deadline order, not start order, and
+// uptimens() moves forward across a sleep.
+void
+sleepq(char *s)
+{
+  int fds[2], i, pid, xstatus;
+  uint64 t0, t1;
+  char c;
+
+  t0 = uptimens();
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      sleep(2 * (3 - i));
+      c = '0' + i;
+      write(fds[1], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  for(i = 2; i >= 0; i--){
+    if(read(fds[0], &c, 1) != 1 || c != '0' + i){
+      printf("%s: sleepers woke out of order\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  for(i = 0; i < 3; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  t1 = uptimens();
+  if(t1 <= t0 || t1 - t0 < 100000000ULL){
+    printf("%s: uptimens didn't advance\n", s);
+    exit(1);
+  }
+}
+
+// buffered printf() output must come out once, in order,
+// across fork() and exit().
+void
+stdiobuf(char *s)
+{
+  int fds[2], pid, n, m, xstatus;
+  char buf[64];
+  char *want = "hello child\nparent\n";
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    close(1);
+    dup(fds[1]);
+    close(fds[1]);
+    setvbuf(1, _IOFBF);
+    printf("hello ");
+    if((pid = fork()) == 0){
+      printf("child\n");
+      exit(0);
+    }
+    wait(0);
+    printf("parent\n");
+    exit(0);
+  }
+  close(fds[1]);
+  n = 0;
+  while(n < sizeof(buf) - 1 && (m = read(fds[0], buf + n, sizeof(buf) - 1 - n)) > 0)
+    n += m;
+  buf[n] = 0;
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || strcmp(buf, want) != 0){
+    printf("%s: got \"%s\"\n", s, buf);
+    exit(1);
+  }
+}
+
+// small blocks of every size class, freed and reused,
+// and realloc() keeping a block's contents as it grows.
+void
+mallocsmall(char *s)
+{
+  char *p[200], *q;
+  int i, j, n;
+
+  for(j = 0; j < 3; j++){
+    for(i = 0; i < 200; i++){
+      n = 1 + (i * 37) % 3000;
+      if((p[i] = malloc(n)) == 0){
+        printf("%s: malloc(%d) failed\n", s, n);
+        exit(1);
+      }
+      memset(p[i], i, n);
+    }
+    for(i = 0; i < 200; i++){
+      n = 1 + (i * 37) % 3000;
+      if(p[i][0] != (char)i || p[i][n-1] != (char)i){
+        printf("%s: block %d overwritten\n", s, i);
+        exit(1);
+      }
+    }
+    for(i = 0; i < 200; i += 2)
+      free(p[i]);
+    for(i = 1; i < 200; i += 2)
+      free(p[i]);
+  }
+
+  q = 0;
+  for(n = 1; n <= 8192; n *= 2){
+    if((q = realloc(q, n)) == 0){
+      printf("%s: realloc(%d) failed\n", s, n);
+      exit(1);
+    }
+    for(i = 0; i < n/2; i++){
+      if(q[i] != (char)i){
+        printf("%s: realloc lost contents\n", s);
+        exit(1);
+      }
+    }
+    for(i = n/2; i < n; i++)
+      q[i] = i;
+  }
+  free(q);
+}
+
+// writev() gathers in order, readv() scatters, and pread()
+// and pwrite() leave the file offset alone.
+void
+vectorio(char *s)
+{
+  char *file = "vectorio";
+  struct iovec iov[3];
+  char a[4], b[8], c[16];
+  int fd;
+
+  unlink(file);
+  if((fd = open(file, O_CREATE|O_RDWR)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "abc";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "defghij";
+  iov[2].iov_len = 7;
+  if(writev(fd, iov, 3) != 10){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "XY", 2, 4) != 2 || pread(fd, c, 3, 3) != 3 || memcmp(c, "dXY", 3) != 0){
+    printf("%s: pread/pwrite wrong\n", s);
+    exit(1);
+  }
+  // the offset is still at the end.
+  if(write(fd, "k", 1) != 1 || pread(fd, c, sizeof(c), 0) != 11 ||
+     memcmp(c, "abcdXYghijk", 11) != 0){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if((fd = open(file, O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  if(readv(fd, iov, 2) != 11 || memcmp(a, "abcd", 4) != 0 || memcmp(b, "XYghijk", 7) != 0){
+    printf("%s: readv wrong\n", s);
+    exit(1);
+  }
+  if(pread(fd, c, 1, 100) != 0 || read(fd, c, 1) != 0){
+    printf("%s: read past end\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(file);
+}
+
+// write() returns before the log commits; fsync() waits.
+void
+fsynctest(char *s)
+{
+  char *file = "fsynctest";
+  char buf[BSIZE];
+  int fd, i;
+
+  if(fsync(-1) != -1 || fsync(NOFILE) != -1){
+    printf("%s: fsync of a bad fd succeeded\n", s);
+    exit(1);
+  }
+  unlink(file);
+  if((fd = open(file, O_CREATE|O_RDWR)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'f', sizeof(buf));
+  for(i = 0; i < 20; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(i % 5 == 0 && fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(file);
+}
+
+// trace() makes the statistics device count a system call,
+// numbered above 31 too.
+void
+tracestats(char *s)
+{
+  char *buf, *keys[] = { "getpid: #calls ", "openat: #calls " };
+  int n, i, k, pid, fd, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(trace((1L << SYS_getpid) | (1L << SYS_openat)) != 0)
+      exit(1);
+    if((fd = open(".", O_RDONLY)) < 0)
+      exit(1);
+    for(i = 0; i < 10; i++){
+      _getpid();  // getpid() needn't enter the kernel
+      close(openat(fd, ".", O_RDONLY));
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: trace failed\n", s);
+    exit(1);
+  }
+
+  buf = malloc(8192);
+  n = statistics(buf, 8192);
+  for(k = 0; k < sizeof(keys)/sizeof(keys[0]); k++){
+    for(i = 0; i + strlen(keys[k]) <= n; i++){
+      if(memcmp(buf + i, keys[k], strlen(keys[k])) == 0 &&
+         atoi(buf + i + strlen(keys[k])) >= 10)
+        break;
+    }
+    if(i + strlen(keys[k]) > n){
+      printf("%s: %snot counted\n", s, keys[k]);
+      exit(1);
+    }
+  }
+  free(buf);
+}
+
+// getpid() and uptime() read the usyscall page, which
+// user code can't write.
+void
+usyscall(char *s)
+{
+  int pid, xstatus, t;
+
+  if(getpid() != _getpid()){
+    printf("%s: getpid %d, system call says %d\n", s, getpid(), _getpid());
+    exit(1);
+  }
+  t = _uptime();
+  if(uptime() < t || uptime() > t + 1 || uptimens() / 100000000 < t){
+    printf("%s: uptime %d, system call says %d\n", s, uptime(), t);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(getpid() != _getpid())
+      exit(1);
+    *(volatile int *)USYSCALL = 0;
+    exit(2);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: child status %d\n", s, xstatus);
+    exit(1);
+  }
+}
+
+// threads made by clone() share memory, including pages
+// that they fault in at the same time, and join() collects
+// their exit statuses.
+#define NCLONE 4
+static char *clonemem;
+static volatile int clonego;
+
+static void
+clonework(void *arg)
+{
+  int i = (int)(uint64)arg;
+
+  while(!clonego)
+    ;
+  // every thread touches every page of the fresh heap.
+  for(int k = 0; k < 8*4096; k += 64)
+    clonemem[k + i]++;
+  if(i == NCLONE - 1)
+    exit(NCLONE);
+}
+
+void
+clonetest(char *s)
+{
+  static char stacks[NCLONE][4096];
+  int pids[NCLONE], i, k, pid, xstatus, n;
+
+  clonemem = sbrk(8*4096);
+  if(clonemem == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  clonego = 0;
+  for(i = 0; i < NCLONE; i++){
+    pids[i] = clone(clonework, (void*)(uint64)i, stacks[i] + sizeof(stacks[i]));
+    if(pids[i] < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  if(fork() >= 0){
+    printf("%s: fork with threads succeeded\n", s);
+    exit(1);
+  }
+  clonego = 1;
+
+  n = 0;
+  while((pid = join(&xstatus)) > 0){
+    for(i = 0; i < NCLONE && pids[i] != pid; i++)
+      ;
+    if(i == NCLONE || xstatus != (i == NCLONE - 1 ? NCLONE : 0)){
+      printf("%s: join %d status %d\n", s, pid, xstatus);
+      exit(1);
+    }
+    n++;
+  }
+  if(n != NCLONE){
+    printf("%s: joined %d threads\n", s, n);
+    exit(1);
+  }
+  for(k = 0; k < 8*4096; k += 64){
+    for(i = 0; i < NCLONE; i++){
+      if(clonemem[k + i] != 1){
+        printf("%s: thread %d's store at %d lost\n", s, i, k);
+        exit(1);
+      }
+    }
+  }
+  if(wait(0) != -1){
+    printf("%s: wait found a thread\n", s);
+    exit(1);
+  }
+}
+
+// threads take turns at a mutex, and the last one to finish
+// signals a condition variable that the process waits on.
+static struct mutex futexmu;
+static struct cond futexdone;
+static int futexcount, futexfinished;
+
+static void
+futexwork(void *arg)
+{
+  for(int k = 0; k < 1000; k++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+  mutex_lock(&futexmu);
+  if(++futexfinished == NCLONE)
+    cond_signal(&futexdone);
+  mutex_unlock(&futexmu);
+}
+
+void
+futextest(char *s)
+{
+  static char stacks[NCLONE][4096];
+  int i, v = 1;
+
+  if(futexwait(&v, 2) != -1){
+    printf("%s: futexwait on a changed word slept\n", s);
+    exit(1);
+  }
+
+  mutex_init(&futexmu);
+  cond_init(&futexdone);
+  futexcount = futexfinished = 0;
+  for(i = 0; i < NCLONE; i++){
+    if(clone(futexwork, 0, stacks[i] + sizeof(stacks[i])) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  mutex_lock(&futexmu);
+  while(futexfinished < NCLONE)
+    cond_wait(&futexdone, &futexmu);
+  if(futexcount != NCLONE*1000){
+    printf("%s: count %d, not %d\n", s, futexcount, NCLONE*1000);
+    exit(1);
+  }
+  mutex_unlock(&futexmu);
+  for(i = 0; i < NCLONE; i++)
+    join(0);
+}
+
+// getdents() returns every entry in use, a few at a time,
+// with its stat.
+void
+getdentstest(char *s)
+{
+  struct dirstat ds[3];
+  char name[16];
+  int fd, i, n, k, seen;
+
+  if(mkdir("gdents") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++){
+    strcpy(name, "gdents/f0");
+    name[8] = '0' + i;
+    if((fd = open(name, O_CREATE|O_WRONLY)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    write(fd, name, i);
+    close(fd);
+  }
+  unlink("gdents/f3");
+
+  if((fd = open("gdents", O_RDONLY)) < 0){
+    printf("%s: open gdents failed\n", s);
+    exit(1);
+  }
+  seen = 0;
+  while((n = getdents(fd, ds, 3)) > 0){
+    for(k = 0; k < n; k++){
+      if(strcmp(ds[k].name, ".") == 0 || strcmp(ds[k].name, "..") == 0){
+        if(ds[k].type != T_DIR){
+          printf("%s: %s not a directory\n", s, ds[k].name);
+          exit(1);
+        }
+        continue;
+      }
+      i = ds[k].name[1] - '0';
+      if(ds[k].name[0] != 'f' || i < 0 || i > 9 || i == 3 ||
+         ds[k].type != T_FILE || ds[k].size != i || (seen & (1 << i))){
+        printf("%s: bad entry %s\n", s, ds[k].name);
+        exit(1);
+      }
+      seen |= 1 << i;
+    }
+  }
+  close(fd);
+  if(n < 0 || seen != (0x3ff & ~(1 << 3))){
+    printf("%s: getdents returned %d, saw %x\n", s, n, seen);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++){
+    name[8] = '0' + i;
+    unlink(name);
+  }
+  unlink("gdents");
+}
+
+// openat() looks up a relative path in the directory dirfd
+// has open, and an absolute one as open() does.
+void
+openattest(char *s)
+{
+  char buf[8];
+  int dfd, fd;
+
+  if(mkdir("oat") < 0 || mkdir("oat/sub") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  if((dfd = open("oat", O_RDONLY)) < 0){
+    printf("%s: open oat failed\n", s);
+    exit(1);
+  }
+  if((fd = openat(dfd, "sub/f", O_CREATE|O_WRONLY)) < 0){
+    printf("%s: openat create failed\n", s);
+    exit(1);
+  }
+  write(fd, "oat", 3);
+  close(fd);
+
+  if((fd = open("oat/sub/f", O_RDONLY)) < 0 || read(fd, buf, sizeof(buf)) != 3 ||
+     memcmp(buf, "oat", 3) != 0){
+    printf("%s: oat/sub/f not created in oat\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = openat(dfd, "sub/../sub/f", O_RDONLY)) < 0){
+    printf("%s: openat .. failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(openat(dfd, "f", O_RDONLY) >= 0){
+    printf("%s: openat found f in the cwd\n", s);
+    exit(1);
+  }
+  if((fd = openat(dfd, "/README", O_RDONLY)) < 0){
+    printf("%s: openat absolute path failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // a file is no directory to start from.
+  fd = open("oat/sub/f", O_RDONLY);
+  if(openat(fd, "x", O_RDONLY) >= 0 || openat(fd, "x", O_CREATE|O_RDWR) >= 0){
+    printf("%s: openat in a file succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(openat(-1, "sub", O_RDONLY) >= 0){
+    printf("%s: openat with fd -1 succeeded\n", s);
+    exit(1);
+  }
+  close(dfd);
+
+  unlink("oat/sub/f");
+  unlink("oat/sub");
+  unlink("oat");
+}
+
+// spawn() runs a program with the descriptors it is given,
+// and fails, leaving no child, for one that can't be run.
+void
+spawntest(char *s)
+{
+  char *argv[] = { "echo", "spawned", 0 };
+  char buf[16];
+  int p[2], fds[3], n, m, xst;
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fds[0] = -1;
+  fds[1] = p[1];
+  fds[2] = 2;
+  if(spawn("echo", argv, fds, 3) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(p[1]);
+  // echo has the only other write end, so this ends at EOF
+  // once it exits.
+  n = 0;
+  while(n < sizeof(buf) && (m = read(p[0], buf + n, sizeof(buf) - n)) > 0)
+    n += m;
+  if(n != 8 || memcmp(buf, "spawned\n", 8) != 0){
+    printf("%s: wrong output from spawned echo\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  if(wait(&xst) < 0 || xst != 0){
+    printf("%s: spawned echo failed\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", argv, fds, 0) != -1){
+    printf("%s: spawn of a missing program succeeded\n", s);
+    exit(1);
+  }
+  fds[0] = 99;
+  if(spawn("echo", argv, fds, 1) != -1){
+    printf("%s: spawn with a bad descriptor succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
+// poll() waits for whichever pipe is written first, times
+// out, and reports closed pipes and bad descriptors.
+void
+polltest(char *s)
+{
+  struct pollfd fds[2];
+  int a[2], b[2], pid, xst;
+  char c;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = b[0];
+  fds[1].events = POLLIN;
+  if(poll(fds, 2, 0) != 0){
+    printf("%s: empty pipes ready\n", s);
+    exit(1);
+  }
+  if(poll(fds, 2, 100) != 0){
+    printf("%s: timeout didn't\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if(poll(fds, 2, -1) != 1 || fds[0].revents != 0 || fds[1].revents != POLLIN){
+    printf("%s: wrong pipe ready\n", s);
+    exit(1);
+  }
+  if(read(b[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  wait(&xst);
+
+  fds[0].fd = b[1];
+  fds[0].events = POLLOUT;
+  if(poll(fds, 1, 0) != 1 || fds[0].revents != POLLOUT){
+    printf("%s: pipe not writable\n", s);
+    exit(1);
+  }
+
+  close(a[1]);
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = 99;
+  if(poll(fds, 2, -1) != 2 || fds[0].revents != POLLHUP || fds[1].revents != POLLNVAL){
+    printf("%s: no POLLHUP or POLLNVAL\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(b[0]);
+  close(b[1]);
+}
+
+// the profiler should catch this process spinning in user
+// space, and then in the kernel.
+void
+proftest(char *s)
+{
+  static struct profsample samples[32];
+  struct profsample *p;
+  int fd, pfd[2], n, t0, user, kernel;
+
+  if((fd = open("profile", O_RDONLY)) < 0 || pipe(pfd) < 0){
+    printf("%s: open profile failed\n", s);
+    exit(1);
+  }
+  profile(100000);
+  t0 = uptime();
+  while(uptime() < t0 + 3)
+    ;
+  t0 = uptime();
+  while(uptime() < t0 + 3){
+    if(write(pfd[1], buf, 512) != 512 || read(pfd[0], buf, 512) != 512){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+  }
+  user = kernel = 0;
+  while((n = read(fd, samples, sizeof(samples))) > 0){
+    for(p = samples; p < samples + n / sizeof(samples[0]); p++){
+      if(p->nk + p->nu > PROFDEPTH){
+        printf("%s: bad sample\n", s);
+        exit(1);
+      }
+      if(p->pid != getpid())
+        continue;
+      if(p->nu > 0 && p->pc[p->nk] < 0x80000000)
+        user++;
+      if(p->nk > 0 && p->pc[0] >= 0x80000000)
+        kernel++;
+    }
+  }
+  profile(0);
+  close(fd);
+  close(pfd[0]);
+  close(pfd[1]);
+  if(user == 0 || kernel == 0){
+    printf("%s: %d user and %d kernel samples\n", s, user, kernel);
+    exit(1);
+  }
+}
+
+// a system call shows up in the trace, entry then return,
+// with a context switch to this process before them.
+void
+ktracetest(char *s)
+{
+  static struct ktevent ev[64];
+  struct ktevent *e;
+  int fd, n, pid, state;
+
+  if((fd = open("ktrace", O_RDONLY)) < 0){
+    printf("%s: open ktrace failed\n", s);
+    exit(1);
+  }
+  while(read(fd, ev, sizeof(ev)) > 0)
+    ;
+  pid = getpid();
+  sleep(1);
+  _getpid();
+
+  state = 0;
+  while((n = read(fd, ev, sizeof(ev))) > 0){
+    for(e = ev; e < ev + n / sizeof(ev[0]); e++){
+      if(e->type >= KT_NTYPE){
+        printf("%s: bad event type %d\n", s, e->type);
+        exit(1);
+      }
+      if(e->type == KT_SWITCH){
+        // recorded as the process switched from.
+        if(state == 0 && e->b == pid)
+          state = 1;
+      } else if(e->pid == pid){
+        if(state == 1 && e->type == KT_SYSCALL && e->a == SYS_getpid)
+          state = 2;
+        else if(state == 2 && e->type == KT_SYSRET && e->a == SYS_getpid && e->b == pid)
+          state = 3;
+      }
+    }
+  }
+  close(fd);
+  if(state != 3){
+    printf("%s: events missing (%d)\n", s, state);
+    exit(1);
+  }
+}
+
+// a shared memory segment made by one process and attached
+// by another is the same memory in both, even when a pipe
+// read would hand over pages; it goes away with its last
+// mapping.
+void
+shmtest(char *s)
+{
+  enum { N = 3*PGSIZE + 100 };
+  char *a, *b;
+  int p[2], i, len, pid, xstatus;
+
+  if((a = shmcreate("ut-shm", N)) == (char*)-1){
+    printf("%s: shmcreate failed\n", s);
+    exit(1);
+  }
+  if(shmcreate("ut-shm", PGSIZE) != (char*)-1){
+    printf("%s: shmcreate of a taken name worked\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i] = i % 251;
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[1]);
+    if((b = shmattach("ut-shm", &len)) == (char*)-1 || len != 4*PGSIZE){
+      printf("%s: shmattach failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < N; i++){
+      if(b[i] != i % 251){
+        printf("%s: wrong data in attached segment\n", s);
+        exit(1);
+      }
+    }
+    // a whole page, page-aligned, as a pipe could remap.
+    if(read(p[0], b + PGSIZE, PGSIZE) != PGSIZE){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+    b[0] = 'x';
+    exit(0);
+  }
+  close(p[0]);
+  memset(buf, 'y', PGSIZE);
+  if(write(p[1], buf, PGSIZE) != PGSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(p[1]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(a[0] != 'x' || a[PGSIZE] != 'y' || a[2*PGSIZE-1] != 'y' || a[2*PGSIZE] != (2*PGSIZE) % 251){
+    printf("%s: child's stores not seen\n", s);
+    exit(1);
+  }
+  if(munmap(a, N) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(shmattach("ut-shm", 0) != (char*)-1){
+    printf("%s: segment outlived its mappings\n", s);
+    exit(1);
+  }
+}
+
+// more processes than the process table starts with can
+// be alive at once, and are all waited for.
+void
+bigproctable(char *s)
+{
+  enum { N = NPROC + 36 };
+  int p[2], i, n, pid;
+  char c;
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(n = 0; n < N; n++){
+    if((pid = fork()) < 0){
+      printf("%s: fork %d failed\n", s, n);
+      break;
+    }
+    if(pid == 0){
+      // wait until the parent closes the write end.
+      close(p[1]);
+      read(p[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(p[0]);
+  close(p[1]);
+  for(i = 0; i < n; i++){
+    if(wait(0) < 0){
+      printf("%s: wait failed\n", s);
+      exit(1);
+    }
+  }
+  if(wait(0) != -1){
+    printf("%s: extra child\n", s);
+    exit(1);
+  }
+  if(n < N)
+    exit(1);
+}
+
+// the word-at-a-time string routines get heads, tails and
+// overlaps right.
+void
+memops(char *s)
+{
+  static char buf[256], ref[256];
+  int i, n, d, soff, k;
+
+  for(n = 0; n < 80; n++){
+    for(d = 0; d < 9; d++){
+      for(soff = 0; soff < 9; soff++){
+        for(i = 0; i < sizeof(buf); i++)
+          buf[i] = ref[i] = i * 7 + 1;
+        // an overlapping move within buf, in either direction.
+        memmove(buf + 64 + d, buf + 64 + soff * 3, n);
+        if(d < soff * 3){
+          for(k = 0; k < n; k++)
+            ref[64 + d + k] = ref[64 + soff * 3 + k];
+        } else {
+          for(k = n - 1; k >= 0; k--)
+            ref[64 + d + k] = ref[64 + soff * 3 + k];
+        }
+        if(memcmp(buf, ref, sizeof(buf)) != 0){
+          printf("%s: memmove(%d, %d, %d) wrong\n", s, d, soff * 3, n);
+          exit(1);
+        }
+
+        memset(buf + d, 0xa5, n);
+        for(k = 0; k < n; k++)
+          ref[d + k] = 0xa5;
+        if(memcmp(buf, ref, sizeof(buf)) != 0){
+          printf("%s: memset(%d, %d) wrong\n", s, d, n);
+          exit(1);
+        }
+
+        if(n > 0){
+          ref[soff + n - 1]++;
+          if(memcmp(buf + soff, ref + soff, n) == 0 || memcmp(buf + soff, ref + soff, n - 1) != 0){
+            printf("%s: memcmp(%d, %d) wrong\n", s, soff, n);
+            exit(1);
+          }
+          ref[soff + n - 1]--;
+        }
+
+        memset(buf, 'x', sizeof(buf));
+        buf[d + n] = 0;
+        if(strlen(buf + d) != n){
+          printf("%s: strlen(%d, %d) wrong\n", s, d, n);
+          exit(1);
+        }
+      }
+    }
+  }
+}
+
+// regression test. test whether exec() leaks memory if one of the
+// arguments is invalid. the test passes if the kernel doesn't panic.
+void
+badarg(char *s)
+{
+  for(int i = 0; i < 50000; i++){
+    char *argv[2];
+    argv[0] = (char*)0xffffffff;
+    argv[1] = 0;
+    exec("echo", argv);
+  }
+  
+  exit(0);
+}
+
+struct test {
+  void (*f)(char *);
+  char *s;
+} quicktests[] = {
+  {copyin, "copyin"},
+  {copyout, "copyout"},
+  {copyinstr1, "copyinstr1"},
+  {copyinstr2, "copyinstr2"},
+  {copyinstr3, "copyinstr3"},
+  {rwsbrk, "rwsbrk" },
+  {truncate1, "truncate1"},
+  {truncate2, "truncate2"},
+  {truncate3, "truncate3"},
+  {openiputtest, "openiput"},
+  {exitiputtest, "exitiput"},
+  {iputtest, "iput"},
+  {opentest, "opentest"},
+  {writetest, "writetest"},
+  {writebig, "writebig"},
+  {createtest, "createtest"},
+  {dirtest, "dirtest"},
+  {exectest, "exectest"},
+  {pipe1, "pipe1"},
+  {pipepage, "pipepage"},
+  {killstatus, "killstatus"},
+  {preempt, "preempt"},
+  {exitwait, "exitwait"},
+  {reparent, "reparent" },
+  {twochildren, "twochildren"},
+  {forkfork, "forkfork"},
+  {forkforkfork, "forkforkfork"},
+  {reparent2, "reparent2"},
+  {mem, "mem"},
+  {sharedfd, "sharedfd"},
+  {fourfiles, "fourfiles"},
+  {createdelete, "createdelete"},
+  {unlinkread, "unlinkread"},
+  {linktest, "linktest"},
+  {concreate, "concreate"},
+  {linkunlink, "linkunlink"},
+  {subdir, "subdir"},
+  {bigwrite, "bigwrite"},
+  {bigfile, "bigfile"},
+  {fourteen, "fourteen"},
+  {rmdot, "rmdot"},
+  {dirfile, "dirfile"},
+  {iref, "iref"},
+  {forktest, "forktest"},
+  {sbrkbasic, "sbrkbasic"},
+  {sbrkmuch, "sbrkmuch"},
+  {kernmem, "kernmem"},
+  {MAXVAplus, "MAXVAplus"},
+  {sbrkfail, "sbrkfail"},
+  {sbrkarg, "sbrkarg"},
+  {validatetest, "validatetest"},
+  {bsstest, "bsstest"},
+  {bigargtest, "bigargtest"},
+  {manyargs, "manyargs"},
+  {topexec, "topexec"},
+  {argptest, "argptest"},
+  {stacktest, "stacktest"},
+  {textwrite, "textwrite"},
+  {pgbug, "pgbug" },
+  {sbrkbugs, "sbrkbugs" },
+  {sbrklast, "sbrklast"},
+  {sbrk8000, "sbrk8000"},
+  {sbrklazy, "sbrklazy"},
+  {cowfork, "cowfork"},
+  {superpage, "superpage"},
+  {setprio, "setprio"},
+  {mmapfile, "mmapfile"},
+  {sleepq, "sleepq"},
+  {stdiobuf, "stdiobuf"},
+  {mallocsmall, "mallocsmall"},
+  {vectorio, "vectorio"},
+  {fsynctest, "fsynctest"},
+  {tracestats, "tracestats"},
+  {usyscall, "usyscall"},
+  {memops, "memops"},
+  {clonetest, "clonetest"},
+  {futextest, "futextest"},
+  {getdentstest, "getdentstest"},
+  {openattest, "openattest"},
+  {spawntest, "spawntest"},
+  {bigproctable, "bigproctable"},
+  {polltest, "polltest"},
+  {proftest, "proftest"},
+  {ktracetest, "ktracetest"},
+  {shmtest, "shmtest"},
+  {badarg, "badarg" },
+
+  { 0, 0},
+};
+
+//
+// Section with tests that take a fair bit of time
+//
+
+// directory that uses indirect blocks
+void
+bigdir(char *s)
+{
+  enum { N = 500 };
+  int i, fd;
+  char name[10];
+
+  unlink("bd");
+
+  fd = open("bd", O_CREATE);
+  if(fd < 0){
+    printf("%s: bigdir create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[0] = 'x';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if(link("bd", name) != 0){
+      printf("%s: bigdir link(bd, %s) failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  unlink("bd");
+  for(i = 0; i < N; i++){
+    name[0] = 'x';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if(unlink(name) != 0){
+      printf("%s: bigdir unlink failed", s);
+      exit(1);
+    }
+  }
+}
+
+// concurrent writes to try to provoke deadlock in the virtio disk
+// driver.
+void
+manywrites(char *s)
+{
+  int nchildren = 4;
+  int howmany = 30; // increase to look for deadlock
+  
   for(int ci = 0; ci < nchildren; ci++){
     int pid = fork();
     if(pid < 0){
@@ -2924,6 +4352,59 @@ outofinodes(char *s)
   }
 }
 
+// touch as much memory as the machine has, which only fits
+// if some pages are paged out, and find it all intact, in
+// a child after fork() too.
+void
+swaptest(char *s)
+{
+  enum { NPG = (PHYSTOP - KERNBASE) / PGSIZE };
+  int i, pid, xstatus;
+  char *a;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if((a = sbrk(NPG * PGSIZE)) == (char*)-1){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < NPG; i++)
+      *(int*)(a + i*PGSIZE) = i;
+    for(i = 0; i < NPG; i++){
+      if(*(int*)(a + i*PGSIZE) != i){
+        printf("%s: page %d lost\n", s, i);
+        exit(1);
+      }
+    }
+    // room for the child's page table; the lower half, the
+    // least recently used, is mostly paged out.
+    sbrk(-(NPG/2) * PGSIZE);
+    if((pid = fork()) < 0){
+      printf("%s: fork with pages out failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < NPG/2; i += 64){
+      if(*(int*)(a + i*PGSIZE) != i){
+        printf("%s: page %d lost after fork\n", s, i);
+        exit(1);
+      }
+    }
+    if(pid == 0)
+      exit(0);
+    wait(&xstatus);
+    exit(xstatus);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child failed (%d)\n", s, xstatus);
+    exit(1);
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +4412,7 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {swaptest, "swaptest"},
     
   { 0, 0},
 };
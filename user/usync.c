@@ -0,0 +1,83 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+// Locks and condition variables for threads made by clone(),
+// on futexwait() and futexwake(). Taking a free mutex or
+// releasing one that nobody waits for is a single atomic
+// instruction, without a system call.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // contended: mark it as having waiters, then sleep until
+  // it's released. whoever takes it this way leaves it
+  // marked, since others may still be waiting.
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futexwait(&m->state, 2);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+// Take m if it is free. Returns 1 if it was taken, else 0.
+int
+mutex_trylock(struct mutex *m)
+{
+  return __sync_bool_compare_and_swap(&m->state, 0, 1);
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1){
+    // there may be waiters.
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    futexwake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, wait for a signal on c, and take m again.
+// As with any condition variable, the caller must check
+// its condition again on return.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+
+  mutex_unlock(m);
+  // returns at once if there was a signal since the load.
+  futexwait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futexwake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+  futexwake(&c->seq, NPROC);
+}
@@ -6,24 +6,28 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry(name) makes name() the system call SYS_name;
+# entry(name, call) makes name() the system call SYS_call.
 sub entry {
     my $name = shift;
+    my $call = @_ ? shift : $name;
     print ".global $name\n";
     print "${name}:\n";
-    print " li a7, SYS_${name}\n";
+    print " li a7, SYS_${call}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+# ulib.c wraps these, to flush printf()'s buffers first.
+entry("_fork", "fork");
+entry("_exit", "exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
 entry("close");
 entry("kill");
-entry("exec");
+entry("_exec", "exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -32,7 +36,30 @@ entry("link");
 entry("mkdir");
 entry("chdir");
 entry("dup");
-entry("getpid");
+entry("_getpid", "getpid");
 entry("sbrk");
 entry("sleep");
-entry("uptime");
+entry("_uptime", "uptime");
+entry("setpriority");
+entry("mmap");
+entry("munmap");
+entry("_uptimens", "uptimens");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("fsync");
+entry("trace");
+entry("_clone", "clone");
+entry("join");
+entry("futexwait");
+entry("futexwake");
+entry("getdents");
+entry("spawn");
+entry("poll");
+entry("connect");
+entry("recvpage");
+entry("profile");
+entry("shmcreate");
+entry("shmattach");
+entry("openat");
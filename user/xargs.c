@@ -0,0 +1,165 @@
+// Build and run commands from standard input.
+//
+// usage: xargs [-n max] [-P procs] command [arg ...]
+//
+// Runs command with its args followed by words read from
+// standard input, which are separated by spaces, tabs and
+// newlines. Each command gets as many words as exec() takes
+// (fewer than MAXARG arguments, in ARGPAGES pages), or at
+// most max, so a long input runs a few commands rather than
+// one per word. With -P, up to procs commands run at once.
+// Exits with status 1 if any command failed.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// bytes of strings and argv[] one command may have. exec()
+// wastes at most the end of each page packing words up to
+// MAXPATH bytes long.
+#define ARGBYTES (ARGPAGES * (PGSIZE - MAXPATH))
+
+char *args[MAXARG];
+int nfixed, nargs;       // arguments from the command line, and all
+int nbytes, fixedbytes;  // bytes they take up
+char strs[ARGBYTES];     // the words read for the next command
+char *next = strs;
+
+int maxwords = MAXARG, maxprocs = 1;
+int running, failed;
+
+char buf[512];
+int bufn, bufi;
+
+void
+usage(void)
+{
+  fprintf(2, "usage: xargs [-n max] [-P procs] command [arg ...]\n");
+  exit(1);
+}
+
+// Wait for one of the commands to finish.
+void
+reap(void)
+{
+  int xstatus;
+
+  if(wait(&xstatus) < 0){
+    fprintf(2, "xargs: wait failed\n");
+    exit(1);
+  }
+  if(xstatus != 0)
+    failed = 1;
+  running--;
+}
+
+// Run the command with the words read so far, if any,
+// once there's a free slot for it.
+void
+run(void)
+{
+  int pid;
+
+  if(nargs == nfixed)
+    return;
+  args[nargs] = 0;
+  while(running >= maxprocs)
+    reap();
+  if((pid = fork()) < 0){
+    fprintf(2, "xargs: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(args[0], args);
+    fprintf(2, "xargs: exec %s failed\n", args[0]);
+    exit(1);
+  }
+  running++;
+  nargs = nfixed;
+  nbytes = fixedbytes;
+  next = strs;
+}
+
+int
+getch(void)
+{
+  if(bufi == bufn){
+    if((bufn = read(0, buf, sizeof(buf))) <= 0)
+      return -1;
+    bufi = 0;
+  }
+  return (uchar)buf[bufi++];
+}
+
+// Read the next word of standard input into w, which has
+// room for MAXPATH bytes. Returns its length, or -1 at the
+// end of the input.
+int
+getword(char *w)
+{
+  int c, n;
+
+  while((c = getch()) >= 0 && strchr(" \t\r\n", c))
+    ;
+  for(n = 0; c >= 0 && !strchr(" \t\r\n", c); c = getch()){
+    if(n == MAXPATH-1){
+      fprintf(2, "xargs: word too long\n");
+      exit(1);
+    }
+    w[n++] = c;
+  }
+  w[n] = 0;
+  return n > 0 ? n : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char word[MAXPATH];
+  int i, n;
+
+  for(i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2){
+    if(strcmp(argv[i], "-n") == 0)
+      maxwords = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-P") == 0)
+      maxprocs = atoi(argv[i+1]);
+    else
+      usage();
+    if(maxwords < 1 || maxprocs < 1)
+      usage();
+  }
+  if(i >= argc)
+    usage();
+
+  for(; i < argc; i++){
+    if(nfixed == MAXARG - 2){
+      fprintf(2, "xargs: too many arguments\n");
+      exit(1);
+    }
+    args[nfixed++] = argv[i];
+    fixedbytes += strlen(argv[i]) + 1 + sizeof(char*);
+  }
+  // and argv[]'s null.
+  fixedbytes += sizeof(char*);
+  nargs = nfixed;
+  nbytes = fixedbytes;
+
+  while((n = getword(word)) >= 0){
+    if(nargs - nfixed == maxwords || nargs == MAXARG - 1 ||
+       nbytes + n + 1 + sizeof(char*) > ARGBYTES)
+      run();
+    if(nbytes + n + 1 + sizeof(char*) > ARGBYTES){
+      fprintf(2, "xargs: arguments too long\n");
+      exit(1);
+    }
+    memmove(next, word, n + 1);
+    args[nargs++] = next;
+    next += n + 1;
+    nbytes += n + 1 + sizeof(char*);
+  }
+  run();
+  while(running > 0)
+    reap();
+  exit(failed);
+}